@@ -0,0 +1,164 @@
+#include "actionsink.h"
+
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusMessage>
+#include <QDebug>
+#include <QProcess>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/uinput.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+typedef struct {
+    const char  *name;
+    int         code;
+} KeyName;
+
+// The keys a headset button is likely to be bound to, anything else can be
+// given by number.
+static const KeyName keyNames[] = {
+    { "KEY_MUTE",           KEY_MUTE },
+    { "KEY_VOLUMEDOWN",     KEY_VOLUMEDOWN },
+    { "KEY_VOLUMEUP",       KEY_VOLUMEUP },
+    { "KEY_PLAYPAUSE",      KEY_PLAYPAUSE },
+    { "KEY_PLAY",           KEY_PLAY },
+    { "KEY_PAUSE",          KEY_PAUSE },
+    { "KEY_STOPCD",         KEY_STOPCD },
+    { "KEY_NEXTSONG",       KEY_NEXTSONG },
+    { "KEY_PREVIOUSSONG",   KEY_PREVIOUSSONG },
+    { "KEY_MICMUTE",        KEY_MICMUTE },
+    { "KEY_MEDIA",          KEY_MEDIA },
+    { "KEY_F20",            KEY_F20 },
+};
+
+ActionSink::~ActionSink()
+{
+}
+
+void ActionSink::prepare(const QList<ButtonAction> &actions)
+{
+    Q_UNUSED(actions);
+}
+
+int ActionSink::keyCode(const QString &name)
+{
+    for( const KeyName &k : keyNames )
+    {
+        if( name == k.name )
+            return k.code;
+    }
+
+    bool ok = false;
+    int code = name.toInt(&ok, 0);
+    return ok && code > 0 && code <= KEY_MAX ? code : -1;
+}
+
+SystemActionSink::SystemActionSink()
+    : m_uinput{-1}
+{
+}
+
+SystemActionSink::~SystemActionSink()
+{
+    if( m_uinput >= 0 )
+    {
+        ioctl(m_uinput, UI_DEV_DESTROY);
+        ::close(m_uinput);
+    }
+}
+
+void SystemActionSink::prepare(const QList<ButtonAction> &actions)
+{
+    if( m_uinput >= 0 )
+        return;
+
+    // Only create the device when something is bound to a key, and up front
+    // so it has been picked up by the time the first key is sent.
+    QList<int> keys;
+    for( const ButtonAction &a : actions )
+    {
+        if( a.type == ActionKey && !keys.contains(a.key) )
+            keys.push_back(a.key);
+    }
+    if( keys.isEmpty() )
+        return;
+
+    m_uinput = ::open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if( m_uinput < 0 )
+    {
+        qDebug() << "SystemActionSink: Failed to open /dev/uinput:" << strerror(errno);
+        return;
+    }
+
+    struct uinput_setup setup;
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_VIRTUAL;
+    setup.id.vendor = 0x046d;
+    setup.id.product = 0x0ab5;
+    strncpy(setup.name, "G733 headset buttons", UINPUT_MAX_NAME_SIZE - 1);
+
+    bool ok = ioctl(m_uinput, UI_SET_EVBIT, EV_KEY) >= 0;
+    for( int key : keys )
+        ok = ok && ioctl(m_uinput, UI_SET_KEYBIT, key) >= 0;
+    ok = ok && ioctl(m_uinput, UI_DEV_SETUP, &setup) >= 0 && ioctl(m_uinput, UI_DEV_CREATE) >= 0;
+    if( !ok )
+    {
+        qDebug() << "SystemActionSink: Failed to create the uinput device:" << strerror(errno);
+        ::close(m_uinput);
+        m_uinput = -1;
+    }
+}
+
+void SystemActionSink::run(const ButtonAction &action)
+{
+    switch( action.type )
+    {
+    case ActionKey:
+    {
+        if( m_uinput < 0 )
+            return;
+
+        // Press, sync, release, sync in one write.
+        struct input_event ev[4];
+        memset(ev, 0, sizeof(ev));
+        ev[0].type = ev[2].type = EV_KEY;
+        ev[0].code = ev[2].code = action.key;
+        ev[0].value = 1;
+        ev[1].type = ev[3].type = EV_SYN;
+        ev[1].code = ev[3].code = SYN_REPORT;
+        if( ::write(m_uinput, ev, sizeof(ev)) < 0 )
+            qDebug() << "SystemActionSink: Failed to send key" << action.key << strerror(errno);
+        break;
+    }
+
+    case ActionCall:
+    {
+        QDBusMessage call = QDBusMessage::createMethodCall(action.service, action.path, action.interface, action.method);
+        for( const QString &arg : action.args )
+            call << arg;
+        QDBusConnection::sessionBus().send(call);
+        break;
+    }
+
+    case ActionCommand:
+    {
+        // startDetached() forks and waits for the exec, which is left to the
+        // main thread so the I/O thread carries on reading.
+        const QString program = action.program;
+        const QStringList args = action.args;
+        auto start = [program, args]() {
+            if( !QProcess::startDetached(program, args) )
+                qDebug() << "SystemActionSink: Failed to start" << program;
+        };
+        if( QCoreApplication::instance() )
+            QMetaObject::invokeMethod( QCoreApplication::instance(), start, Qt::QueuedConnection );
+        else
+            start();
+        break;
+    }
+    }
+}
@@ -0,0 +1,55 @@
+#ifndef ACTIONSINK_H
+#define ACTIONSINK_H
+
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+typedef enum {
+    ActionKey,          // a key press and release through uinput
+    ActionCall,         // a D-Bus method call, reply ignored
+    ActionCommand       // a detached process
+} ActionType;
+
+typedef struct {
+    ActionType  type;
+    int         key;        // linux input key code
+    QString     service;    // ActionCall
+    QString     path;
+    QString     interface;
+    QString     method;
+    QString     program;    // ActionCommand
+    QStringList args;       // method or program arguments
+} ButtonAction;
+
+// Where ButtonEngine sends actions, called on the I/O thread. Implementations
+// must not block.
+class ActionSink
+{
+public:
+    virtual ~ActionSink();
+
+    // Every action that may be run later, before the first run().
+    virtual void prepare(const QList<ButtonAction> &actions);
+    virtual void run(const ButtonAction &action) = 0;
+
+    // Key code of a KEY_* name such as KEY_PLAYPAUSE, or of a number. -1 if
+    // unknown.
+    static int keyCode(const QString &name);
+};
+
+// Emits keys on a uinput device created in prepare(), sends method calls on
+// the session bus and has the main thread start commands.
+class SystemActionSink : public ActionSink
+{
+    int     m_uinput;
+
+public:
+    SystemActionSink();
+    ~SystemActionSink() override;
+
+    void prepare(const QList<ButtonAction> &actions) override;
+    void run(const ButtonAction &action) override;
+};
+
+#endif // ACTIONSINK_H
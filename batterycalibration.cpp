@@ -0,0 +1,183 @@
+#include "batterycalibration.h"
+
+#include <QDebug>
+#include <QSettings>
+#include <QStringList>
+
+BatteryCalibration::BatteryCalibration()
+{
+    reset();
+}
+
+void BatteryCalibration::reset()
+{
+    for( int k=0; k < CALIBRATION_KNOTS; k++ )
+        m_soc[k] = 0;
+    m_cycles = 0;
+
+    for( qint64 &t : m_time )
+        t = 0;
+    m_active = false;
+    m_charging = false;
+    m_ranFlat = false;
+    m_lastSample = -1;
+    m_lastVoltage = 0;
+    m_lastStaticSoC = 0;
+}
+
+// [<serial>]
+// Cycles=3
+// Curve=0,0.4,...      ; percent per knot
+// Active=true          ; and the rest, the discharge in progress
+// Time=0,120000,...    ; ms per band
+bool BatteryCalibration::load(const QString &path, const QString &serial)
+{
+    reset();
+
+    QSettings settings(path, QSettings::IniFormat);
+    settings.beginGroup(serial);
+    if( !settings.contains("Cycles") )
+        return false;
+
+    const QStringList curve = settings.value("Curve").toStringList().join(",").split(',');
+    const QStringList time = settings.value("Time").toStringList().join(",").split(',');
+    if( curve.size() != CALIBRATION_KNOTS || time.size() != CALIBRATION_KNOTS - 1 )
+        return false;
+
+    m_cycles = qMax(0, settings.value("Cycles").toInt());
+    for( int k=0; k < CALIBRATION_KNOTS; k++ )
+        m_soc[k] = qBound(0.0f, curve[k].toFloat(), 100.0f);
+    for( int b=0; b < CALIBRATION_KNOTS - 1; b++ )
+        m_time[b] = qMax<qint64>(0, time[b].toLongLong());
+
+    m_active = settings.value("Active").toBool();
+    m_charging = settings.value("Charging").toBool();
+    m_ranFlat = settings.value("RanFlat").toBool();
+    m_lastVoltage = settings.value("LastVoltage").toInt();
+    m_lastStaticSoC = settings.value("LastSoC").toDouble();
+
+    // Whatever happened while the daemon wasn't looking is a gap.
+    m_lastSample = -1;
+    return true;
+}
+
+bool BatteryCalibration::save(const QString &path, const QString &serial) const
+{
+    QStringList curve;
+    for( float soc : m_soc )
+        curve.push_back(QString::number(soc, 'f', 2));
+    QStringList time;
+    for( qint64 t : m_time )
+        time.push_back(QString::number(t));
+
+    QSettings settings(path, QSettings::IniFormat);
+    settings.beginGroup(serial);
+    settings.setValue("Cycles", m_cycles);
+    settings.setValue("Curve", curve.join(","));
+    settings.setValue("Active", m_active);
+    settings.setValue("Charging", m_charging);
+    settings.setValue("RanFlat", m_ranFlat);
+    settings.setValue("Time", time.join(","));
+    settings.setValue("LastVoltage", m_lastVoltage);
+    settings.setValue("LastSoC", m_lastStaticSoC);
+    settings.endGroup();
+    settings.sync();
+    if( settings.status() != QSettings::NoError )
+    {
+        qDebug() << "BatteryCalibration: Failed to write" << path;
+        return false;
+    }
+    return true;
+}
+
+int BatteryCalibration::band(int voltage)
+{
+    return qBound(0, (voltage - CALIBRATION_MIN_VOLTAGE) / CALIBRATION_STEP, CALIBRATION_KNOTS - 2);
+}
+
+bool BatteryCalibration::sample(qint64 now, int voltage, bool charging, double staticSoC)
+{
+    if( charging )
+    {
+        // Only a discharge that ran flat says where empty is.
+        const bool finished = m_active && m_ranFlat && finishCycle();
+
+        m_active = false;
+        m_charging = true;
+        m_lastSample = -1;
+        return finished;
+    }
+
+    // Off the charger, a discharge starts if it's full.
+    if( m_charging )
+    {
+        m_charging = false;
+        m_active = staticSoC >= CALIBRATION_FULL_SOC;
+        for( qint64 &t : m_time )
+            t = 0;
+    }
+
+    if( !m_active )
+        return false;
+
+    // The draw between two readings is put down to the earlier one's band.
+    if( m_lastSample >= 0 && now > m_lastSample && now - m_lastSample <= CALIBRATION_MAX_GAP )
+        m_time[band(m_lastVoltage)] += now - m_lastSample;
+
+    m_lastSample = now;
+    m_lastVoltage = voltage;
+    m_lastStaticSoC = staticSoC;
+    m_ranFlat = false;
+    return false;
+}
+
+void BatteryCalibration::offline(bool lostPower)
+{
+    if( lostPower && m_active && !m_charging && m_lastSample >= 0 )
+        m_ranFlat = m_lastStaticSoC < CALIBRATION_FLAT_SOC;
+    m_lastSample = -1;
+}
+
+bool BatteryCalibration::finishCycle()
+{
+    qint64 total = 0;
+    for( qint64 t : m_time )
+        total += t;
+    if( total <= 0 )
+        return false;
+
+    // Charge left at knot k is the time spent below it.
+    const float weight = float(qMin(m_cycles, CALIBRATION_WINDOW - 1));
+    qint64 below = 0;
+    for( int k=0; k < CALIBRATION_KNOTS; k++ )
+    {
+        const float soc = float(100.0 * below / total);
+        m_soc[k] = (m_soc[k] * weight + soc) / (weight + 1);
+        if( k < CALIBRATION_KNOTS - 1 )
+            below += m_time[k];
+    }
+    m_cycles++;
+    return true;
+}
+
+bool BatteryCalibration::active() const
+{
+    return m_active;
+}
+
+bool BatteryCalibration::converged() const
+{
+    return m_cycles >= CALIBRATION_CYCLES;
+}
+
+int BatteryCalibration::cycles() const
+{
+    return m_cycles;
+}
+
+double BatteryCalibration::soc(int voltage) const
+{
+    const int b = band(voltage);
+    const double f = qBound(0.0, double(voltage - CALIBRATION_MIN_VOLTAGE - b * CALIBRATION_STEP) / CALIBRATION_STEP, 1.0);
+    return m_soc[b] + (m_soc[b + 1] - m_soc[b]) * f;
+}
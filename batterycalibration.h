@@ -0,0 +1,67 @@
+#ifndef BATTERYCALIBRATION_H
+#define BATTERYCALIBRATION_H
+
+#include <QString>
+#include <QtGlobal>
+
+#define CALIBRATION_MIN_VOLTAGE 3300    // mV at the first knot
+#define CALIBRATION_STEP        30      // mV between knots
+#define CALIBRATION_KNOTS       33      // up to 4260 mV
+#define CALIBRATION_CYCLES      2       // full discharges before the curve is used
+#define CALIBRATION_WINDOW      4       // cycles the curve averages over, so it follows aging
+#define CALIBRATION_MAX_GAP     600000  // ms between readings, longer counts as switched off
+#define CALIBRATION_FULL_SOC    95      // static SoC a discharge has to start from
+#define CALIBRATION_FLAT_SOC    10      // static SoC below which losing the headset means it ran flat
+
+// Learns one headset's discharge curve from its own full discharges. A
+// discharge starts when the charger comes off a full battery and counts once
+// the headset ran flat and went back on the charger. At constant draw the
+// charge left at a voltage is the share of the discharge's online time
+// spent below it, so time is summed per voltage band as readings come in and
+// turned into SoC per knot at the end. The curve is piecewise linear over
+// fixed knots and a running average over the last CALIBRATION_WINDOW
+// discharges.
+class BatteryCalibration
+{
+    float   m_soc[CALIBRATION_KNOTS];       // learned percent at each knot
+    int     m_cycles;
+
+    // The discharge in progress.
+    qint64  m_time[CALIBRATION_KNOTS - 1];  // ms online between knot i and i+1
+    bool    m_active;
+    bool    m_charging;
+    bool    m_ranFlat;
+    qint64  m_lastSample;                   // ms since the epoch, -1 after a gap
+    int     m_lastVoltage;
+    double  m_lastStaticSoC;
+
+public:
+    BatteryCalibration();
+
+    void reset();
+
+    // Group serial of path, an INI file.
+    bool load(const QString &path, const QString &serial);
+    bool save(const QString &path, const QString &serial) const;
+
+    // A reading, O(1). staticSoC is what the built-in curve makes of it.
+    // Returns true when it completed a discharge and updated the curve.
+    bool sample(qint64 now, int voltage, bool charging, double staticSoC);
+
+    // The headset stopped answering, lostPower if it just stopped rather
+    // than went to sleep or was unplugged.
+    void offline(bool lostPower);
+
+    bool active() const;        // a discharge is being followed
+    bool converged() const;
+    int cycles() const;
+
+    // Percent at voltage, interpolated between the knots.
+    double soc(int voltage) const;
+
+protected:
+    static int band(int voltage);
+    bool finishCycle();     // false if the discharge had no time to learn from
+};
+
+#endif // BATTERYCALIBRATION_H
@@ -0,0 +1,57 @@
+#include "batterycurve.h"
+
+#include <algorithm>
+
+BatteryCurve::BatteryCurve()
+    : m_minVoltage{0},
+      m_static{nullptr},
+      m_size{0}
+{
+}
+
+void BatteryCurve::build(const QList< QPair<int, double> > &samples)
+{
+    m_table.clear();
+    m_static = nullptr;
+    m_size = 0;
+    if( samples.isEmpty() )
+        return;
+
+    QVector<BatteryCurvePoint> sorted;
+    sorted.reserve(samples.size());
+    for( const QPair<int, double> &s : samples )
+        sorted.push_back({ s.first, s.second });
+
+    std::sort(sorted.begin(), sorted.end(), [](const BatteryCurvePoint &a, const BatteryCurvePoint &b) {
+        return a.voltage < b.voltage;
+    });
+
+    m_minVoltage = sorted.first().voltage;
+    m_size = sorted.last().voltage - m_minVoltage + 1;
+    m_table.resize(m_size);
+    fillBatteryCurve(sorted.constData(), sorted.size(), m_table.data());
+}
+
+bool BatteryCurve::isEmpty() const
+{
+    return m_size == 0;
+}
+
+int BatteryCurve::minVoltage() const
+{
+    return m_minVoltage;
+}
+
+int BatteryCurve::maxVoltage() const
+{
+    return m_minVoltage + m_size - 1;
+}
+
+double BatteryCurve::soc(int voltage) const
+{
+    if( m_size == 0 )
+        return 0;
+
+    const float *table = m_static ? m_static : m_table.constData();
+    return table[ qBound(0, voltage - m_minVoltage, m_size - 1) ];
+}
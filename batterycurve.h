@@ -0,0 +1,111 @@
+#ifndef BATTERYCURVE_H
+#define BATTERYCURVE_H
+
+#include <QList>
+#include <QPair>
+#include <QVector>
+
+#include <cstddef>
+#include <iterator>
+
+typedef struct {
+    int     voltage;    // mV
+    double  soc;        // percent
+} BatteryCurvePoint;
+
+template<std::size_t N>
+struct BatteryCurveTable {
+    int     minVoltage;
+    float   soc[N];
+};
+
+// Fills one entry per millivolt from points sorted by voltage. Each entry is
+// the highest SoC seen at or below that voltage, interpolated linearly between
+// the distinct voltages, so the curve is monotonic despite noise in the
+// recordings. Usable both at compile time and at runtime.
+constexpr void fillBatteryCurve(const BatteryCurvePoint *sorted, int count, float *table)
+{
+    const int minVoltage = sorted[0].voltage;
+
+    int i = 0;
+    double best = sorted[0].soc;
+    while( i < count && sorted[i].voltage == minVoltage )
+    {
+        if( sorted[i].soc > best )
+            best = sorted[i].soc;
+        i++;
+    }
+    table[0] = float(best);
+
+    int prevVoltage = minVoltage;
+    double prevSoC = best;
+    while( i < count )
+    {
+        const int voltage = sorted[i].voltage;
+        while( i < count && sorted[i].voltage == voltage )
+        {
+            if( sorted[i].soc > best )
+                best = sorted[i].soc;
+            i++;
+        }
+
+        for( int v=prevVoltage+1; v <= voltage; v++ )
+            table[v - minVoltage] = float(prevSoC + (best - prevSoC) * (v - prevVoltage) / (voltage - prevVoltage));
+
+        prevVoltage = voltage;
+        prevSoC = best;
+    }
+}
+
+template<std::size_t N>
+constexpr std::size_t batteryCurveSpan(const BatteryCurvePoint (&sorted)[N])
+{
+    return sorted[N-1].voltage - sorted[0].voltage + 1;
+}
+
+template<std::size_t Span>
+constexpr BatteryCurveTable<Span> compileBatteryCurve(const BatteryCurvePoint *sorted, int count)
+{
+    BatteryCurveTable<Span> t{};
+    t.minVoltage = sorted[0].voltage;
+    fillBatteryCurve(sorted, count, t.soc);
+    return t;
+}
+
+// Used by the headers generated from maps/*.csv.
+#define BATTERY_CURVE(points) \
+    compileBatteryCurve<batteryCurveSpan(points)>(points, int(std::size(points)))
+
+// Voltage to state-of-charge mapping with one entry per millivolt over the
+// range the samples cover, so lookups are O(1). Either wraps a table compiled
+// into the binary or owns one built from samples at runtime.
+class BatteryCurve
+{
+    int             m_minVoltage;
+    const float     *m_static;
+    int             m_size;
+    QVector<float>  m_table;
+
+public:
+    BatteryCurve();
+
+    template<std::size_t N>
+    BatteryCurve(const BatteryCurveTable<N> &table)
+        : m_minVoltage{table.minVoltage},
+          m_static{table.soc},
+          m_size{int(N)}
+    {
+    }
+
+    // Samples are (millivolts, percent) in any order.
+    void build(const QList< QPair<int, double> > &samples);
+
+    bool isEmpty() const;
+    int minVoltage() const;
+    int maxVoltage() const;
+
+    // Clamped to the ends of the table outside of the sampled range.
+    double soc(int voltage) const;
+};
+
+#endif // BATTERYCURVE_H
@@ -0,0 +1,111 @@
+#include "batteryestimator.h"
+
+#define VOLTAGE_ALPHA   0.3     // weight of a new reading
+#define MIN_SAMPLES     4
+#define MIN_SPAN        60.0    // seconds covered before estimating
+#define HYSTERESIS_ABS  60      // seconds
+#define HYSTERESIS_REL  0.1     // of the published value
+
+BatteryEstimator::BatteryEstimator()
+{
+    reset();
+}
+
+void BatteryEstimator::reset()
+{
+    m_head = 0;
+    m_count = 0;
+    m_sumT = m_sumS = m_sumTT = m_sumTS = 0;
+    m_voltage = -1;
+    m_charging = false;
+    m_timeToEmpty = 0;
+    m_timeToFull = 0;
+}
+
+void BatteryEstimator::setCharging(bool charging)
+{
+    if( charging == m_charging )
+        return;
+
+    reset();
+    m_charging = charging;
+}
+
+double BatteryEstimator::filterVoltage(int voltage)
+{
+    if( m_voltage < 0 )
+        m_voltage = voltage;
+    else
+        m_voltage += VOLTAGE_ALPHA * (voltage - m_voltage);
+
+    return m_voltage;
+}
+
+void BatteryEstimator::sample(qint64 msecs, double soc)
+{
+    double t = msecs / 1000.0;
+    if( m_count == ESTIMATOR_SAMPLES )
+    {
+        const Sample &old = m_ring[m_head];
+        m_sumT -= old.t;
+        m_sumS -= old.soc;
+        m_sumTT -= old.t * old.t;
+        m_sumTS -= old.t * old.soc;
+    }
+    else
+        m_count++;
+
+    m_ring[m_head] = { t, soc };
+    m_head = (m_head + 1) % ESTIMATOR_SAMPLES;
+    m_sumT += t;
+    m_sumS += soc;
+    m_sumTT += t * t;
+    m_sumTS += t * soc;
+
+    int oldest = (m_head + ESTIMATOR_SAMPLES - m_count) % ESTIMATOR_SAMPLES;
+    if( m_count < MIN_SAMPLES || t - m_ring[oldest].t < MIN_SPAN )
+        return;
+
+    double s = slope();
+    int empty = 0;
+    int full = 0;
+    if( !m_charging && s < 0 )
+        empty = qRound(soc / -s);
+    else if( m_charging && s > 0 )
+        full = qRound((100.0 - soc) / s);
+
+    if( moved(m_timeToEmpty, empty) )
+        m_timeToEmpty = empty;
+    if( moved(m_timeToFull, full) )
+        m_timeToFull = full;
+}
+
+int BatteryEstimator::timeToEmpty() const
+{
+    return m_timeToEmpty;
+}
+
+int BatteryEstimator::timeToFull() const
+{
+    return m_timeToFull;
+}
+
+double BatteryEstimator::slope() const
+{
+    // Least squares, percent per second.
+    double n = m_count;
+    double denom = n * m_sumTT - m_sumT * m_sumT;
+    if( denom <= 0 )
+        return 0;
+
+    return (n * m_sumTS - m_sumT * m_sumS) / denom;
+}
+
+bool BatteryEstimator::moved(int published, int estimate)
+{
+    if( (published == 0) != (estimate == 0) )
+        return true;
+
+    int threshold = qMax(HYSTERESIS_ABS, int(published * HYSTERESIS_REL));
+    return qAbs(estimate - published) > threshold;
+}
@@ -0,0 +1,54 @@
+#ifndef BATTERYESTIMATOR_H
+#define BATTERYESTIMATOR_H
+
+#include <QtGlobal>
+
+#define ESTIMATOR_SAMPLES 32
+
+// Time-to-empty/full from the SoC slope over the last ESTIMATOR_SAMPLES
+// readings. The least-squares sums are kept up to date as samples enter and
+// leave the ring, so each sample costs O(1).
+class BatteryEstimator
+{
+    typedef struct {
+        double  t;      // seconds
+        double  soc;    // percent
+    } Sample;
+
+    Sample  m_ring[ESTIMATOR_SAMPLES];
+    int     m_head;
+    int     m_count;
+    double  m_sumT;
+    double  m_sumS;
+    double  m_sumTT;
+    double  m_sumTS;
+
+    double  m_voltage;  // filtered, < 0 until the first reading
+    bool    m_charging;
+
+    int     m_timeToEmpty;
+    int     m_timeToFull;
+
+public:
+    BatteryEstimator();
+
+    void reset();
+
+    // Starts over on a plug or unplug, the slope means nothing across one.
+    void setCharging(bool charging);
+
+    // Exponential moving average of the readings, to feed the SoC curve.
+    double filterVoltage(int voltage);
+
+    void sample(qint64 msecs, double soc);
+
+    // Seconds, 0 when unknown. Only change when the estimate moves meaningfully.
+    int timeToEmpty() const;
+    int timeToFull() const;
+
+protected:
+    double slope() const;
+    static bool moved(int published, int estimate);
+};
+
+#endif // BATTERYESTIMATOR_H
@@ -0,0 +1,254 @@
+#include "buttonengine.h"
+
+#include <QDebug>
+#include <QProcess>
+#include <QtAlgorithms>
+#include <QSettings>
+
+#include <algorithm>
+
+ButtonEngine::ButtonEngine()
+    : m_longPress{BUTTON_LONG_PRESS},
+      m_down{0},
+      m_consumed{0}
+{
+    for( qint64 &t : m_pressedAt )
+        t = 0;
+}
+
+// [Buttons]
+// LongPress=500
+//
+// [Binding-mute]
+// Buttons=0            ; indices as in buttonPressed(), "0,1" for a chord
+// Trigger=tap          ; press, tap or long
+// Key=KEY_MICMUTE      ; or Call=<service> <path> <interface>.<method> [args]
+//                      ; or Command=<program> [args]
+void ButtonEngine::loadSettings()
+{
+    QSettings settings;
+    int longPress = qMax(50, settings.value("Buttons/LongPress", BUTTON_LONG_PRESS).toInt());
+
+    QList<ButtonBinding> bindings;
+    const QStringList groups = settings.childGroups();
+    for( const QString &group : groups )
+    {
+        if( !group.startsWith("Binding-") )
+            continue;
+
+        ButtonBinding b;
+        b.name = group.mid(8);
+        b.mask = 0;
+
+        settings.beginGroup(group);
+        const QStringList buttons = settings.value("Buttons").toStringList().join(",").split(',');
+        for( const QString &s : buttons )
+        {
+            bool ok = false;
+            int i = s.trimmed().toInt(&ok);
+            if( ok && i >= 0 && i < BUTTON_COUNT )
+                b.mask |= 1 << i;
+        }
+
+        QString trigger = settings.value("Trigger", "press").toString();
+        b.trigger = trigger == "tap" ? TriggerTap : trigger == "long" ? TriggerLong : TriggerPress;
+
+        bool parsed = false;
+        for( const char *key : { "Key", "Call", "Command" } )
+        {
+            if( settings.contains(key) )
+            {
+                // Unquoted commas split INI values into lists.
+                parsed = parseAction(key, settings.value(key).toStringList().join(","), b.action);
+                break;
+            }
+        }
+        settings.endGroup();
+
+        if( !b.mask || !parsed || (trigger != "press" && trigger != "tap" && trigger != "long") )
+        {
+            qDebug() << "ButtonEngine: Ignoring binding" << b.name;
+            continue;
+        }
+        bindings.push_back(b);
+    }
+
+    setBindings(bindings, longPress);
+}
+
+void ButtonEngine::setBindings(const QList<ButtonBinding> &bindings, int longPress)
+{
+    m_bindings = bindings;
+    m_longPress = longPress;
+    std::stable_sort(m_bindings.begin(), m_bindings.end(), [](const ButtonBinding &a, const ButtonBinding &b) {
+        return qPopulationCount(a.mask) > qPopulationCount(b.mask);
+    });
+    reset();
+}
+
+QList<ButtonAction> ButtonEngine::actions() const
+{
+    QList<ButtonAction> result;
+    for( const ButtonBinding &b : m_bindings )
+        result.push_back(b.action);
+    return result;
+}
+
+bool ButtonEngine::isEmpty() const
+{
+    return m_bindings.isEmpty();
+}
+
+bool ButtonEngine::parseAction(const QString &key, const QString &value, ButtonAction &action)
+{
+    action.key = -1;
+    if( key == "Key" )
+    {
+        action.type = ActionKey;
+        action.key = ActionSink::keyCode(value.trimmed());
+        return action.key > 0;
+    }
+
+    const QStringList parts = QProcess::splitCommand(value);
+    if( key == "Call" )
+    {
+        int dot = parts.size() >= 3 ? parts[2].lastIndexOf('.') : -1;
+        if( dot <= 0 )
+            return false;
+
+        action.type = ActionCall;
+        action.service = parts[0];
+        action.path = parts[1];
+        action.interface = parts[2].left(dot);
+        action.method = parts[2].mid(dot + 1);
+        action.args = parts.mid(3);
+        return true;
+    }
+
+    if( key == "Command" && !parts.isEmpty() )
+    {
+        action.type = ActionCommand;
+        action.program = parts.first();
+        action.args = parts.mid(1);
+        return true;
+    }
+
+    return false;
+}
+
+qint64 ButtonEngine::pressedAt(quint8 mask) const
+{
+    // A chord counts from its last button.
+    qint64 at = 0;
+    for( int i=0; i < BUTTON_COUNT; i++ )
+    {
+        if( (mask & (1 << i)) && m_pressedAt[i] > at )
+            at = m_pressedAt[i];
+    }
+    return at;
+}
+
+bool ButtonEngine::armed(const ButtonBinding &b) const
+{
+    if( b.trigger != TriggerLong || (m_down & b.mask) != b.mask || (m_consumed & b.mask) )
+        return false;
+
+    // The chord's own time counts from its last button, which may be later.
+    for( const ButtonBinding &c : m_bindings )
+    {
+        if( c.trigger == TriggerLong && c.mask != b.mask && (c.mask & b.mask) == b.mask
+            && (m_down & c.mask) == c.mask && !(m_consumed & c.mask) )
+            return false;
+    }
+    return true;
+}
+
+void ButtonEngine::fire(const ButtonBinding &b, ActionSink *sink)
+{
+    if( sink )
+        sink->run(b.action);
+}
+
+int ButtonEngine::update(quint8 buttons, qint64 now, ActionSink *sink)
+{
+    // Long presses that came due before this report.
+    int count = expire(now, sink);
+
+    const quint8 before = m_down;
+    const quint8 pressed = buttons & ~before;
+    const quint8 released = before & ~buttons;
+    for( int i=0; i < BUTTON_COUNT; i++ )
+    {
+        if( pressed & (1 << i) )
+            m_pressedAt[i] = now;
+    }
+    m_down = buttons;
+
+    for( const ButtonBinding &b : m_bindings )
+    {
+        switch( b.trigger )
+        {
+        case TriggerPress:
+            if( (b.mask & pressed) && (buttons & b.mask) == b.mask )
+            {
+                fire(b, sink);
+                count++;
+                if( qPopulationCount(b.mask) > 1 )
+                    m_consumed |= b.mask;
+            }
+            break;
+
+        case TriggerTap:
+            if( (b.mask & released) && (before & b.mask) == b.mask && !(m_consumed & b.mask)
+                && now - pressedAt(b.mask) < m_longPress )
+            {
+                fire(b, sink);
+                count++;
+                m_consumed |= b.mask;
+            }
+            break;
+
+        case TriggerLong:
+            break;
+        }
+    }
+
+    m_consumed &= m_down;
+    return count;
+}
+
+int ButtonEngine::expire(qint64 now, ActionSink *sink)
+{
+    int count = 0;
+    for( const ButtonBinding &b : m_bindings )
+    {
+        if( armed(b) && now - pressedAt(b.mask) >= m_longPress )
+        {
+            fire(b, sink);
+            count++;
+            m_consumed |= b.mask;
+        }
+    }
+    return count;
+}
+
+qint64 ButtonEngine::nextDeadline() const
+{
+    qint64 next = -1;
+    for( const ButtonBinding &b : m_bindings )
+    {
+        if( !armed(b) )
+            continue;
+
+        qint64 due = pressedAt(b.mask) + m_longPress;
+        if( next < 0 || due < next )
+            next = due;
+    }
+    return next;
+}
+
+void ButtonEngine::reset()
+{
+    m_down = 0;
+    m_consumed = 0;
+}
@@ -0,0 +1,69 @@
+#ifndef BUTTONENGINE_H
+#define BUTTONENGINE_H
+
+#include <QList>
+#include <QString>
+
+#include "actionsink.h"
+
+#define BUTTON_COUNT        8       // bits in a button report
+#define BUTTON_LONG_PRESS   500     // ms, default for Buttons/LongPress
+
+typedef enum {
+    TriggerPress,       // as soon as all of the buttons are down
+    TriggerTap,         // released again before the long press time
+    TriggerLong         // held for the long press time
+} ButtonTrigger;
+
+typedef struct {
+    QString         name;
+    quint8          mask;       // more than one bit is a chord
+    ButtonTrigger   trigger;
+    ButtonAction    action;
+} ButtonBinding;
+
+// Turns button masks into actions. Taps and long presses of a chord take the
+// place of those of its buttons, so releasing a chord doesn't also tap each
+// button in it. Presses fire straight away and always do. Times are in ms.
+class ButtonEngine
+{
+    QList<ButtonBinding> m_bindings;   // widest chords first
+    int     m_longPress;
+
+    quint8  m_down;
+    quint8  m_consumed;             // down, but already part of a fired chord or long press
+    qint64  m_pressedAt[BUTTON_COUNT];
+
+public:
+    ButtonEngine();
+
+    // Reads the "Buttons" group and one "Binding-<name>" group per binding.
+    void loadSettings();
+    void setBindings(const QList<ButtonBinding> &bindings, int longPress);
+    QList<ButtonAction> actions() const;
+    bool isEmpty() const;
+
+    // Feeds the latest button mask and runs whatever it triggers on sink.
+    // Returns the number of actions run.
+    int update(quint8 buttons, qint64 now, ActionSink *sink);
+
+    // Runs long presses that are due. Returns the number of actions run.
+    int expire(qint64 now, ActionSink *sink);
+
+    // When expire() next has something to do, -1 if never.
+    qint64 nextDeadline() const;
+
+    // Forgets the buttons held without running anything, on disconnect.
+    void reset();
+
+    static bool parseAction(const QString &key, const QString &value, ButtonAction &action);
+
+protected:
+    qint64 pressedAt(quint8 mask) const;
+    // A long press waiting for its time: all of its buttons down, none used
+    // up, and no wider long press held over them.
+    bool armed(const ButtonBinding &b) const;
+    void fire(const ButtonBinding &b, ActionSink *sink);
+};
+
+#endif // BUTTONENGINE_H
@@ -9,27 +9,94 @@ CONFIG += link_pkgconfig
 # In order to do so, uncomment the following line.
 #DEFINES += QT_DISABLE_DEPRECATED_BEFORE=0x060000    # disables all the APIs deprecated before Qt 6.0.0
 
-PKGCONFIG += hidapi-hidraw
+PKGCONFIG += hidapi-hidraw libudev
 
 SOURCES += \
+        actionsink.cpp \
+        batterycalibration.cpp \
+        batterycurve.cpp \
+        batteryestimator.cpp \
+        buttonengine.cpp \
         headsetdbusservice.cpp \
         headsethid.cpp \
-        main.cpp
+        headsetmanager.cpp \
+        headsetmanagerdbusservice.cpp \
+        hidppdecoder.cpp \
+        hidtransport.cpp \
+        hotplugmonitor.cpp \
+        lightingengine.cpp \
+        main.cpp \
+        pollscheduler.cpp \
+        settingsstore.cpp \
+        telemetryhistory.cpp \
+        tracering.cpp
 
 # Default rules for deployment.
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
 !isEmpty(target.path): INSTALLS += target
 
+# Lets the session bus start the daemon on demand, it exits again a minute
+# after the last headset is gone.
+unix:!android {
+    QMAKE_SUBSTITUTES += org.logitech.Headset.Power.service.in
+    dbus_service.files = $$OUT_PWD/org.logitech.Headset.Power.service
+    dbus_service.path = /usr/share/dbus-1/services
+    dbus_service.CONFIG += no_check_exist
+    INSTALLS += dbus_service
+}
+
 HEADERS += \
+    actionsink.h \
+    batterycalibration.h \
+    batterycurve.h \
+    batteryestimator.h \
+    buttonengine.h \
     headsetdbusservice.h \
-    headsethid.h
+    headsethid.h \
+    headsetmanager.h \
+    headsetmanagerdbusservice.h \
+    headsetstats.h \
+    hidppdecoder.h \
+    hidtransport.h \
+    hotplugmonitor.h \
+    lightingengine.h \
+    pollscheduler.h \
+    seqlock.h \
+    settingsstore.h \
+    spscqueue.h \
+    telemetryhistory.h \
+    tracering.h
+
+# Request latency histograms and counters on org.logitech.Headset.Stats and a
+# local socket. CONFIG -= headset_stats leaves them out entirely.
+CONFIG += headset_stats
+headset_stats {
+    DEFINES += HEADSET_STATS
+    SOURCES += headsetstats.cpp headsetstatsdbusservice.cpp statsexporter.cpp
+    HEADERS += headsetstatsdbusservice.h statsexporter.h
+}
+
+# Events above this level are compiled out of the trace ring: 0 errors,
+# 1 info, 2 debug (every request and reply).
+DEFINES += TRACE_LEVEL=1
 
 DISTFILES += \
+    org.logitech.Headset.Power.service.in \
     maps/charging_ascending.csv \
     maps/charging_descending.csv \
+    maps/discharging.csv \
+    maps/csv2header.sh
+
+# Battery curves are compiled in as constexpr tables, <name>_curve.h per CSV.
+CURVES = \
+    maps/charging_ascending.csv \
     maps/discharging.csv
 
-resources.files = $${DISTFILES}
-resources.prefix = /
-RESOURCES += resources
+curves.input = CURVES
+curves.output = ${QMAKE_FILE_BASE}_curve.h
+curves.commands = sh $$PWD/maps/csv2header.sh ${QMAKE_FILE_IN} ${QMAKE_FILE_BASE} > ${QMAKE_FILE_OUT}
+curves.depends = $$PWD/maps/csv2header.sh
+curves.CONFIG += no_link target_predeps
+QMAKE_EXTRA_COMPILERS += curves
+INCLUDEPATH += $$OUT_PWD
@@ -1,18 +1,165 @@
 #include "headsetdbusservice.h"
 
 #include <QCoreApplication>
-#include <QTimer>
+#include <QFile>
+#include <QSettings>
+#include <QtDBus/QDBusArgument>
+#include <QtDBus/QDBusMessage>
 
-HeadsetDBusService::HeadsetDBusService(QObject *obj, HeadsetHID *h)
+#include <fcntl.h>
+#include <unistd.h>
+
+HeadsetDBusService::HeadsetDBusService(QObject *obj, HeadsetHID *h, const QString &path, const QDBusConnection &bus)
     : QDBusAbstractAdaptor{obj},
-      m_hid(h)
+      m_hid(nullptr),
+      m_path(path),
+      m_bus(bus),
+      m_minInterval(100),
+      m_legacySignals(false),
+      m_signalsEmitted(0),
+      m_changesCoalesced(0),
+      m_changesSuppressed(0),
+      m_nextTicket(0)
+{
+    QSettings settings;
+    m_minInterval = qMax(0, settings.value("Signals/MinInterval", m_minInterval).toInt());
+    m_legacySignals = settings.value("Signals/Legacy", m_legacySignals).toBool();
+
+    // Voltage jitters by a few mV between readings.
+    m_deadband.insert("voltage", 10);
+    settings.beginGroup("Deadband");
+    const QStringList keys = settings.childKeys();
+    for( const QString &key : keys )
+        m_deadband.insert(key, settings.value(key).toDouble());
+    settings.endGroup();
+
+    connect( &m_flushTimer, &QTimer::timeout, this, &HeadsetDBusService::flushProperties );
+    m_flushTimer.setSingleShot(true);
+    m_lastFlush.start();
+
+    setHeadset(h);
+}
+
+void HeadsetDBusService::setHeadset(HeadsetHID *h)
 {
-    connect( m_hid, &HeadsetHID::chargingChanged, this, &HeadsetDBusService::chargingChanged );
-    connect( m_hid, &HeadsetHID::onlineChanged, this, &HeadsetDBusService::onlineChanged );
-    connect( m_hid, &HeadsetHID::voltageChanged, this, &HeadsetDBusService::voltageChanged );
-    connect( m_hid, &HeadsetHID::socChanged, this, &HeadsetDBusService::socChanged );
-    connect( m_hid, &HeadsetHID::lightingChanged, this, &HeadsetDBusService::lightingChanged );
+    if( m_hid == h )
+        return;
+
+    if( m_hid )
+        disconnect( m_hid, nullptr, this, nullptr );
+
+    m_hid = h;
+    propertiesReset();
+    if( !m_hid )
+        return;
+
+    connect( m_hid, &HeadsetHID::chargingChanged, this, [this](bool onoff) { propertyChanged("charging", onoff); } );
+    connect( m_hid, &HeadsetHID::onlineChanged, this, [this](bool onoff) { propertyChanged("online", onoff); } );
+    connect( m_hid, &HeadsetHID::voltageChanged, this, [this](double voltage) { propertyChanged("voltage", int(voltage)); } );
+    connect( m_hid, &HeadsetHID::socChanged, this, [this](int soc) { propertyChanged("soc", soc); } );
+    connect( m_hid, &HeadsetHID::lightingChanged, this, [this](bool onoff) { propertyChanged("lighting", onoff); } );
+    connect( m_hid, &HeadsetHID::pollIntervalChanged, this, [this](int interval) { propertyChanged("pollInterval", interval); } );
+    connect( m_hid, &HeadsetHID::timeToEmptyChanged, this, [this](int seconds) { propertyChanged("timeToEmpty", seconds); } );
+    connect( m_hid, &HeadsetHID::timeToFullChanged, this, [this](int seconds) { propertyChanged("timeToFull", seconds); } );
+    connect( m_hid, &HeadsetHID::sidetoneChanged, this, [this](int level) { propertyChanged("sidetone", level); } );
     connect( m_hid, &HeadsetHID::buttonPressed, this, &HeadsetDBusService::buttonPressed );
+    // Queued even when emitted on this thread, so applySettings() has
+    // registered every ticket before the first one is answered.
+    connect( m_hid, &HeadsetHID::settingApplied, this, &HeadsetDBusService::settingApplied, Qt::QueuedConnection );
+}
+
+void HeadsetDBusService::propertiesReset()
+{
+    // Whatever differs from what clients last saw goes out in one batch.
+    propertyChanged("online", online());
+    propertyChanged("charging", charging());
+    propertyChanged("voltage", voltage());
+    propertyChanged("soc", soc());
+    propertyChanged("lighting", lighting());
+    propertyChanged("pollInterval", pollInterval());
+    propertyChanged("timeToEmpty", timeToEmpty());
+    propertyChanged("timeToFull", timeToFull());
+    propertyChanged("sidetone", sidetone());
+}
+
+void HeadsetDBusService::propertyChanged(const QString &name, const QVariant &value)
+{
+    if( m_pending.contains(name) )
+        m_changesCoalesced++;
+    m_pending.insert(name, value);
+
+    // Everything changed by the same batch of reports lands in one flush.
+    if( !m_flushTimer.isActive() )
+        m_flushTimer.start( qMax<qint64>(0, m_minInterval - m_lastFlush.elapsed()) );
+}
+
+void HeadsetDBusService::flushProperties()
+{
+    QVariantMap changed;
+    for( auto it = m_pending.constBegin(); it != m_pending.constEnd(); ++it )
+    {
+        auto published = m_published.constFind(it.key());
+        if( published != m_published.constEnd() )
+        {
+            if( published.value() == it.value() )
+                continue;
+
+            double deadband = m_deadband.value(it.key(), 0);
+            if( deadband > 0 && qAbs(it.value().toDouble() - published.value().toDouble()) < deadband )
+            {
+                m_changesSuppressed++;
+                continue;
+            }
+        }
+
+        changed.insert(it.key(), it.value());
+        m_published.insert(it.key(), it.value());
+    }
+    m_pending.clear();
+    m_lastFlush.restart();
+
+    if( changed.isEmpty() )
+        return;
+
+    QDBusMessage msg = QDBusMessage::createSignal(m_path, "org.freedesktop.DBus.Properties", "PropertiesChanged");
+    msg << QString(SERVICE_INTERFACE) << changed << QStringList();
+    m_bus.send(msg);
+    m_signalsEmitted++;
+
+    // The per-property signals older clients listen for, from the same batch,
+    // only when asked for: each one is another broadcast.
+    if( !m_legacySignals )
+        return;
+
+    for( auto it = changed.constBegin(); it != changed.constEnd(); ++it )
+    {
+        const QString &name = it.key();
+        const QVariant &value = it.value();
+        m_signalsEmitted++;
+        if( name == "online" )
+            emit onlineChanged(value.toBool());
+        else if( name == "charging" )
+            emit chargingChanged(value.toBool());
+        else if( name == "voltage" )
+            emit voltageChanged(value.toInt());
+        else if( name == "soc" )
+            emit socChanged(value.toInt());
+        else if( name == "lighting" )
+            emit lightingChanged(value.toBool());
+        else if( name == "pollInterval" )
+            emit pollIntervalChanged(value.toInt());
+        else if( name == "timeToEmpty" )
+            emit timeToEmptyChanged(value.toInt());
+        else if( name == "timeToFull" )
+            emit timeToFullChanged(value.toInt());
+        else if( name == "sidetone" )
+            emit sidetoneChanged(value.toInt());
+    }
+}
+
+HeadsetHID *HeadsetDBusService::headset() const
+{
+    return m_hid;
 }
 
 bool HeadsetDBusService::online()
@@ -55,6 +202,228 @@ int HeadsetDBusService::soc()
     return -1;
 }
 
+int HeadsetDBusService::pollInterval()
+{
+    if( m_hid )
+        return m_hid->pollInterval();
+
+    return 0;
+}
+
+int HeadsetDBusService::timeToEmpty()
+{
+    if( m_hid )
+        return m_hid->timeToEmpty();
+
+    return 0;
+}
+
+int HeadsetDBusService::timeToFull()
+{
+    if( m_hid )
+        return m_hid->timeToFull();
+
+    return 0;
+}
+
+int HeadsetDBusService::sidetone()
+{
+    if( m_hid )
+        return m_hid->sidetone();
+
+    return -1;
+}
+
+qulonglong HeadsetDBusService::signalsEmitted()
+{
+    return m_signalsEmitted;
+}
+
+qulonglong HeadsetDBusService::changesCoalesced()
+{
+    return m_changesCoalesced;
+}
+
+qulonglong HeadsetDBusService::changesSuppressed()
+{
+    return m_changesSuppressed;
+}
+
+qulonglong HeadsetDBusService::unknownReports()
+{
+    return m_hid ? m_hid->state().unknownReports : 0;
+}
+
+qulonglong HeadsetDBusService::readWakeups()
+{
+    return m_hid ? m_hid->state().wakeups : 0;
+}
+
+int HeadsetDBusService::reportsDrainedMax()
+{
+    return m_hid ? m_hid->state().drainedMax : 0;
+}
+
+qulonglong HeadsetDBusService::queueOverruns()
+{
+    return m_hid ? m_hid->state().overruns : 0;
+}
+
+int HeadsetDBusService::requestQueueDepth()
+{
+    return m_hid ? m_hid->state().queueDepth : 0;
+}
+
+int HeadsetDBusService::requestQueueDepthMax()
+{
+    return m_hid ? m_hid->state().queueDepthMax : 0;
+}
+
+qulonglong HeadsetDBusService::requestsSuperseded()
+{
+    return m_hid ? m_hid->state().requestsSuperseded : 0;
+}
+
+qulonglong HeadsetDBusService::requestsDropped()
+{
+    return m_hid ? m_hid->state().requestsDropped : 0;
+}
+
+int HeadsetDBusService::commandLatencyMax()
+{
+    return m_hid ? m_hid->state().commandLatencyMax : 0;
+}
+
+int HeadsetDBusService::timeToReady()
+{
+    return m_hid ? m_hid->state().timeToReady : -1;
+}
+
+bool HeadsetDBusService::featuresCached()
+{
+    return m_hid ? m_hid->state().featuresCached : false;
+}
+
+int HeadsetDBusService::timeToRestore()
+{
+    return m_hid ? m_hid->state().timeToRestore : -1;
+}
+
+int HeadsetDBusService::calibrationCycles()
+{
+    return m_hid ? m_hid->state().calibrationCycles : 0;
+}
+
+qulonglong HeadsetDBusService::lightingWrites()
+{
+    return m_hid ? m_hid->state().lightingWrites : 0;
+}
+
+qulonglong HeadsetDBusService::lightingFramesSkipped()
+{
+    return m_hid ? m_hid->state().lightingFramesSkipped : 0;
+}
+
+qulonglong HeadsetDBusService::buttonActions()
+{
+    return m_hid ? m_hid->state().buttonActions : 0;
+}
+
+int HeadsetDBusService::buttonLatencyMax()
+{
+    return m_hid ? m_hid->state().buttonLatencyMax : 0;
+}
+
+// Properties are ints on the bus, apart from the switches.
+static QVariant stateVariant(int property, qint32 value)
+{
+    if( property == StateOnline || property == StateCharging || property == StateLighting )
+        return bool(value);
+
+    return int(value);
+}
+
+QVariantMap HeadsetDBusService::state()
+{
+    QVariantMap result;
+    if( !m_hid )
+    {
+        result["sequence"] = qulonglong(0);
+        result["online"] = false;
+        return result;
+    }
+
+    const HeadsetState st = m_hid->state();
+    result["sequence"] = qulonglong(st.sequence);
+    for( int p=0; p < StatePropertyCount; p++ )
+        result[HeadsetHID::statePropertyName(p)] = stateVariant(p, HeadsetHID::stateValue(st, p));
+    return result;
+}
+
+QVariantMap HeadsetDBusService::changesSince(qulonglong sequence)
+{
+    QMap<int, qint32> changes;
+    quint64 current = 0;
+    if( !m_hid || !m_hid->changesSince(sequence, changes, &current) )
+    {
+        QVariantMap result = state();
+        result["snapshot"] = true;
+        return result;
+    }
+
+    QVariantMap result;
+    result["sequence"] = qulonglong(current);
+    result["snapshot"] = false;
+    for( auto it = changes.constBegin(); it != changes.constEnd(); ++it )
+        result[HeadsetHID::statePropertyName(it.key())] = stateVariant(it.key(), it.value());
+    return result;
+}
+
+// The history lives on the I/O thread and is unmapped when the headset
+// closes, so both are answered from there.
+QByteArray HeadsetDBusService::history(qint64 from, qint64 to)
+{
+    if( !m_hid )
+        return QByteArray();
+
+    HeadsetHID *hid = m_hid;
+    QDBusConnection bus = m_bus;
+    QDBusMessage call = message();
+    setDelayedReply(true);
+    QMetaObject::invokeMethod( hid, [hid, bus, call, from, to]() mutable {
+        bus.send(call.createReply(QVariant(hid->history(from, to, HISTORY_QUERY_MAX))));
+    }, Qt::QueuedConnection );
+    return QByteArray();
+}
+
+QDBusUnixFileDescriptor HeadsetDBusService::historyFile()
+{
+    if( !m_hid )
+    {
+        sendErrorReply(QDBusError::Failed, "No history available.");
+        return QDBusUnixFileDescriptor();
+    }
+
+    HeadsetHID *hid = m_hid;
+    QDBusConnection bus = m_bus;
+    QDBusMessage call = message();
+    setDelayedReply(true);
+    QMetaObject::invokeMethod( hid, [hid, bus, call]() mutable {
+        QString path = hid->historyFile();
+        int fd = path.isEmpty() ? -1 : ::open(QFile::encodeName(path).constData(), O_RDONLY | O_CLOEXEC);
+        if( fd < 0 )
+        {
+            bus.send(call.createErrorReply(QDBusError::Failed, "No history available."));
+            return;
+        }
+
+        QDBusUnixFileDescriptor result;
+        result.giveFileDescriptor(fd);
+        bus.send(call.createReply(QVariant::fromValue(result)));
+    }, Qt::QueuedConnection );
+    return QDBusUnixFileDescriptor();
+}
+
 void HeadsetDBusService::setLighting(bool onoff)
 {
     if( !m_hid )
@@ -63,6 +432,279 @@ void HeadsetDBusService::setLighting(bool onoff)
     m_hid->enableLighting(onoff);
 }
 
+void HeadsetDBusService::setSidetone(int level)
+{
+    if( !m_hid )
+        return;
+
+    m_hid->setSidetone(level);
+}
+
+void HeadsetDBusService::setZoneEffect(const QString &zone, const QString &effect, uint color, int period, int brightness)
+{
+    int z = LightingEngine::zoneFromName(zone);
+    int mode = LightingEngine::modeFromName(effect);
+    if( z < 0 || mode < 0 )
+    {
+        sendErrorReply(QDBusError::InvalidArgs, "Unknown lighting zone or effect.");
+        return;
+    }
+
+    if( !m_hid )
+        return;
+
+    LightingEffect e;
+    e.mode = mode;
+    e.color = color & 0xffffff;
+    e.period = quint16(qBound(0, period, 0xffff));
+    e.brightness = quint8(qBound(0, brightness, 100));
+    m_hid->setZoneEffect(z, e);
+}
+
+QVariantMap HeadsetDBusService::zoneEffect(const QString &zone)
+{
+    QVariantMap result;
+    int z = LightingEngine::zoneFromName(zone);
+    if( z < 0 )
+    {
+        sendErrorReply(QDBusError::InvalidArgs, "Unknown lighting zone.");
+        return result;
+    }
+
+    LightingEffect e = m_hid ? m_hid->zoneEffect(z) : LightingEngine::offEffect();
+    result["effect"] = QString::fromLatin1(LightingEngine::modeName(e.mode));
+    result["color"] = uint(e.color);
+    result["period"] = int(e.period);
+    result["brightness"] = int(e.brightness);
+    return result;
+}
+
+// Everything one applySettings() call asks of a zone, and the keys that
+// asked for it.
+typedef struct {
+    QStringList     keys;
+    LightingEffect  effect;
+} ZoneChange;
+
+static const char *applyResultName(int result)
+{
+    switch( result )
+    {
+    case ApplyDone:         return "applied";
+    case ApplyFailed:       return "failed";
+    case ApplyTimedOut:     return "timeout";
+    case ApplyOffline:      return "offline";
+    case ApplySuperseded:   return "superseded";
+    }
+    return "failed";
+}
+
+// A key covering more than one zone reports the worst of them.
+static int applySeverity(int result)
+{
+    switch( result )
+    {
+    case ApplyDone:         return 0;
+    case ApplySuperseded:   return 1;
+    case ApplyOffline:      return 2;
+    case ApplyTimedOut:     return 3;
+    }
+    return 4;
+}
+
+// Overlays the fields of value, an a{sv}, on effect.
+static bool parseZoneEffect(const QVariant &value, LightingEffect &effect)
+{
+    QVariantMap fields;
+    if( value.userType() == qMetaTypeId<QDBusArgument>() )
+        fields = qdbus_cast<QVariantMap>(value.value<QDBusArgument>());
+    else if( value.userType() == QMetaType::QVariantMap )
+        fields = value.toMap();
+    else
+        return false;
+
+    for( auto it = fields.constBegin(); it != fields.constEnd(); ++it )
+    {
+        bool ok = false;
+        if( it.key() == "effect" )
+        {
+            int mode = LightingEngine::modeFromName(it.value().toString());
+            ok = mode >= 0;
+            effect.mode = quint8(mode);
+        }
+        else if( it.key() == "color" )
+            effect.color = it.value().toUInt(&ok) & 0xffffff;
+        else if( it.key() == "period" )
+            effect.period = quint16(qBound(0, it.value().toInt(&ok), 0xffff));
+        else if( it.key() == "brightness" )
+            effect.brightness = quint8(qBound(0, it.value().toInt(&ok), 100));
+
+        if( !ok )
+            return false;
+    }
+    return true;
+}
+
+QVariantMap HeadsetDBusService::applySettings(const QVariantMap &settings)
+{
+    QVariantMap results;
+    ZoneChange zones[LightingZoneCount];
+    for( int z=0; z < LightingZoneCount; z++ )
+        zones[z].effect = m_hid ? m_hid->zoneEffect(z) : LightingEngine::offEffect();
+
+    // "lighting" first, so "logo" and "strips" refine it rather than race
+    // it: each zone gets one change, answered under every key that made it.
+    if( settings.contains("lighting") )
+    {
+        const QVariant value = settings.value("lighting");
+        if( value.userType() != QMetaType::Bool )
+            results["lighting"] = "invalid";
+        else
+        {
+            for( ZoneChange &c : zones )
+            {
+                c.keys.push_back("lighting");
+                c.effect = value.toBool() ? LightingEngine::defaultEffect() : LightingEngine::offEffect();
+            }
+        }
+    }
+
+    int sidetone = -1;
+    for( auto it = settings.constBegin(); it != settings.constEnd(); ++it )
+    {
+        const QString &key = it.key();
+        if( key == "lighting" )
+            continue;
+
+        int zone = LightingEngine::zoneFromName(key);
+        if( zone >= 0 )
+        {
+            LightingEffect effect = zones[zone].effect;
+            if( !parseZoneEffect(it.value(), effect) )
+            {
+                results[key] = "invalid";
+                continue;
+            }
+            zones[zone].keys.push_back(key);
+            zones[zone].effect = effect;
+        }
+        else if( key == "sidetone" )
+        {
+            bool ok = false;
+            sidetone = it.value().toInt(&ok);
+            if( !ok || sidetone < 0 || sidetone > 100 )
+            {
+                results[key] = "invalid";
+                sidetone = -1;
+            }
+        }
+        else
+            results[key] = "unknown";
+    }
+
+    int outstanding = sidetone >= 0 ? 1 : 0;
+    for( const ZoneChange &c : zones )
+        outstanding += c.keys.isEmpty() ? 0 : 1;
+
+    if( !outstanding || !m_hid )
+    {
+        for( const ZoneChange &c : zones )
+        {
+            for( const QString &key : c.keys )
+                results[key] = applyResultName(ApplyOffline);
+        }
+        if( sidetone >= 0 )
+            results["sidetone"] = applyResultName(ApplyOffline);
+        return results;
+    }
+
+    // Answered from finishApply(), once every ticket is or the deadline passes.
+    const quint32 id = ++m_nextTicket;
+    PendingApply &apply = m_applies[id];
+    apply.call = message();
+    apply.results = results;
+    apply.outstanding = outstanding;
+    apply.deadline = new QTimer(this);
+    apply.deadline->setSingleShot(true);
+    connect( apply.deadline, &QTimer::timeout, this, [this, id]() { finishApply(id); } );
+    apply.deadline->start(APPLY_TIMEOUT);
+    setDelayedReply(true);
+
+    for( int z=0; z < LightingZoneCount; z++ )
+    {
+        if( zones[z].keys.isEmpty() )
+            continue;
+
+        if( !++m_nextTicket )
+            ++m_nextTicket;
+        m_tickets.insert(m_nextTicket, qMakePair(id, zones[z].keys));
+        m_hid->setZoneEffect(z, zones[z].effect, m_nextTicket);
+    }
+    if( sidetone >= 0 )
+    {
+        if( !++m_nextTicket )
+            ++m_nextTicket;
+        m_tickets.insert(m_nextTicket, qMakePair(id, QStringList() << "sidetone"));
+        m_hid->setSidetone(sidetone, m_nextTicket);
+    }
+    return QVariantMap();
+}
+
+void HeadsetDBusService::settingApplied(quint32 ticket, int result)
+{
+    auto t = m_tickets.find(ticket);
+    if( t == m_tickets.end() )
+        return;     // its call already timed out
+
+    const quint32 id = t.value().first;
+    const QStringList keys = t.value().second;
+    m_tickets.erase(t);
+
+    auto apply = m_applies.find(id);
+    if( apply == m_applies.end() )
+        return;
+
+    for( const QString &key : keys )
+    {
+        if( !apply->worst.contains(key) || applySeverity(result) > applySeverity(apply->worst.value(key)) )
+            apply->worst.insert(key, result);
+    }
+    if( --apply->outstanding == 0 )
+        finishApply(id);
+}
+
+void HeadsetDBusService::finishApply(quint32 id)
+{
+    auto it = m_applies.find(id);
+    if( it == m_applies.end() )
+        return;
+
+    PendingApply apply = it.value();
+    m_applies.erase(it);
+    apply.deadline->deleteLater();
+
+    // Whatever is still outstanding missed the deadline.
+    for( auto t = m_tickets.begin(); t != m_tickets.end(); )
+    {
+        if( t.value().first != id )
+        {
+            ++t;
+            continue;
+        }
+        for( const QString &key : t.value().second )
+        {
+            if( applySeverity(ApplyTimedOut) > applySeverity(apply.worst.value(key, ApplyDone)) )
+                apply.worst.insert(key, ApplyTimedOut);
+        }
+        t = m_tickets.erase(t);
+    }
+
+    for( auto w = apply.worst.constBegin(); w != apply.worst.constEnd(); ++w )
+        apply.results[w.key()] = applyResultName(w.value());
+
+    m_bus.send(apply.call.createReply(QVariant(apply.results)));
+}
+
 void HeadsetDBusService::quit()
 {
     QTimer::singleShot(0, qApp, &QCoreApplication::quit);
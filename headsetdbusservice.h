@@ -1,29 +1,100 @@
 #ifndef HEADSETDBUSSERVICE_H
 #define HEADSETDBUSSERVICE_H
 
+#include <QElapsedTimer>
+#include <QMap>
 #include <QObject>
+#include <QPair>
+#include <QStringList>
+#include <QTimer>
+#include <QVariantMap>
 #include <QtDBus/QDBusAbstractAdaptor>
+#include <QtDBus/QDBusConnection>
+#include <QtDBus/QDBusContext>
+#include <QtDBus/QDBusMessage>
+#include <QtDBus/QDBusUnixFileDescriptor>
 #include <QtDBus/QDBusVariant>
 
 #include "headsethid.h"
 
 #define SERVICE_NAME "org.logitech.Headset.Power"
+#define SERVICE_INTERFACE "org.logitech.Headset.Power.Service"
+#define HISTORY_QUERY_MAX 65536 // records per history() call
+#define APPLY_TIMEOUT 2000      // ms applySettings() waits for the headset
 
-class HeadsetDBusService : public QDBusAbstractAdaptor
+// An applySettings() call waiting for its zones to be applied.
+typedef struct {
+    QDBusMessage    call;
+    QVariantMap     results;    // key to result, final ones only
+    QMap<QString, int> worst;   // key to worst ApplyResult so far
+    int             outstanding;
+    QTimer          *deadline;
+} PendingApply;
+
+class HeadsetDBusService : public QDBusAbstractAdaptor, protected QDBusContext
 {
     Q_OBJECT
     Q_CLASSINFO("D-Bus Interface", "org.logitech.Headset.Power.Service")
 
     HeadsetHID *m_hid;
+    QString     m_path;
+    QDBusConnection m_bus;
+
+    // Property changes are published together, at most every m_minInterval
+    // ms, and only once they move past the property's deadband.
+    QVariantMap m_pending;
+    QVariantMap m_published;
+    QMap<QString, double> m_deadband;
+    QTimer      m_flushTimer;
+    QElapsedTimer m_lastFlush;
+    int         m_minInterval;
+    bool        m_legacySignals;    // also emit onlineChanged() and the like
+    quint64     m_signalsEmitted;
+    quint64     m_changesCoalesced;
+    quint64     m_changesSuppressed;
+
+    // Tickets handed to HeadsetHID, each to the applySettings() call and the
+    // keys it answers for.
+    quint32     m_nextTicket;
+    QMap<quint32, QPair<quint32, QStringList> > m_tickets;
+    QMap<quint32, PendingApply> m_applies;
 
     Q_PROPERTY(bool online READ online NOTIFY onlineChanged)
     Q_PROPERTY(bool charging READ charging NOTIFY chargingChanged)
     Q_PROPERTY(int voltage READ voltage NOTIFY voltageChanged)
     Q_PROPERTY(int soc READ soc NOTIFY socChanged)
     Q_PROPERTY(bool lighting READ lighting WRITE setLighting NOTIFY lightingChanged)
+    Q_PROPERTY(int pollInterval READ pollInterval NOTIFY pollIntervalChanged)
+    Q_PROPERTY(int timeToEmpty READ timeToEmpty NOTIFY timeToEmptyChanged)
+    Q_PROPERTY(int timeToFull READ timeToFull NOTIFY timeToFullChanged)
+    Q_PROPERTY(int sidetone READ sidetone WRITE setSidetone NOTIFY sidetoneChanged)
+    Q_PROPERTY(qulonglong signalsEmitted READ signalsEmitted)
+    Q_PROPERTY(qulonglong changesCoalesced READ changesCoalesced)
+    Q_PROPERTY(qulonglong changesSuppressed READ changesSuppressed)
+    Q_PROPERTY(qulonglong unknownReports READ unknownReports)
+    Q_PROPERTY(qulonglong readWakeups READ readWakeups)
+    Q_PROPERTY(int reportsDrainedMax READ reportsDrainedMax)
+    Q_PROPERTY(qulonglong queueOverruns READ queueOverruns)
+    Q_PROPERTY(int requestQueueDepth READ requestQueueDepth)
+    Q_PROPERTY(int requestQueueDepthMax READ requestQueueDepthMax)
+    Q_PROPERTY(qulonglong requestsSuperseded READ requestsSuperseded)
+    Q_PROPERTY(qulonglong requestsDropped READ requestsDropped)
+    Q_PROPERTY(int commandLatencyMax READ commandLatencyMax)
+    Q_PROPERTY(int timeToReady READ timeToReady)
+    Q_PROPERTY(bool featuresCached READ featuresCached)
+    Q_PROPERTY(int timeToRestore READ timeToRestore)
+    Q_PROPERTY(int calibrationCycles READ calibrationCycles)
+    Q_PROPERTY(qulonglong lightingWrites READ lightingWrites)
+    Q_PROPERTY(qulonglong lightingFramesSkipped READ lightingFramesSkipped)
+    Q_PROPERTY(qulonglong buttonActions READ buttonActions)
+    Q_PROPERTY(int buttonLatencyMax READ buttonLatencyMax)
 
 public:
-    explicit HeadsetDBusService(QObject *obj, HeadsetHID *h);
+    explicit HeadsetDBusService(QObject *obj, HeadsetHID *h, const QString &path = "/",
+                                const QDBusConnection &bus = QDBusConnection::sessionBus());
+
+    void setHeadset(HeadsetHID *h);
+    HeadsetHID *headset() const;
 
 public slots:
     bool online();
@@ -31,7 +102,64 @@ public slots:
     bool lighting();
     int voltage();
     int soc();
+    int pollInterval();
+    int timeToEmpty();
+    int timeToFull();
+    int sidetone();
+
+    // Diagnostics, always built, unlike org.logitech.Headset.Stats.
+    qulonglong signalsEmitted();
+    qulonglong changesCoalesced();
+    qulonglong changesSuppressed();
+    qulonglong unknownReports();
+    qulonglong readWakeups();
+    int reportsDrainedMax();
+    qulonglong queueOverruns();
+    int requestQueueDepth();
+    int requestQueueDepthMax();
+    qulonglong requestsSuperseded();
+    qulonglong requestsDropped();
+    int commandLatencyMax();
+    int timeToReady();
+    bool featuresCached();
+    int timeToRestore();
+    int calibrationCycles();
+    qulonglong lightingWrites();
+    qulonglong lightingFramesSkipped();
+    qulonglong buttonActions();
+    int buttonLatencyMax();
+
+    // Every property plus "sequence", the state's sequence number, in one
+    // consistent snapshot.
+    QVariantMap state();
+
+    // The properties changed after sequence with their current values, and
+    // the new "sequence". When the change log no longer reaches back that far
+    // it is the whole state() instead, with "snapshot" set.
+    QVariantMap changesSince(qulonglong sequence);
+
+    // Packed HistoryRecords (see telemetryhistory.h) between two times in ms
+    // since the epoch, or the whole history file to map read-only.
+    QByteArray history(qint64 from, qint64 to);
+    QDBusUnixFileDescriptor historyFile();
+
     Q_NOREPLY void setLighting(bool onoff);
+    // In percent, -1 until set. Kept across restarts like the lighting.
+    Q_NOREPLY void setSidetone(int level);
+
+    // zone is "logo" or "strips", effect "off", "static", "breathing" or
+    // "cycle". color is 0xRRGGBB, period in ms, brightness in percent.
+    void setZoneEffect(const QString &zone, const QString &effect, uint color, int period, int brightness);
+    QVariantMap zoneEffect(const QString &zone);
+
+    // Applies several settings at once and replies when the headset has
+    // acknowledged all of them, or after APPLY_TIMEOUT. Keys are "lighting"
+    // (bool), "logo" and "strips" (a{sv} of effect, color, period and
+    // brightness as for setZoneEffect(), missing ones are kept) and
+    // "sidetone" (0 to 100). The reply
+    // maps each key to "applied", "failed", "timeout", "offline",
+    // "superseded", "invalid" or "unknown".
+    QVariantMap applySettings(const QVariantMap &settings);
     Q_NOREPLY void quit();
 
 signals:
@@ -41,7 +169,21 @@ signals:
     void socChanged(qint32 soc);
     void lightingChanged(bool onoff);
     void buttonPressed(int index, bool pressed);
+    void pollIntervalChanged(int interval);
+    void timeToEmptyChanged(int seconds);
+    void timeToFullChanged(int seconds);
+    void sidetoneChanged(int level);
     void aboutToQuit();
+
+protected:
+    void propertyChanged(const QString &name, const QVariant &value);
+    void propertiesReset();
+
+    void settingApplied(quint32 ticket, int result);
+    void finishApply(quint32 id);
+
+private slots:
+    void flushProperties();
 };
 
 #endif // HEADSETDBUSSERVICE_H
@@ -1,220 +1,1226 @@
 #include "headsethid.h"
+#include "tracering.h"
 
+#include <QDateTime>
 #include <QDebug>
 #include <QFile>
+#include <QFileInfo>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QtEndian>
 
-#define VENDOR_LOGITECH     0x046d
-#define ID_LOGITECH_G733    0x0ab5
+#include "charging_ascending_curve.h"
+#include "discharging_curve.h"
 
-#ifndef HIDPP_LONG_MESSAGE
-# define HIDPP_LONG_MESSAGE 0x11
-# define HIDPP_LONG_MESSAGE_LENGTH 20
-# define HIDPP_DEVICE_RECEIVER 0xff
-#endif
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+// Byte 3 of a HID++ 2.0 report: function in the high nibble, software id in
+// the low one. Replies echo the software id, notifications carry 0.
+#define HIDPP_FUNCTION(b)   ((b) >> 4)
+#define HIDPP_SWID(b)       ((b) & 0x0f)
+#define HIDPP_ERROR         0xff
 
 HeadsetHID::HeadsetHID(QObject *parent)
     : QObject{parent},
       m_timeout{0},
       m_buttons{0},
-
-      m_handle{nullptr},
+      m_drainedLast{0},
+      m_drainedMax{0},
+      m_drainedTotal{0},
+      m_wakeups{0},
+      m_overruns{0},
+      m_unknownReports{0},
+      m_pollTimer{this},
+      m_requestTimer{this},
+      m_replyTimer{this},
+      m_frameTimer{this},
+      m_buttonTimer{this},
+      m_swid{0},
+      m_pollInterval{0},
+      m_queueDepthMax{0},
+      m_requestsSuperseded{0},
+      m_requestsDropped{0},
+      m_commandLatencyMax{0},
+      m_discoveryPending{0},
+      m_discoveryFailed{false},
+      m_featuresKnown{false},
+      m_featuresCached{false},
+      m_openedAt{0},
+      m_timeToReady{-1},
+      m_actionSink{nullptr},
+      m_buttonActions{0},
+      m_buttonLatencyMax{0},
+      m_commandFd{-1},
+      m_commandNotifier{nullptr},
+
+      m_transport{nullptr},
+      m_device{nullptr},
       m_online{false},
       m_charging{false},
-      m_lighting{false},
-      m_voltage{false}
+      m_lightingEnabled{false},
+      m_lightingWrites{0},
+      m_framesSkipped{0},
+      m_loaded{false},
+      m_sidetone{-1},
+      m_sidetoneConfirmed{-1},
+      m_sidetoneSent{-1},
+      m_sidetoneTicket{0},
+      m_restoreStarted{-1},
+      m_restoreWrites{0},
+      m_timeToRestore{-1},
+      m_voltage{0},
+      m_soc{0},
+      m_curve_discharging{curve_discharging},
+      m_curve_charging{curve_charging_ascending}
 {
-    loadMaps();
+    // The timers and notifiers are children so moveToThread() takes them
+    // along. Every property signal republishes the state first, ahead of any
+    // other connection, so whoever the signal wakes reads the new values.
+    connect( this, &HeadsetHID::chargingChanged, this, &HeadsetHID::publishState );
+    connect( this, &HeadsetHID::onlineChanged, this, &HeadsetHID::publishState );
+    connect( this, &HeadsetHID::voltageChanged, this, &HeadsetHID::publishState );
+    connect( this, &HeadsetHID::socChanged, this, &HeadsetHID::publishState );
+    connect( this, &HeadsetHID::lightingChanged, this, &HeadsetHID::publishState );
+    connect( this, &HeadsetHID::sidetoneChanged, this, &HeadsetHID::publishState );
+    connect( this, &HeadsetHID::pollIntervalChanged, this, &HeadsetHID::publishState );
+    connect( this, &HeadsetHID::timeToEmptyChanged, this, &HeadsetHID::publishState );
+    connect( this, &HeadsetHID::timeToFullChanged, this, &HeadsetHID::publishState );
+
+    m_commandFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if( m_commandFd < 0 )
+        qDebug() << "HeadsetHID: Failed to create the command eventfd:" << strerror(errno);
+    else
+    {
+        m_commandNotifier = new QSocketNotifier(m_commandFd, QSocketNotifier::Read, this);
+        connect( m_commandNotifier, &QSocketNotifier::activated, this, &HeadsetHID::runCommands );
+    }
 
-    connect( &m_pollTimer, &QTimer::timeout, this, [this](){
-        m_requests.push_back(Voltage);
+    // Rearmed by schedulePoll() whenever something changes how often the
+    // battery is worth asking about.
+    m_scheduler.loadSettings();
+    connect( &m_pollTimer, &QTimer::timeout, this, &HeadsetHID::pollVoltage );
+    m_pollTimer.setSingleShot(true);
+    connect( this, &HeadsetHID::onlineChanged, this, [this](bool onoff){
+        if( !onoff )
+        {
+            dropTelemetry();
+            for( int z=0; z < LightingZoneCount; z++ )
+                completeZone(z, ApplyOffline);
+            completeSidetone(ApplyOffline);
+        }
+        else
+        {
+            STATS( m_stats.add(HeadsetStats::Connects) );
+            if( m_device && !m_featuresKnown )
+                startDiscovery();
+        }
+        m_scheduler.setOnline(onoff);
+        schedulePoll();
+        updateLighting();
+        updateSidetone();
     } );
-    m_pollTimer.setSingleShot(false);
-    m_pollTimer.start(5000);
 
+    // Kicked whenever requests are queued, so requests queued together go out
+    // together. Input arrives through m_device's readyRead().
     connect( &m_requestTimer, &QTimer::timeout, this, &HeadsetHID::processRequest );
-    m_requestTimer.setSingleShot(false);
-    m_requestTimer.start(250);
+    m_requestTimer.setSingleShot(true);
+    m_requestTimer.setInterval(0);
+
+    connect( &m_replyTimer, &QTimer::timeout, this, &HeadsetHID::replyTimedOut );
+    m_replyTimer.setSingleShot(true);
+
+    connect( &m_storeTimer, &QTimer::timeout, this, [this]() { m_store.save(); } );
+    m_storeTimer.setSingleShot(true);
+    m_storeTimer.setInterval(STORE_DELAY);
+
+    // Runs while a zone is animated in software and the headset is awake.
+    connect( &m_frameTimer, &QTimer::timeout, this, &HeadsetHID::lightingFrame );
+    m_frameTimer.setInterval(LIGHTING_FRAME_INTERVAL);
+    for( quint32 &ticket : m_zoneTicket )
+        ticket = 0;
+
+    m_buttonEngine.loadSettings();
+    connect( &m_buttonTimer, &QTimer::timeout, this, &HeadsetHID::buttonTimeout );
+    m_buttonTimer.setSingleShot(true);
+
+    memset(&m_log, 0, sizeof(m_log));
+    m_clock.start();
+    publishState();
+}
+
+HeadsetHID::~HeadsetHID()
+{
+    if( m_device )
+        close();
+    flushStore();
+
+    delete m_actionSink;
+    delete m_commandNotifier;
+    if( m_commandFd >= 0 )
+        ::close(m_commandFd);
+}
+
+void HeadsetHID::setActionSink(ActionSink *sink)
+{
+    delete m_actionSink;
+    m_actionSink = sink;
+    if( m_actionSink )
+        m_actionSink->prepare(m_buttonEngine.actions());
+}
+
+void HeadsetHID::setTransport(HidTransport *transport)
+{
+    if( m_transport )
+        m_transport->deleteLater();
+
+    m_transport = transport;
+    if( m_transport )
+        m_transport->setParent(this);
+}
+
+bool HeadsetHID::open(const QString &hid_path)
+{
+    if( m_device )
+        close();
+
+    // Left to the first open(), on the I/O thread, so nothing on disk holds
+    // up startup.
+    if( !m_loaded )
+    {
+        loadMaps();
+        m_loaded = true;
+    }
+
+    HidTransport *device = m_transport ? m_transport : HidTransport::create(this);
+    m_transport = nullptr;
+    if( !device->open(hid_path) )
+    {
+        device->deleteLater();
+        return false;
+    }
+
+    m_device = device;
+    connect( m_device, &HidTransport::readyRead, this, &HeadsetHID::readFromDevice );
+
+    m_path = hid_path;
+
+    if( !m_actionSink && !m_buttonEngine.isEmpty() )
+        setActionSink(new SystemActionSink);
+
+    // Keys the history, feature cache and calibration. Without a serial the
+    // device node keeps two receivers apart, at the cost of starting over
+    // when it is plugged in elsewhere.
+    m_serial = m_device->serial();
+    if( m_serial.isEmpty() )
+        m_serial = QString("node-%1").arg(hid_path.section('/', -1));
+    loadStore();
+
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    m_history.open( QString("%1/history-%2.bin").arg(dir).arg(m_serial) );
+    m_calibration.load(calibrationFile(), m_serial);
+
+    m_openedAt = m_clock.elapsed();
+    m_timeToReady = -1;
+    m_firmware.clear();
+    m_features = HidppFeatureMap();
+    m_discoveryPending = 0;
+    startRestore();
+
+    // Known before going online, whose handler starts discovery otherwise. A
+    // cache hit only leaves the firmware check, which doesn't hold up the
+    // first reading.
+    m_featuresKnown = m_featuresCached = loadFeatures();
+    if( m_featuresKnown )
+        m_discoveryPending = requestBit(FirmwareInfo);
+    TRACE(TRACE_INFO, TraceOpened, m_featuresCached);
+
+    m_online = true;
+    emit onlineChanged(m_online);
+
+    queueRequest(Version);
+    if( m_featuresKnown )
+        queueRequest(FirmwareInfo);
+
+    // With the indices from the cache the restore goes out right away.
+    updateLighting();
+    updateSidetone();
+
+    pollVoltage();
+
+    return true;
+}
+
+void HeadsetHID::close()
+{
+    if( !m_device )
+    {
+        qDebug() << "HeadsetHID::close(): Nothing to do.";
+        return;
+    }
+
+    m_device->close();
+    m_device->deleteLater();
+    m_device = nullptr;
+
+    m_replyTimer.stop();
+    m_pollTimer.stop();
+    m_inflight.clear();
+    m_lighting.invalidate();
+    for( int z=0; z < LightingZoneCount; z++ )
+        completeZone(z, ApplyOffline);
+    completeSidetone(ApplyOffline);
+    m_sidetoneConfirmed = -1;
+    m_sidetoneSent = -1;
+    m_restoreStarted = -1;
+    m_buttonEngine.reset();
+    m_buttonTimer.stop();
+    m_buttons = 0;
+    m_history.close();
+    calibrationOffline(false);
+    flushStore();
+
+    m_path.clear();
+    m_online = false;
+    TRACE(TRACE_INFO, TraceClosed);
+    emit onlineChanged(m_online);
+    emit closed();
+}
+
+QString HeadsetHID::path()
+{
+    return m_path;
+}
+
+QString HeadsetHID::serial()
+{
+    return m_serial;
+}
+
+HeadsetState HeadsetHID::state(quint64 *version) const
+{
+    return m_state.load(version);
+}
+
+bool HeadsetHID::changesSince(quint64 sequence, QMap<int, qint32> &changes, quint64 *current) const
+{
+    const StateLog log = m_changes.load();
+    if( current )
+        *current = log.sequence;
+
+    // The oldest change may have lost others of its publication to the ring,
+    // so only what came after it is known to be whole.
+    const int oldest = (log.head - log.count + STATE_LOG_SIZE) % STATE_LOG_SIZE;
+    if( sequence > log.sequence || (log.count == STATE_LOG_SIZE && sequence < log.changes[oldest].sequence) )
+        return false;
+
+    for( int i=0; i < log.count; i++ )
+    {
+        const StateChange &c = log.changes[(oldest + i) % STATE_LOG_SIZE];
+        if( c.sequence > sequence )
+            changes.insert(c.property, c.value);
+    }
+    return true;
+}
+
+#ifdef HEADSET_STATS
+const HeadsetStats &HeadsetHID::stats() const
+{
+    return m_stats;
+}
+
+void HeadsetHID::setReconnects(quint64 n)
+{
+    m_stats.add(HeadsetStats::Reconnects, n);
+}
+#endif
+
+const char *HeadsetHID::requestName(int type)
+{
+    static const char *names[RequestTypeCount] = {
+        "FindFirmware",
+        "FindBattery",
+        "FindLighting",
+        "FirmwareInfo",
+        "LightingLogo",
+        "LightingStrips",
+        "Version",
+        "Voltage",
+        "FindSidetone",
+        "Sidetone"
+    };
+    static_assert(RequestTypeCount <= STATS_REQUEST_TYPES, "STATS_REQUEST_TYPES too small");
+
+    return type >= 0 && type < RequestTypeCount ? names[type] : nullptr;
+}
+
+const char *HeadsetHID::statePropertyName(int property)
+{
+    static const char *names[StatePropertyCount] = {
+        "online",
+        "charging",
+        "lighting",
+        "voltage",
+        "soc",
+        "pollInterval",
+        "timeToEmpty",
+        "timeToFull",
+        "sidetone"
+    };
+
+    return property >= 0 && property < StatePropertyCount ? names[property] : nullptr;
+}
+
+qint32 HeadsetHID::stateValue(const HeadsetState &st, int property)
+{
+    switch( property )
+    {
+    case StateOnline:       return st.online;
+    case StateCharging:     return st.charging;
+    case StateLighting:     return st.lighting;
+    case StateVoltage:      return st.voltage;
+    case StateSoc:          return st.soc;
+    case StatePollInterval: return st.pollInterval;
+    case StateTimeToEmpty:  return st.timeToEmpty;
+    case StateTimeToFull:   return st.timeToFull;
+    case StateSidetone:     return st.sidetone;
+    }
+    return 0;
+}
+
+int HeadsetHID::voltage()
+{
+    return m_state.load().voltage;
+}
+
+int HeadsetHID::soc()
+{
+    return m_state.load().soc;
+}
+
+bool HeadsetHID::online()
+{
+    return m_state.load().online;
+}
+
+bool HeadsetHID::charging()
+{
+    return m_state.load().charging;
+}
+
+bool HeadsetHID::lighting()
+{
+    return m_state.load().lighting;
+}
+
+int HeadsetHID::pollInterval()
+{
+    return m_state.load().pollInterval;
+}
+
+int HeadsetHID::timeToEmpty()
+{
+    return m_state.load().timeToEmpty;
+}
+
+int HeadsetHID::timeToFull()
+{
+    return m_state.load().timeToFull;
+}
+
+QByteArray HeadsetHID::history(qint64 from, qint64 to, int maxRecords)
+{
+    return m_history.range(from, to, maxRecords);
+}
+
+QString HeadsetHID::historyFile()
+{
+    return m_history.isOpen() ? m_history.fileName() : QString();
+}
+
+void HeadsetHID::recordHistory(quint8 event, double soc)
+{
+    quint8 flags = 0;
+    if( m_online )
+        flags |= HistoryOnline;
+    if( m_charging )
+        flags |= HistoryCharging;
+
+    m_history.append(QDateTime::currentMSecsSinceEpoch(), m_voltage, soc, flags, event);
+}
+
+void HeadsetHID::pollVoltage()
+{
+    if( m_device )
+    {
+        queueRequest(Voltage);
+        m_scheduler.polled(m_clock.elapsed());
+    }
+    schedulePoll();
+}
+
+void HeadsetHID::schedulePoll()
+{
+    if( !m_device )
+        return;
+
+    int interval = m_scheduler.nextInterval(m_clock.elapsed());
+    m_pollTimer.start(interval);
+
+    if( interval != m_pollInterval )
+    {
+        m_pollInterval = interval;
+        emit pollIntervalChanged(m_pollInterval);
+    }
+}
+
+int HeadsetHID::reportsDrainedLast()
+{
+    return m_state.load().drainedLast;
+}
+
+int HeadsetHID::reportsDrainedMax()
+{
+    return m_state.load().drainedMax;
+}
+
+quint64 HeadsetHID::reportsDrainedTotal()
+{
+    return m_state.load().drainedTotal;
+}
+
+quint64 HeadsetHID::readWakeups()
+{
+    return m_state.load().wakeups;
+}
+
+quint64 HeadsetHID::queueOverruns()
+{
+    return m_state.load().overruns;
+}
+
+void HeadsetHID::publishState()
+{
+    HeadsetState st;
+    st.online = m_online;
+    st.charging = m_charging;
+    st.lighting = m_lightingEnabled;
+    st.voltage = m_voltage;
+    st.soc = m_soc;
+    st.pollInterval = m_pollInterval;
+    st.timeToEmpty = m_estimator.timeToEmpty();
+    st.timeToFull = m_estimator.timeToFull();
+    st.drainedLast = m_drainedLast;
+    st.drainedMax = m_drainedMax;
+    st.drainedTotal = m_drainedTotal;
+    st.wakeups = m_wakeups;
+    st.overruns = m_overruns;
+    st.unknownReports = m_unknownReports;
+    st.queueDepth = m_requests.size();
+    st.queueDepthMax = m_queueDepthMax;
+    st.requestsSuperseded = m_requestsSuperseded;
+    st.requestsDropped = m_requestsDropped;
+    st.commandLatencyMax = m_commandLatencyMax;
+    st.timeToReady = m_timeToReady;
+    st.featuresCached = m_featuresCached;
+    for( int z=0; z < LightingZoneCount; z++ )
+        st.lightingZones[z] = m_lighting.effect(z);
+    st.lightingWrites = m_lightingWrites;
+    st.lightingFramesSkipped = m_framesSkipped;
+    st.buttonActions = m_buttonActions;
+    st.buttonLatencyMax = m_buttonLatencyMax;
+    st.sidetone = m_sidetone;
+    st.timeToRestore = m_timeToRestore;
+    st.calibrationCycles = m_calibration.cycles();
+
+    // Property changes get the next sequence number and go to the log.
+    const HeadsetState last = m_state.load();
+    st.sequence = last.sequence;
+    for( int p=0; p < StatePropertyCount; p++ )
+    {
+        const qint32 value = stateValue(st, p);
+        if( value == stateValue(last, p) )
+            continue;
+
+        if( st.sequence == last.sequence )
+            st.sequence++;
+
+        StateChange &c = m_log.changes[m_log.head];
+        c.sequence = st.sequence;
+        c.value = value;
+        c.property = quint8(p);
+        m_log.head = (m_log.head + 1) % STATE_LOG_SIZE;
+        m_log.count = qMin(m_log.count + 1, STATE_LOG_SIZE);
+    }
+    m_state.store(st);
+
+    if( st.sequence != last.sequence )
+    {
+        m_log.sequence = st.sequence;
+        m_changes.store(m_log);
+    }
+}
+
+bool HeadsetHID::postCommand(CommandType type, int arg, const LightingEffect &effect, quint32 ticket)
+{
+    Command c;
+    c.type = type;
+    c.arg = arg;
+    c.effect = effect;
+    c.ticket = ticket;
+    if( !m_commands.push(c) )
+    {
+        TRACE(TRACE_ERROR, TraceCommandDropped, type);
+        if( ticket )
+            emit settingApplied(ticket, ApplyFailed);
+        return false;
+    }
+
+    quint64 one = 1;
+    if( ::write(m_commandFd, &one, sizeof(one)) < 0 && errno != EAGAIN )
+        TRACE(TRACE_ERROR, TraceWakeFailed, errno);
+    return true;
+}
+
+void HeadsetHID::runCommands()
+{
+    quint64 count;
+    while( ::read(m_commandFd, &count, sizeof(count)) < 0 && errno == EINTR )
+        ;
+
+    Command c;
+    while( m_commands.pop(c) )
+    {
+        switch( c.type )
+        {
+        case SetLighting:
+            applyLighting(c.arg != 0);
+            break;
+        case SetZoneEffect:
+            applyZoneEffect(c.arg, c.effect, c.ticket);
+            break;
+        case SetSidetone:
+            applySidetone(c.arg, c.ticket);
+            break;
+        }
+    }
+}
+
+void HeadsetHID::enableLighting(bool onoff)
+{
+    // Called from the D-Bus side, the only producer of m_commands.
+    postCommand(SetLighting, onoff);
+}
+
+void HeadsetHID::setZoneEffect(int zone, const LightingEffect &effect, quint32 ticket)
+{
+    if( zone < 0 || zone >= LightingZoneCount || effect.mode >= LightingModeCount )
+    {
+        if( ticket )
+            emit settingApplied(ticket, ApplyFailed);
+        return;
+    }
+
+    postCommand(SetZoneEffect, zone, effect, ticket);
+}
+
+LightingEffect HeadsetHID::zoneEffect(int zone)
+{
+    if( zone < 0 || zone >= LightingZoneCount )
+        return LightingEngine::offEffect();
+
+    return m_state.load().lightingZones[zone];
 }
 
-QString HeadsetHID::findDevice()
+void HeadsetHID::applyLighting(bool onoff)
 {
-    struct hid_device_info* devs = hid_enumerate(0x0, 0x0);
-    struct hid_device_info* cur = devs;
+    const LightingEffect effect = onoff ? LightingEngine::defaultEffect() : LightingEngine::offEffect();
+    bool changed = false;
+    for( int z=0; z < LightingZoneCount; z++ )
+    {
+        completeZone(z, ApplySuperseded);
+        m_lighting.setEffect(z, effect);
+        changed = m_store.setZone(z, effect) || changed;
+    }
+    if( changed )
+        storeChanged();
+    updateLighting();
+}
+
+void HeadsetHID::applyZoneEffect(int zone, const LightingEffect &effect, quint32 ticket)
+{
+    completeZone(zone, ApplySuperseded);
+    m_zoneTicket[zone] = ticket;
+
+    m_lighting.setEffect(zone, effect);
+    m_lighting.frame(m_clock.elapsed());
+    if( m_store.setZone(zone, effect) )
+        storeChanged();
+    updateLighting();
+
+    // Nothing to wait for while it can't be written.
+    if( !m_device || !m_online )
+        completeZone(zone, ApplyOffline);
+}
 
-    QString result;
-    while( cur )
+void HeadsetHID::completeZone(int zone, ApplyResult result)
+{
+    if( !m_zoneTicket[zone] )
+        return;
+
+    quint32 ticket = m_zoneTicket[zone];
+    m_zoneTicket[zone] = 0;
+    emit settingApplied(ticket, result);
+}
+
+// Queues a write for every zone whose confirmed state is out of date. The
+// queue keeps one request per zone and it picks up the latest effect when
+// it goes out, so repeated changes cost one write.
+void HeadsetHID::updateLighting()
+{
+    for( int z=0; z < LightingZoneCount; z++ )
     {
-        if( cur->vendor_id == VENDOR_LOGITECH && cur->product_id == ID_LOGITECH_G733 )
+        if( m_lighting.settled(z) )
+            completeZone(z, ApplyDone);
+    }
+
+    // Held back until discovery knows where the lighting feature is.
+    if( m_device && m_online && m_featuresKnown )
+    {
+        for( int z=0; z < LightingZoneCount; z++ )
         {
-            result = QString::fromLocal8Bit(cur->path);
+            if( m_lighting.needsWrite(z) )
+                queueRequest(RequestType(LightingLogo + z));
+        }
+    }
+
+    if( m_lighting.animating() && m_device && m_online )
+    {
+        if( !m_frameTimer.isActive() )
+            m_frameTimer.start();
+    }
+    else
+        m_frameTimer.stop();
+
+    if( m_lightingEnabled != m_lighting.enabled() )
+    {
+        m_lightingEnabled = m_lighting.enabled();
+        emit lightingChanged(m_lightingEnabled);
+    }
+    else
+        publishState();
+
+    checkRestored();
+}
+
+int HeadsetHID::sidetone()
+{
+    return m_state.load().sidetone;
+}
+
+void HeadsetHID::setSidetone(int level, quint32 ticket)
+{
+    postCommand(SetSidetone, qBound(0, level, 100), LightingEffect(), ticket);
+}
+
+void HeadsetHID::applySidetone(int level, quint32 ticket)
+{
+    completeSidetone(ApplySuperseded);
+    m_sidetoneTicket = ticket;
+
+    if( m_store.setSidetone(level) )
+        storeChanged();
+
+    if( m_sidetone != level )
+    {
+        m_sidetone = level;
+        emit sidetoneChanged(m_sidetone);
+    }
+    updateSidetone();
+
+    // Nothing to wait for while it can't be written.
+    if( !m_device || !m_online )
+        completeSidetone(ApplyOffline);
+}
+
+void HeadsetHID::completeSidetone(ApplyResult result)
+{
+    if( !m_sidetoneTicket )
+        return;
+
+    quint32 ticket = m_sidetoneTicket;
+    m_sidetoneTicket = 0;
+    emit settingApplied(ticket, result);
+}
+
+// Same as updateLighting(), one write at a time and only when the headset's
+// level is unknown or differs.
+void HeadsetHID::updateSidetone()
+{
+    if( m_sidetone >= 0 && m_sidetoneConfirmed == m_sidetone )
+        completeSidetone(ApplyDone);
+
+    if( m_sidetone >= 0 && m_sidetoneSent < 0 && m_sidetoneConfirmed != m_sidetone
+        && m_device && m_online && m_featuresKnown )
+        queueRequest(Sidetone);
+
+    checkRestored();
+}
+
+// What a client last asked for, written once the headset is there.
+// updateLighting() tells clients about the lighting.
+void HeadsetHID::loadStore()
+{
+    m_store.load(SettingsStore::defaultPath(), m_serial);
+    for( int z=0; z < LightingZoneCount; z++ )
+    {
+        if( m_store.hasZone(z) )
+            m_lighting.setEffect(z, m_store.zone(z));
+    }
+    m_lighting.frame(m_clock.elapsed());
+
+    if( m_sidetone != m_store.sidetone() )
+    {
+        m_sidetone = m_store.sidetone();
+        emit sidetoneChanged(m_sidetone);
+    }
+}
+
+// Every change ends up on disk, but a burst of them costs one write, away
+// from the change itself.
+void HeadsetHID::storeChanged()
+{
+    if( !m_storeTimer.isActive() )
+        m_storeTimer.start();
+}
+
+void HeadsetHID::flushStore()
+{
+    if( !m_storeTimer.isActive() )
+        return;
+
+    m_storeTimer.stop();
+    m_store.save();
+}
+
+// The headset forgot its settings. Everything in the store that differs goes
+// back out together once the features are known, checkRestored() times it.
+void HeadsetHID::startRestore()
+{
+    m_lighting.invalidate();
+    m_sidetoneConfirmed = -1;
+    m_sidetoneSent = -1;
+    m_restoreWrites = 0;
+    m_restoreStarted = m_store.isEmpty() ? -1 : m_clock.elapsed();
+}
+
+void HeadsetHID::checkRestored()
+{
+    if( m_restoreStarted < 0 || !m_lighting.settled() )
+        return;
+    if( m_sidetone >= 0 && m_sidetoneConfirmed != m_sidetone )
+        return;
+
+    m_timeToRestore = int(m_clock.elapsed() - m_restoreStarted);
+    m_restoreStarted = -1;
+    TRACE(TRACE_INFO, TraceRestored, m_timeToRestore, m_restoreWrites);
+    publishState();
+}
+
+void HeadsetHID::lightingFrame()
+{
+    // Frames yield to telemetry, and a zone whose last frame is still
+    // unanswered skips this one rather than queueing behind it.
+    for( const QueuedRequest &q : m_requests )
+    {
+        if( !isCommand(q.type) )
+        {
+            m_framesSkipped++;
+            return;
+        }
+    }
+
+    for( int z=0; z < LightingZoneCount; z++ )
+    {
+        if( m_lighting.inflight(z) && m_lighting.effect(z).mode == LightingCycle )
+            m_framesSkipped++;
+    }
+
+    m_lighting.frame(m_clock.elapsed());
+    updateLighting();
+}
+
+void HeadsetHID::armButtonTimer()
+{
+    qint64 next = m_buttonEngine.nextDeadline();
+    if( next < 0 )
+        m_buttonTimer.stop();
+    else
+        m_buttonTimer.start( qMax<qint64>(0, next - m_clock.elapsed()) );
+}
+
+void HeadsetHID::buttonTimeout()
+{
+    int actions = m_buttonEngine.expire(m_clock.elapsed(), m_actionSink);
+    if( actions )
+    {
+        TRACE(TRACE_INFO, TraceButtonActions, m_buttons, actions, 0);
+        m_buttonActions += actions;
+        publishState();
+    }
+    armButtonTimer();
+}
+
+bool HeadsetHID::isLighting(RequestType t)
+{
+    return t == LightingLogo || t == LightingStrips;
+}
+
+bool HeadsetHID::isCommand(RequestType t)
+{
+    return isLighting(t) || t == Sidetone;
+}
+
+void HeadsetHID::queueRequest(RequestType t)
+{
+    bool command = isCommand(t);
+
+    // Telemetry is pointless while the headset sleeps, apart from the poll
+    // scheduler's sparse voltage probe that notices it coming back.
+    if( !command && !m_online && t != Voltage )
+    {
+        m_requestsDropped++;
+        return;
+    }
+
+    bool superseded = false;
+    for( QueuedRequest &q : m_requests )
+    {
+        if( q.type == t )
+        {
+            // Keeps its place and original queue time.
+            m_requestsSuperseded++;
+            superseded = true;
             break;
         }
+    }
 
-        cur = cur->next;
+    if( !superseded )
+    {
+        if( m_requests.size() >= REQUEST_QUEUE )
+        {
+            // Make room for a command at the expense of telemetry, never the
+            // other way around.
+            if( !command || isCommand(m_requests.last().type) )
+            {
+                m_requestsDropped++;
+                return;
+            }
+            m_requests.removeLast();
+            m_requestsDropped++;
+        }
+
+        QueuedRequest q;
+        q.type = t;
+        q.queued = m_clock.elapsed();
+
+        int at = m_requests.size();
+        if( command )
+        {
+            at = 0;
+            while( at < m_requests.size() && isCommand(m_requests[at].type) )
+                at++;
+        }
+        m_requests.insert(at, q);
+
+        if( m_requests.size() > m_queueDepthMax )
+            m_queueDepthMax = m_requests.size();
     }
-    hid_free_enumeration(devs);
 
-    return result;
+    if( !m_requestTimer.isActive() )
+        m_requestTimer.start();
+}
+
+void HeadsetHID::dropTelemetry()
+{
+    for( auto it = m_requests.begin(); it != m_requests.end(); )
+    {
+        if( isCommand(it->type) )
+            ++it;
+        else
+        {
+            // Discovery starts over once the headset is back.
+            m_discoveryPending &= ~requestBit(it->type);
+            it = m_requests.erase(it);
+            m_requestsDropped++;
+        }
+    }
+}
+
+void HeadsetHID::processRequest()
+{
+    // Nothing to send to, don't let the queue build up while unplugged.
+    if( !m_device )
+    {
+        m_requestsDropped += m_requests.size();
+        m_requests.clear();
+        publishState();
+        return;
+    }
+
+    while( !m_requests.isEmpty() && m_inflight.size() < MAX_INFLIGHT )
+    {
+        QueuedRequest q = m_requests.takeFirst();
+        RequestType t = q.type;
+        if( isCommand(t) )
+        {
+            int latency = int(m_clock.elapsed() - q.queued);
+            if( latency > m_commandLatencyMax )
+                m_commandLatencyMax = latency;
+        }
+
+        switch( t )
+        {
+        case Version:
+            readVersion();
+            break;
+        case FindFirmware:
+        case FindBattery:
+        case FindLighting:
+        case FindSidetone:
+            findFeature(t);
+            break;
+        case FirmwareInfo:
+            readFirmware();
+            break;
+        case Voltage:
+            readVoltage();
+            break;
+        case LightingLogo:
+        case LightingStrips:
+            writeLighting(t - LightingLogo);
+            break;
+        case Sidetone:
+            writeSidetone();
+            break;
+        default:
+            break;
+        }
+
+        // A write error closed the device.
+        if( !m_device )
+            break;
+    }
+
+    publishState();
+}
+
+quint16 HeadsetHID::requestKey(quint8 feature, quint8 function)
+{
+    return (feature << 8) | function;
 }
 
-bool HeadsetHID::open()
+bool HeadsetHID::sendRequest(RequestType t, quint8 *packet, bool expectsReply)
 {
-    // Generate the path which is needed
-    QString hid_path = findDevice();
-    if( hid_path.isEmpty() )
-    {
-        qDebug() << "Couldn't find a compatible device.";
-        qDebug() << QString::fromWCharArray(hid_error(NULL));
+    if( !readyForRequest() )
         return false;
+
+    quint16 key = 0;
+    if( expectsReply )
+    {
+        // Pick a software id that isn't already waiting on this function, so
+        // the reply can be matched back to this request.
+        int tries = 0;
+        do {
+            m_swid = (m_swid % 0x0f) + 1;
+            packet[3] = (packet[3] & 0xf0) | m_swid;
+            key = requestKey(packet[2], packet[3]);
+        } while( m_inflight.contains(key) && ++tries < 0x0f );
+
+        if( m_inflight.contains(key) )
+        {
+            TRACE(TRACE_ERROR, TraceNoSoftwareId, t);
+            return false;
+        }
     }
 
-    m_handle = hid_open_path(hid_path.toStdString().c_str());
-    if( !m_handle )
+    int r = m_device->write(packet, HIDPP_LONG_MESSAGE_LENGTH);
+    if( r < 0 )
     {
-        qDebug() << "Failed to open the device" << hid_path;
-        qDebug() << QString::fromWCharArray(hid_error(NULL));
+        TRACE(TRACE_ERROR, TraceWriteFailed, t);
+        STATS( m_stats.add(HeadsetStats::WriteFailures) );
+        close();
         return false;
     }
 
-    m_online = true;
-    emit onlineChanged(m_online);
+    STATS( m_stats.add(HeadsetStats::Requests) );
+    TRACE(TRACE_DEBUG, TraceRequestSent, t, packet[2], packet[3]);
+    if( !expectsReply )
+        return true;
 
-    m_requests.push_back(Version);
+    PendingRequest pending;
+    pending.type = t;
+    memcpy(pending.packet, packet, HIDPP_LONG_MESSAGE_LENGTH);
+    pending.deadline = m_clock.elapsed() + REQUEST_TIMEOUT;
+    pending.sent = m_clock.nsecsElapsed() / 1000;
+    pending.retries = 0;
+    m_inflight.insert(key, pending);
 
+    armReplyTimer();
     return true;
 }
 
-void HeadsetHID::close()
+bool HeadsetHID::completeRequest(const quint8 *data_read, int r, RequestType &type)
 {
-    if( !m_handle )
-    {
-        qDebug() << "HeadsetHID::close(): Nothing to do.";
-        return;
-    }
+    if( r < 5 || data_read[0] != HIDPP_LONG_MESSAGE )
+        return false;
 
-    hid_close(m_handle);
-    m_handle = nullptr;
-    m_online = false;
-    emit onlineChanged(m_online);
-}
+    // Error replies are: 11 ff ff <feature> <function|swid> <error>
+    bool error = data_read[2] == HIDPP_ERROR;
+    quint16 key = error ? requestKey(data_read[3], data_read[4]) : requestKey(data_read[2], data_read[3]);
 
-int HeadsetHID::voltage()
-{
-    return m_voltage;
-}
+    auto it = m_inflight.find(key);
+    if( it == m_inflight.end() )
+        return false;
 
-int HeadsetHID::soc()
-{
-    return m_soc;
-}
+    if( error && r >= 6 )
+        TRACE(TRACE_ERROR, TraceErrorReply, it->type, data_read[5]);
 
-bool HeadsetHID::online()
-{
-    return m_online;
-}
+    type = it->type;
+    TRACE(TRACE_DEBUG, TraceReply, it->type, quint32(m_clock.nsecsElapsed() / 1000 - it->sent));
+    STATS( m_stats.add(HeadsetStats::Replies) );
+    STATS( m_stats.latency(it->type, m_clock.nsecsElapsed() / 1000 - it->sent) );
+    m_inflight.erase(it);
+    armReplyTimer();
 
-bool HeadsetHID::charging()
-{
-    return m_charging;
-}
+    // A slot opened up.
+    if( !m_requests.isEmpty() && !m_requestTimer.isActive() )
+        m_requestTimer.start();
 
-bool HeadsetHID::lighting()
-{
-    return m_lighting;
+    return true;
 }
 
-void HeadsetHID::enableLighting(bool onoff)
+void HeadsetHID::armReplyTimer()
 {
-    if( onoff )
+    if( m_inflight.isEmpty() )
     {
-        m_requests.push_back(LightsOn);
-        m_requests.push_back(Noop);
-        m_requests.push_back(Noop);
-        m_requests.push_back(Noop);
-        m_requests.push_back(Noop);
-        m_requests.push_back(LogoOn);
+        m_replyTimer.stop();
+        return;
     }
-    else
+
+    qint64 next = -1;
+    for( const PendingRequest &p : m_inflight )
     {
-        m_requests.push_back(LightsOff);
-        m_requests.push_back(Noop);
-        m_requests.push_back(Noop);
-        m_requests.push_back(Noop);
-        m_requests.push_back(Noop);
-        m_requests.push_back(LogoOff);
+        if( next < 0 || p.deadline < next )
+            next = p.deadline;
     }
-    m_requests.push_back(Noop);
-    m_requests.push_back(Noop);
-    m_requests.push_back(Noop);
-    m_requests.push_back(Noop);
+
+    m_replyTimer.start( qMax<qint64>(0, next - m_clock.elapsed()) );
 }
 
-void HeadsetHID::processRequest()
+void HeadsetHID::replyTimedOut()
 {
-    if( m_requests.length() == 0 )
+    qint64 now = m_clock.elapsed();
+    for( auto it = m_inflight.begin(); it != m_inflight.end(); )
     {
-        // Check buttons:
-        readFromDevice();
-        return;
+        if( it->deadline > now )
+        {
+            ++it;
+            continue;
+        }
+
+        if( m_device && it->retries < REQUEST_RETRIES )
+        {
+            if( m_device->write(it->packet, HIDPP_LONG_MESSAGE_LENGTH) >= 0 )
+            {
+                STATS( m_stats.add(HeadsetStats::Retries) );
+                it->retries++;
+                TRACE(TRACE_INFO, TraceRetry, it->type, it->retries);
+                it->deadline = now + REQUEST_TIMEOUT;
+                it->sent = m_clock.nsecsElapsed() / 1000;
+                ++it;
+                continue;
+            }
+            STATS( m_stats.add(HeadsetStats::WriteFailures) );
+            TRACE(TRACE_ERROR, TraceWriteFailed, it->type);
+        }
+
+        RequestType t = it->type;
+        it = m_inflight.erase(it);
+        m_timeout++;
+        if( t == Sidetone )
+        {
+            m_sidetoneSent = -1;
+            completeSidetone(ApplyTimedOut);
+        }
+        STATS( m_stats.add(HeadsetStats::Timeouts) );
+        TRACE(TRACE_INFO, TraceTimeout, t);
+        if( isLighting(t) )
+        {
+            m_lighting.failed(t - LightingLogo);
+            completeZone(t - LightingLogo, ApplyTimedOut);
+        }
+
+        // Keep whatever indices discovery would have replaced.
+        if( requestBit(t) & m_discoveryPending )
+        {
+            m_discoveryFailed = true;
+            discoveryStep(t);
+        }
     }
 
-    RequestType t = m_requests.takeFirst();
-    switch( t )
+    if( m_online && m_timeout >= TIMEOUT_LIMIT )
     {
-    case Version:
-        readVersion();
-        readFromDevice();
-        break;
-    case Voltage:
-        readVoltage();
-        readFromDevice();
-        break;
-    case LightsOn:
-        setLighting(true);
-        readFromDevice();
-        break;
-    case LogoOn:
-        setLogoLighting(true);
-        readFromDevice();
-        break;
-    case LightsOff:
-        setLighting(false);
-        readFromDevice();
-        break;
-    case LogoOff:
-        setLogoLighting(false);
-        readFromDevice();
-        break;
-    case Noop:
-    default:
-        break;
+        // Most likely it ran flat.
+        calibrationOffline(true);
+        m_online = false;
+        recordHistory(HistoryLost, m_soc);
+        emit onlineChanged(m_online);
     }
+
+    armReplyTimer();
+    if( !m_requests.isEmpty() && !m_requestTimer.isActive() )
+        m_requestTimer.start();
 }
 
 double HeadsetHID::voltageToSoC(int voltage, bool charging)
 {
-    QList< QPair<int, double> > &map = m_curve_discharging;
-    if( charging )
-        map = m_curve_charging;
+    if( !charging && m_calibration.converged() )
+        return m_calibration.soc(voltage);
 
-    if( map.isEmpty() )
-        return 0;
+    const BatteryCurve &curve = charging ? m_curve_charging : m_curve_discharging;
+    return curve.soc(voltage);
+}
 
-    for( QPair<int, double> ent : map )
-    {
-        if( ent.first <= voltage )
-            return ent.second;
-    }
-    return map.last().second;
+QString HeadsetHID::calibrationFile()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/calibration.ini";
+}
+
+void HeadsetHID::calibrationOffline(bool lostPower)
+{
+    // The discharge so far carries over a restart of the daemon.
+    m_calibration.offline(lostPower);
+    m_calibration.save(calibrationFile(), m_serial);
 }
 
 void HeadsetHID::loadMaps()
 {
-    m_curve_charging = loadMap(":/maps/charging_ascending.csv", true);
-    m_curve_discharging = loadMap(":/maps/discharging.csv", false);
+    // The built-in curves are compiled in, these are only custom overrides in
+    // the same format as maps/*.csv, next to the settings file.
+    QString dir = QFileInfo(QSettings().fileName()).absolutePath();
+    QString charging = dir + "/charging.csv";
+    QString discharging = dir + "/discharging.csv";
+
+    if( QFile::exists(charging) )
+        m_curve_charging.build( loadMap(charging) );
+    if( QFile::exists(discharging) )
+        m_curve_discharging.build( loadMap(discharging) );
 }
 
-QList< QPair<int, double> > HeadsetHID::loadMap(const QString &path, bool reversed)
+QList< QPair<int, double> > HeadsetHID::loadMap(const QString &path)
 {
     QList< QPair<int, double> > res;
     QFile f(path);
@@ -238,22 +1244,21 @@ QList< QPair<int, double> > HeadsetHID::loadMap(const QString &path, bool revers
         QPair<int, double> entry;
         entry.first = parts[0].toInt();
         entry.second = parts[1].toDouble();
-
-        if( reversed )
-            res.push_front(entry);
-        else
-            res.push_back(entry);
+        res.push_back(entry);
     }
     return res;
 }
 
 bool HeadsetHID::readyForRequest()
 {
-    if( !m_handle && !open() )
+    // Reopening is left to HeadsetManager.
+    if( !m_device )
     {
         if( m_online )
-            emit onlineChanged(false);
-        m_online = false;
+        {
+            m_online = false;
+            emit onlineChanged(m_online);
+        }
         return false;
     }
     return true;
@@ -266,279 +1271,477 @@ bool HeadsetHID::readVoltage()
         https://github.com/ashkitten/g933-utils/
         I've simply ported that implementation to this project!
     */
-    if( !readyForRequest() )
-        return false;
-
-    int r = 0;
     quint8 data_request[HIDPP_LONG_MESSAGE_LENGTH] = { HIDPP_LONG_MESSAGE, HIDPP_DEVICE_RECEIVER, 0x08, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    data_request[2] = m_features.index(FeatureBattery);
 
-    r = hid_write(m_handle, data_request, sizeof(data_request) / sizeof(data_request[0]));
-    if( r < 0 )
-    {
-        qDebug() << "HeadsetHID::voltage(): Failed to write to headset.";
-        qDebug() << QString::fromWCharArray(hid_error(NULL));
-        close();
-        return false;
-    }
-
-    return true;
+    return sendRequest(Voltage, data_request);
 }
 
 bool HeadsetHID::readVersion()
 {
-    if( !readyForRequest() )
-        return false;
-
-    int r = 0;
+    // Not a HID++ 2.0 request, nothing comes back that we could match.
     quint8 data_request[HIDPP_LONG_MESSAGE_LENGTH] = { HIDPP_LONG_MESSAGE, HIDPP_DEVICE_RECEIVER, 0x11, 0xff, 0x00, 0x11, 0x00, 0x00, 0xaf, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
 
-    r = hid_write(m_handle, data_request, sizeof(data_request) / sizeof(data_request[0]));
-    if( r < 0 )
-    {
-        qDebug() << "HeadsetHID::readVersion(): Failed to write to headset.";
-        qDebug() << QString::fromWCharArray(hid_error(NULL));
-        close();
-        return false;
-    }
+    return sendRequest(Version, data_request, false);
+}
 
-    return true;
+bool HeadsetHID::findFeature(RequestType t)
+{
+    HidppFeature feature = FeatureLighting;
+    if( t == FindFirmware )
+        feature = FeatureFirmware;
+    else if( t == FindBattery )
+        feature = FeatureBattery;
+    else if( t == FindSidetone )
+        feature = FeatureSidetone;
+    quint16 id = HidppFeatureMap::featureId(feature);
+
+    // Root feature getFeature(id): 11 ff 00 0x <id hi> <id lo>
+    quint8 data_request[HIDPP_LONG_MESSAGE_LENGTH] = { HIDPP_LONG_MESSAGE, HIDPP_DEVICE_RECEIVER, 0x00, 0x00, quint8(id >> 8), quint8(id & 0xff), 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+    if( sendRequest(t, data_request) )
+        return true;
+
+    m_discoveryFailed = true;
+    discoveryStep(t);
+    return false;
 }
 
-bool HeadsetHID::readFeatures()
+bool HeadsetHID::readFirmware()
 {
-    if( !readyForRequest() )
-        return false;
+    // Firmware getFwInfo(entity 0): 11 ff <fw> 1x 00
+    quint8 data_request[HIDPP_LONG_MESSAGE_LENGTH] = { HIDPP_LONG_MESSAGE, HIDPP_DEVICE_RECEIVER, 0x00, 0x10, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    data_request[2] = m_features.index(FeatureFirmware);
 
-    int r = 0;
-    quint8 data_request[HIDPP_LONG_MESSAGE_LENGTH] = { HIDPP_LONG_MESSAGE, HIDPP_DEVICE_RECEIVER, 0x08, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    if( data_request[2] && sendRequest(FirmwareInfo, data_request) )
+        return true;
 
-    r = hid_write(m_handle, data_request, sizeof(data_request) / sizeof(data_request[0]));
-    if( r < 0 )
+    discoveryStep(FirmwareInfo);
+    return false;
+}
+
+quint8 HeadsetHID::requestBit(RequestType t)
+{
+    switch( t )
     {
-        qDebug() << "HeadsetHID::readDeviceName(): Failed to write to headset.";
-        qDebug() << QString::fromWCharArray(hid_error(NULL));
-        close();
-        return false;
+    case FindFirmware:
+        return 0x01;
+    case FindBattery:
+        return 0x02;
+    case FindLighting:
+        return 0x04;
+    case FirmwareInfo:
+        return 0x08;
+    case FindSidetone:
+        return 0x10;
+    default:
+        return 0;
     }
+}
 
-    return true;
+void HeadsetHID::startDiscovery()
+{
+    m_featuresKnown = false;
+    m_featuresCached = false;
+    m_discoveryFailed = false;
+    m_discoveryPending = requestBit(FindFirmware) | requestBit(FindBattery) | requestBit(FindLighting) | requestBit(FindSidetone);
+    queueRequest(FindFirmware);
+    queueRequest(FindBattery);
+    queueRequest(FindLighting);
+    queueRequest(FindSidetone);
 }
 
-bool HeadsetHID::readDeviceName()
+void HeadsetHID::featureFound(RequestType t, quint8 index)
 {
-    if( !readyForRequest() )
-        return false;
+    // 0 means the device doesn't know the feature, the legacy index stays.
+    if( index )
+    {
+        if( t == FindFirmware )
+            m_features.set(FeatureFirmware, index);
+        else if( t == FindBattery )
+            m_features.set(FeatureBattery, index);
+        else if( t == FindLighting )
+            m_features.set(FeatureLighting, index);
+        else if( t == FindSidetone )
+            m_features.set(FeatureSidetone, index);
+    }
 
-    int r = 0;
-    quint8 data_request[HIDPP_LONG_MESSAGE_LENGTH] = { HIDPP_LONG_MESSAGE, HIDPP_DEVICE_RECEIVER, 0x08, 0x0a, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+    if( t == FindFirmware && index )
+    {
+        m_discoveryPending |= requestBit(FirmwareInfo);
+        queueRequest(FirmwareInfo);
+    }
 
-    r = hid_write(m_handle, data_request, sizeof(data_request) / sizeof(data_request[0]));
-    if( r < 0 )
+    discoveryStep(t);
+}
+
+void HeadsetHID::firmwareFound(const QString &version)
+{
+    m_firmware = version;
+
+    if( m_featuresCached && m_firmware != m_cachedFirmware )
     {
-        qDebug() << "HeadsetHID::readDeviceName(): Failed to write to headset.";
-        qDebug() << QString::fromWCharArray(hid_error(NULL));
-        close();
-        return false;
+        qDebug() << "HeadsetHID: Firmware changed from" << m_cachedFirmware << "to" << m_firmware << "rediscovering features.";
+        m_cachedFirmware.clear();
+        m_features = HidppFeatureMap();
+        startDiscovery();
+        return;
     }
 
-    return true;
+    discoveryStep(FirmwareInfo);
 }
 
-bool HeadsetHID::setLighting(bool onoff)
+void HeadsetHID::discoveryStep(RequestType t)
 {
-    // on, breathing  11 ff 04 3c 01 (0 for logo) 02 00 b6 ff 0f a0 00 64 00 00 00
-    // off            11 ff 04 3c 01 (0 for logo) 00
-    // logo and strips can be controlled individually
-    if( !readyForRequest() )
-        return false;
+    m_discoveryPending &= ~requestBit(t);
+    if( m_discoveryPending )
+        return;
+
+    if( !m_featuresCached && !m_discoveryFailed )
+        saveFeatures();
 
-    quint8 data_on[HIDPP_LONG_MESSAGE_LENGTH]  = { HIDPP_LONG_MESSAGE, HIDPP_DEVICE_RECEIVER, 0x04, 0x3c, 0x01, 0x02, 0x00, 0xb6, 0xff, 0x0f, 0xa0, 0x00, 0x64, 0x00, 0x00, 0x00 };
-    quint8 data_off[HIDPP_LONG_MESSAGE_LENGTH] = { HIDPP_LONG_MESSAGE, HIDPP_DEVICE_RECEIVER, 0x04, 0x3c, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
-    int res = hid_write(m_handle, onoff ? data_on : data_off, HIDPP_LONG_MESSAGE_LENGTH);
-    if( res < 0 )
+    // Read the battery again through the resolved index, that's when the
+    // headset counts as ready.
+    if( !m_featuresKnown )
     {
-        qDebug() << "HeadsetHID::setLighting(): Write error to headset.";
-        qDebug() << QString::fromWCharArray(hid_error(NULL));
-        close();
-        return false;
+        m_featuresKnown = true;
+        queueRequest(Voltage);
+        updateLighting();
+        updateSidetone();
     }
+}
 
-    m_lighting = onoff;
-    emit lightingChanged(onoff);
-    return true;
+QString HeadsetHID::featureCacheFile()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/features.ini";
 }
 
-bool HeadsetHID::setLogoLighting(bool onoff)
+bool HeadsetHID::loadFeatures()
 {
-    if( !readyForRequest() )
+    QSettings cache(featureCacheFile(), QSettings::IniFormat);
+    cache.beginGroup(m_serial);
+    if( !cache.contains("Firmware") )
         return false;
 
-    // turn logo lights on/off
-    uint8_t data_logo_on[HIDPP_LONG_MESSAGE_LENGTH]  = { HIDPP_LONG_MESSAGE, HIDPP_DEVICE_RECEIVER, 0x04, 0x3c, 0x00, 0x02, 0x00, 0xb6, 0xff, 0x0f, 0xa0, 0x00, 0x64, 0x00, 0x00, 0x00 };
-    uint8_t data_logo_off[HIDPP_LONG_MESSAGE_LENGTH] = { HIDPP_LONG_MESSAGE, HIDPP_DEVICE_RECEIVER, 0x04, 0x3c, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
-    int res = hid_write(m_handle, onoff ? data_logo_on : data_logo_off, HIDPP_LONG_MESSAGE_LENGTH);
-    if( res < 0 )
+    m_cachedFirmware = cache.value("Firmware").toString();
+    m_features = HidppFeatureMap();
+    m_features.set(FeatureFirmware, quint8(cache.value("FirmwareIndex").toUInt()));
+    m_features.set(FeatureBattery, quint8(cache.value("BatteryIndex", m_features.index(FeatureBattery)).toUInt()));
+    m_features.set(FeatureLighting, quint8(cache.value("LightingIndex", m_features.index(FeatureLighting)).toUInt()));
+    m_features.set(FeatureSidetone, quint8(cache.value("SidetoneIndex", m_features.index(FeatureSidetone)).toUInt()));
+    return true;
+}
+
+void HeadsetHID::saveFeatures()
+{
+    // Without a firmware version there is nothing to tell a stale entry by.
+    if( m_firmware.isEmpty() )
+        return;
+
+    QSettings cache(featureCacheFile(), QSettings::IniFormat);
+    cache.beginGroup(m_serial);
+    cache.setValue("Firmware", m_firmware);
+    cache.setValue("FirmwareIndex", m_features.index(FeatureFirmware));
+    cache.setValue("BatteryIndex", m_features.index(FeatureBattery));
+    cache.setValue("LightingIndex", m_features.index(FeatureLighting));
+    cache.setValue("SidetoneIndex", m_features.index(FeatureSidetone));
+    cache.endGroup();
+
+    m_cachedFirmware = m_firmware;
+}
+
+bool HeadsetHID::writeLighting(int zone)
+{
+    // Changed back to what the headset already shows while it was queued,
+    // or discovery started over since.
+    if( !m_lighting.needsWrite(zone) || !m_featuresKnown )
+        return true;
+
+    // on, breathing  11 ff 04 3c 01 (0 for logo) 02 00 b6 ff 0f a0 00 64 00 00 00
+    // off            11 ff 04 3c 01 (0 for logo) 00
+    // see LightingEngine::encode() for the rest
+    quint8 packet[HIDPP_LONG_MESSAGE_LENGTH] = { HIDPP_LONG_MESSAGE, HIDPP_DEVICE_RECEIVER, 0x04, 0x3c };
+    packet[2] = m_features.index(FeatureLighting);
+    m_lighting.write(zone, packet);
+    if( !sendRequest(RequestType(LightingLogo + zone), packet) )
     {
-        qDebug() << "HeadsetHID::setLogoLighting(): Write error to headset.";
-        qDebug() << QString::fromWCharArray(hid_error(NULL));
-        close();
+        m_lighting.failed(zone);
+        completeZone(zone, m_device ? ApplyFailed : ApplyOffline);
         return false;
     }
 
+    m_lightingWrites++;
+    if( m_restoreStarted >= 0 )
+        m_restoreWrites++;
     return true;
 }
 
-void printPacket(quint8 *data_read, int r)
+bool HeadsetHID::writeSidetone()
 {
-    char obuf[HIDPP_LONG_MESSAGE_LENGTH * 5 + 2];
-    obuf[0] = '\0';
-    for( int x=0; x < r; x++ )
+    if( m_sidetone < 0 || m_sidetoneSent >= 0 || m_sidetoneConfirmed == m_sidetone || !m_featuresKnown )
+        return true;
+
+    // setSidetoneLevel(level): 11 ff 07 1x <level>
+    quint8 packet[HIDPP_LONG_MESSAGE_LENGTH] = { HIDPP_LONG_MESSAGE, HIDPP_DEVICE_RECEIVER, 0x07, 0x10 };
+    packet[2] = m_features.index(FeatureSidetone);
+    packet[4] = quint8(m_sidetone);
+    if( !sendRequest(Sidetone, packet) )
     {
-        char codeout[6];
-        snprintf(codeout, sizeof(codeout), " %x", data_read[x]);
-        strcat(obuf, codeout);
+        completeSidetone(m_device ? ApplyFailed : ApplyOffline);
+        return false;
     }
-    printf("Received: %s\n", obuf);
+
+    m_sidetoneSent = m_sidetone;
+    if( m_restoreStarted >= 0 )
+        m_restoreWrites++;
+    return true;
 }
 
 void HeadsetHID::readFromDevice()
 {
-    if( !m_handle )
+    if( !m_device )
         return;
 
-    quint8 data_read[7];
-    memset( data_read, 0, sizeof(data_read) );
-    int r = hid_read_timeout(m_handle, data_read, 7, REQUEST_TIMEOUT);
-    if( 0 == r )
+    // Drain everything the kernel has queued so bursts are handled in one pass.
+    int drained = 0;
+    quint8 data_read[HIDPP_LONG_MESSAGE_LENGTH];
+    for( ;; )
     {
-        m_timeout++;
-        if( m_online && m_timeout >= 20 )
+        memset( data_read, 0, sizeof(data_read) );
+        int r = m_device->read(data_read, sizeof(data_read));
+        if( r < 0 )
         {
-            m_online = false;
-            emit onlineChanged(m_online);
-            return;
+            // The receiver went away.
+            close();
+            break;
         }
-        return;
+        else if( 0 == r )
+            break;
+
+        drained++;
+        handleReport(data_read, r);
+
+        // close() may have been called by a handler.
+        if( !m_device )
+            break;
     }
-    else if( !m_online && m_timeout >= 20 )
+
+    STATS( m_stats.add(HeadsetStats::Reports, drained) );
+    STATS( m_stats.tick(m_clock.elapsed()) );
+
+    m_wakeups++;
+    m_drainedLast = drained;
+    m_drainedTotal += drained;
+    if( drained > m_drainedMax )
+        m_drainedMax = drained;
+
+    // A full queue means the kernel may have discarded the oldest reports.
+    if( drained >= HIDRAW_QUEUE )
+        m_overruns++;
+
+    publishState();
+}
+
+void HeadsetHID::handleReport(const quint8 *data_read, int r)
+{
+    RequestType request = Version;
+    bool reply = completeRequest(data_read, r, request);
+
+    if( !m_online && m_timeout >= TIMEOUT_LIMIT )
     {
         m_online = true;
         emit onlineChanged(m_online);
     }
     m_timeout = 0;
 
-    if( r >= 4 && data_read[0] == 0x11 && data_read[1] == 0xff )
+    HidppEvent event;
+    if( !HidppDecoder::decode(data_read, r, m_features, event) )
     {
-        if( r >= 5 && data_read[2] == 0x05 && data_read[3] == 0 )
-        {
-            uint8_t mask = 1;
-            for( int x=0; x < 8; x++ )
-            {
-                bool wason = (m_buttons & mask);
-                bool ison = (data_read[4] & mask);
-                if( wason != ison )
-                    emit buttonPressed(x, ison);
+        m_unknownReports++;
+#if TRACE_LEVEL >= TRACE_DEBUG
+        quint8 bytes[8] = { 0 };
+        memcpy(bytes, data_read, qMin(r, 8));
+        TRACE(TRACE_DEBUG, TraceUnknownReport, r, qFromBigEndian<quint32>(bytes), qFromBigEndian<quint32>(bytes + 4));
+#endif
+        return;
+    }
 
-                mask <<= 1;
-            }
-            m_buttons = data_read[4];
+    applyEvent(event, reply ? &request : nullptr);
+}
 
-            return;
+void HeadsetHID::applyEvent(const HidppEvent &event, const RequestType *request)
+{
+    switch( event.type )
+    {
+    case HidppFeatureIndex:
+        if( request && (requestBit(*request) & m_discoveryPending) )
+            featureFound(*request, event.index);
+        break;
+
+    case HidppFirmware:
+        if( request && *request == FirmwareInfo )
+            firmwareFound(QString::fromLatin1(event.firmware));
+        break;
+
+    case HidppButtons:
+    {
+        qint64 start = m_clock.nsecsElapsed();
+        TRACE(TRACE_DEBUG, TraceButtons, event.buttons);
+        int actions = m_buttonEngine.update(event.buttons, m_clock.elapsed(), m_actionSink);
+        if( actions )
+        {
+            int latency = int((m_clock.nsecsElapsed() - start) / 1000);
+            TRACE(TRACE_INFO, TraceButtonActions, event.buttons, actions, latency);
+            m_buttonActions += actions;
+            if( latency > m_buttonLatencyMax )
+                m_buttonLatencyMax = latency;
+            publishState();
         }
-        // Battery voltage, seems like a janky way to know SoC.
-        else if( r >= 7 )
+        armButtonTimer();
+
+        // Clients still get every change.
+        quint8 mask = 1;
+        for( int x=0; x < 8; x++ )
         {
-            if( data_read[2] == 0x08 && data_read[3] == 0x0a )
-            {
+            bool wason = (m_buttons & mask);
+            bool ison = (event.buttons & mask);
+            if( wason != ison )
+                emit buttonPressed(x, ison);
+
+            mask <<= 1;
+        }
+        m_buttons = event.buttons;
+        break;
+    }
 
-                quint16 v = (data_read[4] << 8) | data_read[5];
-                if( m_voltage != v )
-                    emit voltageChanged(v);
+    // Battery voltage, seems like a janky way to know SoC.
+    case HidppBattery:
+    {
+        bool voltageMoved = m_voltage != event.voltage;
+        m_voltage = event.voltage;
+        if( voltageMoved )
+            emit voltageChanged(m_voltage);
+
+        bool ostate = m_charging;
+        m_charging = event.charging;
+        if( ostate != m_charging )
+            emit chargingChanged(m_charging);
+
+        double exactSoC = voltageToSoC(m_voltage, m_charging);
+        int newSoC = exactSoC;
+        TRACE(TRACE_DEBUG, TraceVoltage, m_voltage, m_charging, newSoC);
+        if( newSoC != m_soc )
+        {
+            m_soc = newSoC;
+            emit socChanged(newSoC);
+        }
 
-                m_voltage = v;
+        recordHistory(ostate != m_charging ? HistoryChargingChanged : HistorySample, exactSoC);
 
-                uint8_t state = data_read[6];
-                bool ostate = m_charging;
-                if (state == 0x03)
-                    m_charging = true;
-                else
-                    m_charging = false;
+        if( m_timeToReady < 0 && m_featuresKnown )
+        {
+            m_timeToReady = int(m_clock.elapsed() - m_openedAt);
+            TRACE(TRACE_INFO, TraceReady, m_timeToReady, m_featuresCached);
+            publishState();
+        }
 
-                if( ostate != m_charging )
-                    emit chargingChanged(m_charging);
+        m_scheduler.setCharging(m_charging);
+        m_scheduler.sample(m_voltage, exactSoC);
+        schedulePoll();
 
-                int newSoC = voltageToSoC(m_voltage, m_charging);
-                if( newSoC != m_soc )
-                    emit socChanged(newSoC);
-                m_soc = newSoC;
+        int oldEmpty = m_estimator.timeToEmpty();
+        int oldFull = m_estimator.timeToFull();
+        m_estimator.setCharging(m_charging);
+        double filtered = m_estimator.filterVoltage(m_voltage);
+        m_estimator.sample(m_clock.elapsed(), voltageToSoC(qRound(filtered), m_charging));
 
-                return;
-            }
-            // 11 ff 8 0 0 0 0
-            else if( data_read[2] == 0x08 && data_read[3] == 0 && data_read[4] == 0 && data_read[5] == 0 && data_read[6] == 0 )
-            {
-                printf("Sleeping\n");
-                if( m_online )
-                {
-                    m_online = false;
-                    emit onlineChanged(m_online);
-                }
+        // The calibration is judged against the built-in curve, and its
+        // clock has to run across restarts.
+        if( m_calibration.sample(QDateTime::currentMSecsSinceEpoch(), qRound(filtered), m_charging,
+                                 m_curve_discharging.soc(qRound(filtered))) )
+        {
+            m_calibration.save(calibrationFile(), m_serial);
+            qDebug() << "HeadsetHID: Learned discharge" << m_calibration.cycles() << "for" << m_serial;
+            publishState();
+        }
+        if( oldEmpty != m_estimator.timeToEmpty() )
+            emit timeToEmptyChanged(m_estimator.timeToEmpty());
+        if( oldFull != m_estimator.timeToFull() )
+            emit timeToFullChanged(m_estimator.timeToFull());
+        break;
+    }
 
-                return;
-            }
-            // 11 ff 8 0 f 83 1 <- 0=sleep, 1=woke?
-            //           `--'- important?
-            else if( data_read[2] == 0x08 && data_read[3] == 0 && data_read[6] == 0x01 )
-            {
-                printf("Waking\n");
-                if( !m_online )
-                {
-                    m_online = true;
-                    emit onlineChanged(m_online);
+    case HidppSleep:
+        TRACE(TRACE_INFO, TraceSleep);
+        calibrationOffline(false);
+        if( m_online )
+        {
+            m_online = false;
+            emit onlineChanged(m_online);
+        }
+        recordHistory(HistorySleep, m_soc);
+        break;
 
-                    setLighting(m_lighting);
-                }
+    case HidppWake:
+        TRACE(TRACE_INFO, TraceWake);
+        if( !m_online )
+        {
+            // It forgets its settings while asleep, onlineChanged() puts
+            // them back.
+            startRestore();
+            m_online = true;
+            emit onlineChanged(m_online);
+        }
+        recordHistory(HistoryWake, m_soc);
+        break;
 
-                return;
-            }
-            // 11 ff ff 8 a 5 0
-            else if( data_read[2] == 0xff && data_read[3] == 0x08 && data_read[4] == 0x0a && data_read[5] == 0x05 && data_read[6] == 0x00 )
-            {
-                //printf("Timeout?\n");
-                //printPacket(data_read, r);
+    // Already matched to its request by completeRequest(), only discovery
+    // cares.
+    case HidppError:
+        if( request && (requestBit(*request) & m_discoveryPending) )
+        {
+            m_discoveryFailed = true;
+            discoveryStep(*request);
+        }
+        // Not retried until the zone changes again.
+        if( request && isLighting(*request) )
+        {
+            m_lighting.failed(*request - LightingLogo);
+            completeZone(*request - LightingLogo, ApplyFailed);
+        }
+        if( request && *request == Sidetone )
+        {
+            m_sidetoneSent = -1;
+            completeSidetone(ApplyFailed);
+        }
+        break;
 
-                return;
-            }
-            // 11 ff 4 3c 1 2 0 // Lights on (breathing mode) confirmed
-            else if( data_read[2] == 0x04 && data_read[3] == 0x3c && data_read[6] == 0 )
-            {
-                bool someon = false;
-                if( data_read[4] == 1 && data_read[5] == 2 )
-                {
-                    someon = true;
-                    printf("Lights on (Breathing)\n");
-                }
-                else if( data_read[4] == 1 && data_read[5] == 0 )
-                    printf("Lights off\n");
-                else if( data_read[4] == 0 && data_read[5] == 2 )
-                {
-                    someon = true;
-                    printf("Logo on (Breathing)\n");
-                }
-                else if( data_read[4] == 0 && data_read[5] == 0 )
-                    printf("Logo off\n");
-
-                if( someon != m_lighting )
-                {
-                    printf("Restoring previous lighting state, %s\n", m_lighting ? "on" : "off");
-                    setLighting(m_lighting);
-                }
+    // The reply may not echo the level, what was sent is what counts.
+    case HidppSidetone:
+        if( request && *request == Sidetone && m_sidetoneSent >= 0 )
+        {
+            m_sidetoneConfirmed = m_sidetoneSent;
+            m_sidetoneSent = -1;
+            TRACE(TRACE_INFO, TraceSidetone, m_sidetoneConfirmed);
+        }
+        updateSidetone();
+        break;
 
-                return;
-            }
+    case HidppLighting:
+        TRACE(TRACE_INFO, TraceLighting, event.zone, event.mode);
+        if( request && isLighting(*request) )
+            m_lighting.confirmed(*request - LightingLogo);
+        else if( event.zone < LightingZoneCount )
+        {
+            // Changed behind our back, put back what was asked for.
+            m_lighting.reported(event.zone, event.mode);
+            if( m_lighting.needsWrite(event.zone) )
+                TRACE(TRACE_INFO, TraceLightingRestore, event.zone);
         }
-    }
+        updateLighting();
+        break;
 
-    printf("Unhandled packet:\n");
-    printPacket(data_read, r);
+    default:
+        break;
+    }
 }
@@ -1,87 +1,400 @@
 #ifndef HEADSETHID_H
 #define HEADSETHID_H
 
+#include <QElapsedTimer>
+#include <QHash>
 #include <QList>
+#include <QMap>
 #include <QObject>
+#include <QSocketNotifier>
 #include <QTimer>
 
-#include <hidapi.h>
+#include "actionsink.h"
+#include "batterycalibration.h"
+#include "batterycurve.h"
+#include "batteryestimator.h"
+#include "buttonengine.h"
+#include "hidppdecoder.h"
+#include "headsetstats.h"
+#include "hidtransport.h"
+#include "lightingengine.h"
+#include "pollscheduler.h"
+#include "seqlock.h"
+#include "settingsstore.h"
+#include "spscqueue.h"
+#include "telemetryhistory.h"
+
+#define VENDOR_LOGITECH     0x046d
+#define ID_LOGITECH_G733    0x0ab5
+
+#ifndef HIDPP_LONG_MESSAGE
+# define HIDPP_LONG_MESSAGE 0x11
+# define HIDPP_LONG_MESSAGE_LENGTH 20
+# define HIDPP_DEVICE_RECEIVER 0xff
+#endif
 
 #define REQUEST_TIMEOUT 100 // in ms
+#define REQUEST_RETRIES 2   // resends before a request counts as timed out
+#define MAX_INFLIGHT    8   // requests awaiting a reply at once
+#define TIMEOUT_LIMIT   3   // timed out requests before going offline
+#define HIDRAW_QUEUE    64  // HIDRAW_BUFFER_SIZE, reports the kernel queues per reader
+#define COMMAND_QUEUE   64  // commands waiting for the I/O thread
+#define REQUEST_QUEUE   16  // requests waiting to be written, at most one of each kind
+#define STATE_LOG_SIZE  64  // property changes changesSince() reaches back over
+#define STORE_DELAY     1000    // ms changes wait before device.ini is written
+
+// How a change made with a ticket ended up, see settingApplied().
+typedef enum {
+    ApplyDone,          // the headset acknowledged it, or already showed it
+    ApplyFailed,        // it answered with an error, or the write failed
+    ApplyTimedOut,      // no answer despite retries
+    ApplyOffline,       // kept for when the headset is back
+    ApplySuperseded     // a later change to the zone or sidetone came first
+} ApplyResult;
+
+// The values clients see as properties, in the order of statePropertyName().
+typedef enum {
+    StateOnline,
+    StateCharging,
+    StateLighting,
+    StateVoltage,
+    StateSoc,
+    StatePollInterval,
+    StateTimeToEmpty,
+    StateTimeToFull,
+    StateSidetone,
+    StatePropertyCount
+} StateProperty;
+
+typedef struct {
+    quint64 sequence;       // of the publication that made the change
+    qint32  value;
+    quint8  property;       // StateProperty
+} StateChange;
+
+// The last STATE_LOG_SIZE property changes, a ring written at head.
+typedef struct {
+    quint64 sequence;       // newest change
+    int     count;
+    int     head;
+    StateChange changes[STATE_LOG_SIZE];
+} StateLog;
+
+// What other threads get to see of a headset, published as one unit.
+typedef struct {
+    quint64 sequence;       // bumped by every publication that changed a property
+    bool    online;
+    bool    charging;
+    bool    lighting;
+    int     voltage;
+    int     soc;
+    int     pollInterval;
+    int     timeToEmpty;
+    int     timeToFull;
+    int     drainedLast;
+    int     drainedMax;
+    quint64 drainedTotal;
+    quint64 wakeups;
+    quint64 overruns;
+    quint64 unknownReports;
+    int     queueDepth;
+    int     queueDepthMax;
+    quint64 requestsSuperseded;
+    quint64 requestsDropped;
+    int     commandLatencyMax;  // ms from queueing a command to writing it
+    int     timeToReady;        // ms from open() to a reading through known features, -1 until then
+    bool    featuresCached;     // feature indices came from the cache
+    LightingEffect lightingZones[LightingZoneCount];
+    quint64 lightingWrites;
+    quint64 lightingFramesSkipped;  // animation frames not sent, see lightingFrame()
+    quint64 buttonActions;
+    int     buttonLatencyMax;   // µs from decoding a button report to its actions having run
+    int     sidetone;           // percent, -1 leaves the headset's own
+    int     timeToRestore;      // ms from the last wake or open to the stored settings being back, -1 until then
+    int     calibrationCycles;  // full discharges learned into this headset's own curve
+} HeadsetState;
 
+// Lives on the I/O thread together with the device. Getters read the last
+// published HeadsetState and commands go through m_commands, so other threads
+// never wait on the device.
 class HeadsetHID : public QObject
 {
     Q_OBJECT
 
     typedef enum {
-        Noop,
-        DeviceName,
-        Features,
-        LightsOn,
-        LogoOn,
-        LightsOff,
-        LogoOff,
+        FindFirmware,
+        FindBattery,
+        FindLighting,
+        FirmwareInfo,
+        LightingLogo,       // one per LightingZone, in the same order
+        LightingStrips,
         Version,
-        Voltage
+        Voltage,
+        FindSidetone,       // appended, trace dumps and stats go by number
+        Sidetone,
+        RequestTypeCount
     } RequestType;
 
+    typedef struct {
+        RequestType type;
+        qint64      queued;
+    } QueuedRequest;
+
+    // A written request waiting for its reply, keyed by feature index and
+    // function/software-id byte (see requestKey()).
+    typedef struct {
+        RequestType type;
+        quint8      packet[HIDPP_LONG_MESSAGE_LENGTH];
+        qint64      deadline;
+        qint64      sent;       // µs, last write
+        int         retries;
+    } PendingRequest;
+
+    typedef enum {
+        SetLighting,
+        SetZoneEffect,
+        SetSidetone
+    } CommandType;
+
+    typedef struct {
+        CommandType type;
+        int         arg;
+        LightingEffect effect;
+        quint32     ticket;
+    } Command;
+
     int         m_timeout;
     quint8      m_buttons;
+    int         m_drainedLast;
+    int         m_drainedMax;
+    quint64     m_drainedTotal;
+    quint64     m_wakeups;
+    quint64     m_overruns;
+    quint64     m_unknownReports;
     QTimer      m_pollTimer;
     QTimer      m_requestTimer;
+    QTimer      m_replyTimer;
+    QTimer      m_frameTimer;
+    QTimer      m_buttonTimer;
+    QElapsedTimer m_clock;
+    quint8      m_swid;
+    PollScheduler m_scheduler;
+    BatteryEstimator m_estimator;
+    int         m_pollInterval;
+
+    // Commands first, then telemetry, each in the order queued.
+    QList<QueuedRequest> m_requests;
+    int         m_queueDepthMax;
+    quint64     m_requestsSuperseded;
+    quint64     m_requestsDropped;
+    int         m_commandLatencyMax;
 
-    QList<RequestType> m_requests;
+    // Feature discovery. Indices are cached per serial in features.ini under
+    // the cache location, valid for as long as the firmware version matches.
+    HidppFeatureMap m_features;
+    quint8      m_discoveryPending;     // bits of requestBit()
+    bool        m_discoveryFailed;      // some index is only a guess, don't cache
+    bool        m_featuresKnown;
+    bool        m_featuresCached;
+    QString     m_firmware;
+    QString     m_cachedFirmware;
+    qint64      m_openedAt;
+    int         m_timeToReady;
+    QHash<quint16, PendingRequest> m_inflight;
+
+    // Button bindings run right here on the I/O thread, straight from the
+    // decoded report.
+    ButtonEngine m_buttonEngine;
+    ActionSink  *m_actionSink;
+    quint64     m_buttonActions;
+    int         m_buttonLatencyMax;
+
+#ifdef HEADSET_STATS
+    HeadsetStats m_stats;
+#endif
+
+    SeqLock<HeadsetState> m_state;
+    StateLog    m_log;
+    SeqLock<StateLog> m_changes;
+    SpscQueue<Command, COMMAND_QUEUE> m_commands;
+    int         m_commandFd;
+    QSocketNotifier *m_commandNotifier;
 
 public:
     explicit HeadsetHID(QObject *parent = nullptr);
+    ~HeadsetHID();
+
+    // Only from the thread the object lives on. Takes ownership, open()
+    // picks the hidapi one when none was set.
+    void setTransport(HidTransport *transport);
+
+    // Same for where button actions go, open() creates a SystemActionSink
+    // when none was set.
+    void setActionSink(ActionSink *sink);
+    Q_INVOKABLE bool open(const QString &hid_path);
+    Q_INVOKABLE void close();
+
+    // Safe from any thread, never blocks. version counts publications.
+    HeadsetState state(quint64 *version = nullptr) const;
+#ifdef HEADSET_STATS
+    const HeadsetStats &stats() const;
+
+    // Set once by HeadsetManager, a receiver plugged back in gets a new
+    // HeadsetHID.
+    void setReconnects(quint64 n);
+#endif
 
-    static QString findDevice();
-    bool open();
-    void close();
+    // Latest value of every property changed after sequence, false if the
+    // log no longer reaches back that far and only state() will do.
+    bool changesSince(quint64 sequence, QMap<int, qint32> &changes, quint64 *current = nullptr) const;
+
+    // Name of a RequestType, nullptr past the last one.
+    static const char *requestName(int type);
+
+    // D-Bus property name of a StateProperty and its value in st.
+    static const char *statePropertyName(int property);
+    static qint32 stateValue(const HeadsetState &st, int property);
 
 public slots:
+    QString path();
+    QString serial();
     int voltage();
     int soc();
     bool online();
     bool charging();
     bool lighting();
+    int pollInterval();
+    int timeToEmpty();
+    int timeToFull();
+    // Only from the thread the object lives on, the ring goes away with
+    // close().
+    QByteArray history(qint64 from, qint64 to, int maxRecords);
+    QString historyFile();
     void enableLighting(bool onoff);
+    // A non-zero ticket is answered by one settingApplied() once the headset
+    // acknowledged the change, or it failed.
+    void setZoneEffect(int zone, const LightingEffect &effect, quint32 ticket = 0);
+    LightingEffect zoneEffect(int zone);
+    int sidetone();
+    // A non-zero ticket is answered like setZoneEffect()'s.
+    void setSidetone(int level, quint32 ticket = 0);
+
+    int reportsDrainedLast();
+    int reportsDrainedMax();
+    quint64 reportsDrainedTotal();
+    quint64 readWakeups();
+    quint64 queueOverruns();
 
 protected:
-    hid_device  *m_handle;
+    QString     m_path;
+    QString     m_serial;       // the device node's name when it reports none
+    HidTransport *m_transport;  // used by the next open()
+    HidTransport *m_device;     // while open
 
     bool m_online;
     bool m_charging;
-    bool m_lighting;
+    LightingEngine m_lighting;
+    bool m_lightingEnabled;
+    quint32 m_zoneTicket[LightingZoneCount];    // awaiting settingApplied(), 0 for none
+    quint64 m_lightingWrites;
+    quint64 m_framesSkipped;
+
+    // What gets replayed after a wake or reconnect, and how long that took.
+    SettingsStore m_store;
+    QTimer  m_storeTimer;       // batches the writes to device.ini
+    bool    m_loaded;           // maps read, by the first open()
+    int     m_sidetone;
+    int     m_sidetoneConfirmed;    // -1 while unknown
+    int     m_sidetoneSent;         // -1 unless a write is in flight
+    quint32 m_sidetoneTicket;       // awaiting settingApplied(), 0 for none
+    qint64  m_restoreStarted;       // -1 unless restoring
+    int     m_restoreWrites;
+    int     m_timeToRestore;
     quint16 m_voltage;
     quint16 m_soc;
 
-    QList< QPair<int, double> > m_curve_discharging;
-    QList< QPair<int, double> > m_curve_charging;
+    TelemetryHistory m_history;
+
+    BatteryCurve m_curve_discharging;
+    BatteryCurve m_curve_charging;
+
+    // This headset's own discharge curve, per serial in calibration.ini
+    // under the data location. Replaces m_curve_discharging once converged.
+    BatteryCalibration m_calibration;
+    void calibrationOffline(bool lostPower);
+    static QString calibrationFile();
 
     double voltageToSoC(int voltage, bool charging);
-    QList< QPair<int, double> > loadMap(const QString &path, bool reversed);
+    QList< QPair<int, double> > loadMap(const QString &path);
     void loadMaps();
+    void recordHistory(quint8 event, double soc);
+    void applyEvent(const HidppEvent &event, const RequestType *request);
+    void startDiscovery();
+    void featureFound(RequestType t, quint8 index);
+    void firmwareFound(const QString &version);
+    void discoveryStep(RequestType t);
+    bool loadFeatures();
+    void saveFeatures();
+    static QString featureCacheFile();
+    static quint8 requestBit(RequestType t);
+    void publishState();
+    bool postCommand(CommandType type, int arg, const LightingEffect &effect = LightingEffect(), quint32 ticket = 0);
+    void applyLighting(bool onoff);
+    void applyZoneEffect(int zone, const LightingEffect &effect, quint32 ticket);
+    void updateLighting();
+    void completeZone(int zone, ApplyResult result);
+    void loadStore();
+    void storeChanged();
+    void flushStore();
+    void applySidetone(int level, quint32 ticket);
+    void updateSidetone();
+    void completeSidetone(ApplyResult result);
+    void startRestore();
+    void checkRestored();
+    void armButtonTimer();
+    static bool isLighting(RequestType t);
 
     bool readyForRequest();
+    void queueRequest(RequestType t);
+    void dropTelemetry();
+    static bool isCommand(RequestType t);
+    bool sendRequest(RequestType t, quint8 *packet, bool expectsReply=true);
+    bool completeRequest(const quint8 *data_read, int r, RequestType &type);
+    void armReplyTimer();
+    static quint16 requestKey(quint8 feature, quint8 function);
 
 private slots:
     bool readVersion();
     bool readVoltage();
-    bool readFeatures();
-    bool readDeviceName();
-    bool setLighting(bool onoff);
-    bool setLogoLighting(bool onoff);
+    bool findFeature(RequestType t);
+    bool readFirmware();
+    bool writeLighting(int zone);
+    bool writeSidetone();
+    void lightingFrame();
+    void buttonTimeout();
     void processRequest();
     void readFromDevice();
+    void runCommands();
+    void handleReport(const quint8 *data_read, int r);
+    void replyTimedOut();
+    void pollVoltage();
+    void schedulePoll();
 
 signals:
     void chargingChanged(bool onoff);
     void onlineChanged(bool onoff);
+    // The device is gone from under it, or close() was called. Only open()
+    // brings it back, onlineChanged() alone also means asleep.
+    void closed();
     void voltageChanged(double voltage);
     void socChanged(int soc);
     void lightingChanged(bool onoff);
+    void sidetoneChanged(int level);
+    void settingApplied(quint32 ticket, int result);
     void buttonPressed(int index, bool pressed);
+    void pollIntervalChanged(int interval);
+    void timeToEmptyChanged(int seconds);
+    void timeToFullChanged(int seconds);
 };
 
 #endif // HEADSETHID_H
@@ -0,0 +1,291 @@
+#include "headsetmanager.h"
+
+#include <QDebug>
+#include <QTimer>
+
+#include "headsetdbusservice.h"
+#ifdef HEADSET_STATS
+# include "headsetstatsdbusservice.h"
+#endif
+
+HeadsetManager::HeadsetManager(HotplugMonitor *monitor, const QDBusConnection &bus, QObject *parent)
+    : QObject{parent},
+      m_monitor{monitor},
+      m_bus{bus},
+      m_primary{nullptr},
+      m_timeToNameOwned{-1},
+      m_timeToFirstVoltage{-1},
+      m_idleExit{0},
+      m_idleTimer{this}
+{
+    m_clock.start();
+    connect( m_monitor, &HotplugMonitor::deviceAdded, this, &HeadsetManager::deviceAdded );
+    connect( m_monitor, &HotplugMonitor::deviceRemoved, this, &HeadsetManager::deviceRemoved );
+
+    connect( &m_idleTimer, &QTimer::timeout, this, &HeadsetManager::idle );
+    m_idleTimer.setSingleShot(true);
+}
+
+HeadsetManager::~HeadsetManager()
+{
+    const QStringList paths = m_headsets.keys();
+    for( const QString &path : paths )
+        deviceRemoved(path);
+
+    // Queued behind their open(), so these run once it is done.
+    for( HeadsetHID *hid : m_opening )
+        retire(hid);
+    m_opening.clear();
+
+    // All of them close at once, a slow one only delays the exit.
+    for( QThread *thread : m_retiring )
+    {
+        thread->wait();
+        delete thread;
+    }
+    m_retiring.clear();
+}
+
+void HeadsetManager::start()
+{
+    if( !m_monitor->start() )
+        qDebug() << "HeadsetManager::start(): Hotplug monitoring unavailable, only headsets present now will be used.";
+
+    const QStringList found = m_monitor->scan();
+    if( found.isEmpty() )
+        qDebug() << "Couldn't find a compatible device.";
+
+    for( const QString &path : found )
+        deviceAdded(path);
+    checkIdle();
+}
+
+void HeadsetManager::setIdleExit(int ms)
+{
+    m_idleExit = qMax(0, ms);
+    checkIdle();
+}
+
+void HeadsetManager::checkIdle()
+{
+    if( m_idleExit > 0 && m_headsets.isEmpty() && m_opening.isEmpty() )
+    {
+        if( !m_idleTimer.isActive() )
+            m_idleTimer.start(m_idleExit);
+    }
+    else
+        m_idleTimer.stop();
+}
+
+void HeadsetManager::nameOwned()
+{
+    if( m_timeToNameOwned < 0 )
+        m_timeToNameOwned = int(m_clock.elapsed());
+}
+
+int HeadsetManager::timeToNameOwned() const
+{
+    return m_timeToNameOwned;
+}
+
+int HeadsetManager::timeToFirstVoltage() const
+{
+    return m_timeToFirstVoltage;
+}
+
+QStringList HeadsetManager::objectPaths() const
+{
+    QStringList result;
+    for( const Headset &h : m_headsets )
+        result.push_back(h.objectPath);
+    return result;
+}
+
+HeadsetHID *HeadsetManager::headset(const QString &objectPath) const
+{
+    for( const Headset &h : m_headsets )
+    {
+        if( h.objectPath == objectPath )
+            return h.hid;
+    }
+    return nullptr;
+}
+
+HeadsetHID *HeadsetManager::primary() const
+{
+    return m_primary;
+}
+
+void HeadsetManager::deviceAdded(const QString &path)
+{
+    if( m_headsets.contains(path) || m_opening.contains(path) )
+        return;
+
+    QThread *thread = new QThread;
+    thread->setObjectName(QString("hid-io-%1").arg(path.section('/', -1)));
+    connect( thread, &QThread::finished, this, [this, thread]() {
+        // finished() comes just before the thread is done.
+        m_retiring.remove(thread);
+        thread->wait();
+        delete thread;
+    } );
+    thread->start();
+
+    HeadsetHID *hid = createHeadset(path);
+    hid->moveToThread(thread);
+    m_opening.insert(path, hid);
+    checkIdle();
+
+    // A failed write closes it on the I/O thread, the node stays ours.
+    connect( hid, &HeadsetHID::closed, this, [this, hid, path]() {
+        deviceClosed(path, hid);
+    } );
+
+    // Connected ahead of open(), the first reply may well beat deviceOpened().
+    if( m_timeToFirstVoltage < 0 )
+    {
+        connect( hid, &HeadsetHID::voltageChanged, this, [this]() {
+            if( m_timeToFirstVoltage >= 0 )
+                return;
+
+            m_timeToFirstVoltage = int(m_clock.elapsed());
+            qDebug() << "HeadsetManager: Name owned after" << m_timeToNameOwned << "ms, first voltage after" << m_timeToFirstVoltage << "ms.";
+        } );
+    }
+
+    // Opening reads the device and the disk, the bus carries on meanwhile.
+    QMetaObject::invokeMethod( hid, [this, hid, path]() {
+        bool opened = hid->open(path);
+        QMetaObject::invokeMethod( this, [this, hid, path, opened]() {
+            deviceOpened(path, hid, opened);
+        }, Qt::QueuedConnection );
+    }, Qt::QueuedConnection );
+}
+
+void HeadsetManager::deviceOpened(const QString &path, HeadsetHID *hid, bool opened)
+{
+    // Removed while it was opening.
+    if( m_opening.value(path) != hid )
+    {
+        retire(hid);
+        return;
+    }
+
+    m_opening.remove(path);
+    if( !opened )
+    {
+        retire(hid);
+        checkIdle();
+        return;
+    }
+
+#ifdef HEADSET_STATS
+    // A receiver unplugged and plugged back in comes back as a new
+    // HeadsetHID, so only here can it be told from a new one.
+    const QString serial = hid->serial();
+    hid->setReconnects(m_opens.value(serial));
+    m_opens[serial]++;
+#endif
+
+    Headset h;
+    h.hid = hid;
+    h.object = new QObject(this);
+    h.objectPath = QString(HEADSET_PATH_PREFIX "%1").arg(path.section('/', -1));
+    HeadsetDBusService *service = new HeadsetDBusService(h.object, hid, h.objectPath, m_bus);
+#ifdef HEADSET_STATS
+    new HeadsetStatsDBusService(h.object, service);
+#else
+    Q_UNUSED(service);
+#endif
+
+    if( !m_bus.registerObject(h.objectPath, h.object) )
+        qDebug() << "HeadsetManager::deviceOpened(): Failed to register" << h.objectPath << m_bus.lastError().message();
+
+    m_headsets.insert(path, h);
+    emit headsetAdded(h.objectPath);
+
+    if( !m_primary )
+    {
+        m_primary = hid;
+        emit primaryChanged(m_primary);
+    }
+    checkIdle();
+}
+
+void HeadsetManager::deviceClosed(const QString &path, HeadsetHID *hid)
+{
+    // Closed while opening, deviceOpened() cleans up after it. Not retried,
+    // so a receiver that fails every write isn't reopened forever.
+    if( m_opening.value(path) == hid )
+    {
+        qDebug() << "HeadsetManager::deviceClosed(): Lost" << path << "while opening it.";
+        m_opening.remove(path);
+        checkIdle();
+        return;
+    }
+
+    // Already removed, or this is its retire() closing it.
+    auto it = m_headsets.find(path);
+    if( it == m_headsets.end() || it.value().hid != hid )
+        return;
+
+    // Dropped now so deviceAdded() takes the node again. If it was unplugged
+    // the monitor has stopped listing it by then.
+    qDebug() << "HeadsetManager::deviceClosed(): Lost" << path << "reopening it in" << REOPEN_DELAY << "ms.";
+    deviceRemoved(path);
+    QTimer::singleShot( REOPEN_DELAY, this, [this, path]() {
+        if( m_monitor->scan().contains(path) )
+            deviceAdded(path);
+    } );
+}
+
+void HeadsetManager::deviceRemoved(const QString &path)
+{
+    // deviceOpened() cleans up after it.
+    if( m_opening.remove(path) )
+    {
+        checkIdle();
+        return;
+    }
+
+    auto it = m_headsets.find(path);
+    if( it == m_headsets.end() )
+        return;
+
+    Headset h = it.value();
+    m_headsets.erase(it);
+
+    m_bus.unregisterObject(h.objectPath);
+    emit headsetRemoved(h.objectPath);
+
+    if( m_primary == h.hid )
+    {
+        m_primary = m_headsets.isEmpty() ? nullptr : m_headsets.first().hid;
+        emit primaryChanged(m_primary);
+    }
+
+    // Gone before the headset is, nothing on the bus reaches it again.
+    delete h.object;
+    retire(h.hid);
+    checkIdle();
+}
+
+HeadsetHID *HeadsetManager::createHeadset(const QString &path)
+{
+    Q_UNUSED(path);
+    return new HeadsetHID;
+}
+
+void HeadsetManager::retire(HeadsetHID *hid)
+{
+    QThread *thread = hid->thread();
+    m_retiring.insert(thread);
+
+    // The thread runs the deleteLater() on its way out.
+    QMetaObject::invokeMethod( hid, [hid, thread]() {
+        if( !hid->path().isEmpty() )
+            hid->close();
+        hid->deleteLater();
+        thread->quit();
+    }, Qt::QueuedConnection );
+}
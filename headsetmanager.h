@@ -0,0 +1,99 @@
+#ifndef HEADSETMANAGER_H
+#define HEADSETMANAGER_H
+
+#include <QElapsedTimer>
+#include <QMap>
+#include <QObject>
+#include <QSet>
+#include <QStringList>
+#include <QThread>
+#include <QTimer>
+#include <QtDBus/QDBusConnection>
+
+#include "headsethid.h"
+#include "hotplugmonitor.h"
+
+#define HEADSET_PATH_PREFIX "/headset/"
+#define REOPEN_DELAY    1000    // ms before reopening a headset that closed itself
+
+// Tracks every attached receiver, each with its own HeadsetHID and D-Bus
+// object at HEADSET_PATH_PREFIX<hidraw node>. Each HeadsetHID lives on an
+// I/O thread of its own, away from the D-Bus connection and from each other,
+// so a receiver that stops answering holds up nobody else.
+class HeadsetManager : public QObject
+{
+    Q_OBJECT
+
+    typedef struct {
+        HeadsetHID  *hid;
+        QObject     *object;
+        QString     objectPath;
+    } Headset;
+
+    HotplugMonitor  *m_monitor;
+    QDBusConnection m_bus;
+    HeadsetHID      *m_primary;
+
+    QMap<QString, Headset> m_headsets; // by device node
+    QMap<QString, HeadsetHID*> m_opening;   // open() queued on the I/O thread
+    QSet<QThread*>  m_retiring;     // closing their headset, then finishing
+#ifdef HEADSET_STATS
+    QMap<QString, quint64> m_opens;    // by serial, for the reconnect count
+#endif
+
+    // Startup, in ms since the manager was created.
+    QElapsedTimer   m_clock;
+    int             m_timeToNameOwned;
+    int             m_timeToFirstVoltage;
+
+    int             m_idleExit;
+    QTimer          m_idleTimer;
+
+public:
+    explicit HeadsetManager(HotplugMonitor *monitor, const QDBusConnection &bus, QObject *parent = nullptr);
+    ~HeadsetManager();
+
+    // Looks for headsets without waiting for any to open.
+    void start();
+
+    // Emit idle() after ms without a headset, 0 never does.
+    void setIdleExit(int ms);
+
+    // Called once the service name is ours.
+    void nameOwned();
+    int timeToNameOwned() const;       // -1 until then
+    int timeToFirstVoltage() const;    // -1 until a headset reported one
+
+    QStringList objectPaths() const;
+    HeadsetHID *headset(const QString &objectPath) const;
+    HeadsetHID *primary() const;
+
+protected:
+    // A new, unopened headset for a device node. Tests hand out ones on a
+    // simulated transport.
+    virtual HeadsetHID *createHeadset(const QString &path);
+
+private:
+    // Closes and deletes hid on its I/O thread, then ends the thread.
+    // Nothing here waits for it.
+    void retire(HeadsetHID *hid);
+
+private slots:
+    void deviceAdded(const QString &path);
+    void deviceRemoved(const QString &path);
+    void deviceOpened(const QString &path, HeadsetHID *hid, bool opened);
+    void deviceClosed(const QString &path, HeadsetHID *hid);
+    void checkIdle();
+
+signals:
+    void headsetAdded(const QString &objectPath);
+    void headsetRemoved(const QString &objectPath);
+
+    // The headset served on "/", for clients that only know about one.
+    void primaryChanged(HeadsetHID *hid);
+
+    // No headset for the idle exit time.
+    void idle();
+};
+
+#endif // HEADSETMANAGER_H
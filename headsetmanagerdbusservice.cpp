@@ -0,0 +1,44 @@
+#include "headsetmanagerdbusservice.h"
+#include "tracering.h"
+
+HeadsetManagerDBusService::HeadsetManagerDBusService(QObject *obj, HeadsetManager *m)
+    : QDBusAbstractAdaptor{obj},
+      m_manager(m)
+{
+    connect( m_manager, &HeadsetManager::headsetAdded, this, [this](const QString &path) {
+        emit headsetAdded(QDBusObjectPath(path));
+    } );
+    connect( m_manager, &HeadsetManager::headsetRemoved, this, [this](const QString &path) {
+        emit headsetRemoved(QDBusObjectPath(path));
+    } );
+}
+
+int HeadsetManagerDBusService::timeToNameOwned()
+{
+    return m_manager ? m_manager->timeToNameOwned() : -1;
+}
+
+int HeadsetManagerDBusService::timeToFirstVoltage()
+{
+    return m_manager ? m_manager->timeToFirstVoltage() : -1;
+}
+
+QList<QDBusObjectPath> HeadsetManagerDBusService::headsets()
+{
+    QList<QDBusObjectPath> result;
+    if( !m_manager )
+        return result;
+
+    const QStringList paths = m_manager->objectPaths();
+    for( const QString &path : paths )
+        result.push_back(QDBusObjectPath(path));
+    return result;
+}
+
+QString HeadsetManagerDBusService::dumpTrace()
+{
+    const QString path = TraceRing::defaultPath();
+    if( !TraceRing::instance().dump(path) )
+        return QString();
+    return path;
+}
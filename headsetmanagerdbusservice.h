@@ -0,0 +1,38 @@
+#ifndef HEADSETMANAGERDBUSSERVICE_H
+#define HEADSETMANAGERDBUSSERVICE_H
+
+#include <QObject>
+#include <QtDBus/QDBusAbstractAdaptor>
+#include <QtDBus/QDBusObjectPath>
+
+#include "headsetmanager.h"
+
+class HeadsetManagerDBusService : public QDBusAbstractAdaptor
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.logitech.Headset.Power.Manager")
+
+    HeadsetManager *m_manager;
+
+    Q_PROPERTY(int timeToNameOwned READ timeToNameOwned)
+    Q_PROPERTY(int timeToFirstVoltage READ timeToFirstVoltage)
+
+public:
+    explicit HeadsetManagerDBusService(QObject *obj, HeadsetManager *m);
+
+    // ms from startup, -1 until it happened.
+    int timeToNameOwned();
+    int timeToFirstVoltage();
+
+public slots:
+    QList<QDBusObjectPath> headsets();
+
+    // Writes the trace ring to a file and returns its path, empty on failure.
+    QString dumpTrace();
+
+signals:
+    void headsetAdded(const QDBusObjectPath &path);
+    void headsetRemoved(const QDBusObjectPath &path);
+};
+
+#endif // HEADSETMANAGERDBUSSERVICE_H
@@ -0,0 +1,155 @@
+#include "headsetstats.h"
+
+#include <QTextStream>
+
+HeadsetStats::HeadsetStats()
+    : m_rate{0},
+      m_rateSince{-1},
+      m_rateBase{0}
+{
+    for( std::atomic<quint64> &c : m_counters )
+        c.store(0, std::memory_order_relaxed);
+    for( auto &type : m_buckets )
+    {
+        for( std::atomic<quint64> &b : type )
+            b.store(0, std::memory_order_relaxed);
+    }
+    for( std::atomic<quint64> &s : m_sums )
+        s.store(0, std::memory_order_relaxed);
+}
+
+void HeadsetStats::bump(std::atomic<quint64> &value, quint64 n)
+{
+    // Single writer, no need for a locked read-modify-write.
+    value.store(value.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void HeadsetStats::add(Counter c, quint64 n)
+{
+    bump(m_counters[c], n);
+}
+
+void HeadsetStats::latency(int requestType, qint64 usecs)
+{
+    if( requestType < 0 || requestType >= STATS_REQUEST_TYPES )
+        return;
+
+    int b = 0;
+    while( b < STATS_BUCKETS - 1 && usecs > bucketBound(b) )
+        b++;
+
+    bump(m_buckets[requestType][b], 1);
+    bump(m_sums[requestType], quint64(qMax<qint64>(0, usecs)));
+}
+
+void HeadsetStats::tick(qint64 now)
+{
+    quint64 reports = counter(Reports);
+    if( m_rateSince < 0 )
+    {
+        m_rateSince = now;
+        m_rateBase = reports;
+        return;
+    }
+
+    qint64 elapsed = now - m_rateSince;
+    if( elapsed < 1000 )
+        return;
+
+    m_rate.store(double(reports - m_rateBase) * 1000 / elapsed, std::memory_order_relaxed);
+    m_rateSince = now;
+    m_rateBase = reports;
+}
+
+quint64 HeadsetStats::counter(Counter c) const
+{
+    return m_counters[c].load(std::memory_order_relaxed);
+}
+
+quint64 HeadsetStats::bucket(int requestType, int bucket) const
+{
+    if( requestType < 0 || requestType >= STATS_REQUEST_TYPES || bucket < 0 || bucket >= STATS_BUCKETS )
+        return 0;
+    return m_buckets[requestType][bucket].load(std::memory_order_relaxed);
+}
+
+quint64 HeadsetStats::latencySum(int requestType) const
+{
+    if( requestType < 0 || requestType >= STATS_REQUEST_TYPES )
+        return 0;
+    return m_sums[requestType].load(std::memory_order_relaxed);
+}
+
+double HeadsetStats::reportsPerSecond() const
+{
+    return m_rate.load(std::memory_order_relaxed);
+}
+
+qint64 HeadsetStats::bucketBound(int bucket)
+{
+    // 250µs doubling up to 256ms, past REQUEST_TIMEOUT and its retries.
+    if( bucket >= STATS_BUCKETS - 1 )
+        return -1;
+    return qint64(250) << bucket;
+}
+
+const char *HeadsetStats::counterName(Counter c)
+{
+    switch( c )
+    {
+    case Requests:
+        return "requests";
+    case Replies:
+        return "replies";
+    case Timeouts:
+        return "timeouts";
+    case Retries:
+        return "retries";
+    case WriteFailures:
+        return "write_failures";
+    case Connects:
+        return "connects";
+    case Reconnects:
+        return "reconnects";
+    case Reports:
+        return "reports";
+    default:
+        return "unknown";
+    }
+}
+
+QString HeadsetStats::exposition(const QString &labels, const char *(*requestName)(int)) const
+{
+    QString out;
+    QTextStream ts(&out);
+
+    for( int c=0; c < CounterCount; c++ )
+        ts << "g733_" << counterName(Counter(c)) << "_total{" << labels << "} " << counter(Counter(c)) << "\n";
+    ts << "g733_reports_per_second{" << labels << "} " << reportsPerSecond() << "\n";
+
+    for( int t=0; t < STATS_REQUEST_TYPES; t++ )
+    {
+        const char *name = requestName(t);
+        if( !name )
+            break;
+
+        // Cumulative, like Prometheus histograms.
+        quint64 count = 0;
+        for( int b=0; b < STATS_BUCKETS; b++ )
+        {
+            count += bucket(t, b);
+            qint64 bound = bucketBound(b);
+            ts << "g733_request_latency_us_bucket{" << labels << ",type=\"" << name << "\",le=\"";
+            if( bound < 0 )
+                ts << "+Inf";
+            else
+                ts << bound;
+            ts << "\"} " << count << "\n";
+        }
+        ts << "g733_request_latency_us_sum{" << labels << ",type=\"" << name << "\"} " << latencySum(t) << "\n";
+        ts << "g733_request_latency_us_count{" << labels << ",type=\"" << name << "\"} " << count << "\n";
+    }
+
+    ts.flush();
+    return out;
+}
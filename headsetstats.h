@@ -0,0 +1,71 @@
+#ifndef HEADSETSTATS_H
+#define HEADSETSTATS_H
+
+#include <QString>
+
+#include <atomic>
+
+// Instrumentation is compiled in with CONFIG += headset_stats (the default),
+// without it STATS() statements vanish and HeadsetStats isn't used.
+#ifdef HEADSET_STATS
+# define STATS(x) x
+#else
+# define STATS(x)
+#endif
+
+#define STATS_REQUEST_TYPES 16  // at least HeadsetHID's RequestTypeCount
+#define STATS_BUCKETS       12  // latency buckets, see bucketBound()
+
+// Counters and request latency histograms for one headset. Written by the
+// I/O thread only (Reconnects by HeadsetManager, before the headset is
+// published), read from anywhere: every value is a relaxed atomic, so
+// readers may see one counter a step ahead of another but never a torn one.
+class HeadsetStats
+{
+public:
+    typedef enum {
+        Requests,       // written, retries not included
+        Replies,
+        Timeouts,       // given up on after the retries
+        Retries,
+        WriteFailures,
+        Connects,       // offline to online, the first one and wakes included
+        Reconnects,     // earlier opens of the same serial
+        Reports,        // input reports read
+        CounterCount
+    } Counter;
+
+    HeadsetStats();
+
+    void add(Counter c, quint64 n = 1);
+    void latency(int requestType, qint64 usecs);
+
+    // Recomputes reportsPerSecond() about once a second, now in ms.
+    void tick(qint64 now);
+
+    quint64 counter(Counter c) const;
+    quint64 bucket(int requestType, int bucket) const;
+    quint64 latencySum(int requestType) const;     // µs
+    double reportsPerSecond() const;
+
+    // Upper bound of a bucket in µs, -1 for the last one, which is unbounded.
+    static qint64 bucketBound(int bucket);
+    static const char *counterName(Counter c);
+
+    // Text exposition, one "name{labels} value" line per sample. labels is
+    // inserted as is, e.g. headset="hidraw3".
+    QString exposition(const QString &labels, const char *(*requestName)(int)) const;
+
+protected:
+    std::atomic<quint64> m_counters[CounterCount];
+    std::atomic<quint64> m_buckets[STATS_REQUEST_TYPES][STATS_BUCKETS];
+    std::atomic<quint64> m_sums[STATS_REQUEST_TYPES];
+    std::atomic<double>  m_rate;
+
+    qint64  m_rateSince;
+    quint64 m_rateBase;
+
+    static void bump(std::atomic<quint64> &value, quint64 n);
+};
+
+#endif // HEADSETSTATS_H
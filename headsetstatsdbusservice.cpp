@@ -0,0 +1,122 @@
+#include "headsetstatsdbusservice.h"
+
+#include <QTextStream>
+
+HeadsetStatsDBusService::HeadsetStatsDBusService(QObject *obj, HeadsetDBusService *service)
+    : QDBusAbstractAdaptor{obj},
+      m_service(service)
+{
+}
+
+QString HeadsetStatsDBusService::exposition(HeadsetHID *hid, const QString &labels)
+{
+    if( !hid )
+        return QString();
+
+    QString out = hid->stats().exposition(labels, &HeadsetHID::requestName);
+    QTextStream ts(&out);
+
+    HeadsetState st = hid->state();
+    ts << "g733_unknown_reports_total{" << labels << "} " << st.unknownReports << "\n";
+    ts << "g733_read_wakeups_total{" << labels << "} " << st.wakeups << "\n";
+    ts << "g733_queue_overruns_total{" << labels << "} " << st.overruns << "\n";
+    ts << "g733_requests_superseded_total{" << labels << "} " << st.requestsSuperseded << "\n";
+    ts << "g733_requests_dropped_total{" << labels << "} " << st.requestsDropped << "\n";
+    ts << "g733_request_queue_depth{" << labels << "} " << st.queueDepth << "\n";
+    ts << "g733_command_latency_max_ms{" << labels << "} " << st.commandLatencyMax << "\n";
+    ts << "g733_time_to_ready_ms{" << labels << "} " << st.timeToReady << "\n";
+    ts << "g733_time_to_restore_ms{" << labels << "} " << st.timeToRestore << "\n";
+    ts << "g733_calibration_cycles{" << labels << "} " << st.calibrationCycles << "\n";
+    ts << "g733_lighting_writes_total{" << labels << "} " << st.lightingWrites << "\n";
+    ts << "g733_lighting_frames_skipped_total{" << labels << "} " << st.lightingFramesSkipped << "\n";
+    ts << "g733_button_actions_total{" << labels << "} " << st.buttonActions << "\n";
+    ts << "g733_button_latency_max_us{" << labels << "} " << st.buttonLatencyMax << "\n";
+    ts << "g733_online{" << labels << "} " << (st.online ? 1 : 0) << "\n";
+    ts.flush();
+    return out;
+}
+
+quint64 HeadsetStatsDBusService::counter(HeadsetStats::Counter c)
+{
+    HeadsetHID *hid = m_service->headset();
+    return hid ? hid->stats().counter(c) : 0;
+}
+
+qulonglong HeadsetStatsDBusService::requests()
+{
+    return counter(HeadsetStats::Requests);
+}
+
+qulonglong HeadsetStatsDBusService::replies()
+{
+    return counter(HeadsetStats::Replies);
+}
+
+qulonglong HeadsetStatsDBusService::timeouts()
+{
+    return counter(HeadsetStats::Timeouts);
+}
+
+qulonglong HeadsetStatsDBusService::retries()
+{
+    return counter(HeadsetStats::Retries);
+}
+
+qulonglong HeadsetStatsDBusService::writeFailures()
+{
+    return counter(HeadsetStats::WriteFailures);
+}
+
+qulonglong HeadsetStatsDBusService::connects()
+{
+    return counter(HeadsetStats::Connects);
+}
+
+qulonglong HeadsetStatsDBusService::reconnects()
+{
+    return counter(HeadsetStats::Reconnects);
+}
+
+qulonglong HeadsetStatsDBusService::reports()
+{
+    return counter(HeadsetStats::Reports);
+}
+
+double HeadsetStatsDBusService::reportsPerSecond()
+{
+    HeadsetHID *hid = m_service->headset();
+    return hid ? hid->stats().reportsPerSecond() : 0;
+}
+
+QList<qulonglong> HeadsetStatsDBusService::latencyBounds()
+{
+    QList<qulonglong> result;
+    for( int b=0; b < STATS_BUCKETS - 1; b++ )
+        result.push_back(HeadsetStats::bucketBound(b));
+    return result;
+}
+
+QList<qulonglong> HeadsetStatsDBusService::latencyHistogram(const QString &type)
+{
+    QList<qulonglong> result;
+    HeadsetHID *hid = m_service->headset();
+    if( !hid )
+        return result;
+
+    for( int t=0; HeadsetHID::requestName(t); t++ )
+    {
+        if( type != HeadsetHID::requestName(t) )
+            continue;
+
+        for( int b=0; b < STATS_BUCKETS; b++ )
+            result.push_back(hid->stats().bucket(t, b));
+        break;
+    }
+    return result;
+}
+
+QString HeadsetStatsDBusService::exposition()
+{
+    HeadsetHID *hid = m_service->headset();
+    return exposition(hid, hid ? QString("serial=\"%1\"").arg(hid->serial()) : QString());
+}
@@ -0,0 +1,62 @@
+#ifndef HEADSETSTATSDBUSSERVICE_H
+#define HEADSETSTATSDBUSSERVICE_H
+
+#include <QList>
+#include <QObject>
+#include <QtDBus/QDBusAbstractAdaptor>
+
+#include "headsetdbusservice.h"
+
+#define STATS_INTERFACE "org.logitech.Headset.Stats"
+
+// Counters and request latencies of whichever headset the Power.Service
+// adaptor on the same object is serving.
+class HeadsetStatsDBusService : public QDBusAbstractAdaptor
+{
+    Q_OBJECT
+    Q_CLASSINFO("D-Bus Interface", "org.logitech.Headset.Stats")
+
+    HeadsetDBusService *m_service;
+
+    Q_PROPERTY(qulonglong requests READ requests)
+    Q_PROPERTY(qulonglong replies READ replies)
+    Q_PROPERTY(qulonglong timeouts READ timeouts)
+    Q_PROPERTY(qulonglong retries READ retries)
+    Q_PROPERTY(qulonglong writeFailures READ writeFailures)
+    Q_PROPERTY(qulonglong connects READ connects)
+    Q_PROPERTY(qulonglong reconnects READ reconnects)
+    Q_PROPERTY(qulonglong reports READ reports)
+    Q_PROPERTY(double reportsPerSecond READ reportsPerSecond)
+
+public:
+    explicit HeadsetStatsDBusService(QObject *obj, HeadsetDBusService *service);
+
+    // The text exposition for one headset, shared with StatsExporter.
+    static QString exposition(HeadsetHID *hid, const QString &labels);
+
+public slots:
+    qulonglong requests();
+    qulonglong replies();
+    qulonglong timeouts();
+    qulonglong retries();
+    qulonglong writeFailures();
+    qulonglong connects();
+    qulonglong reconnects();
+    qulonglong reports();
+    double reportsPerSecond();
+
+    // Upper bounds of the latency buckets in µs, the last one is unbounded
+    // and left out.
+    QList<qulonglong> latencyBounds();
+
+    // Requests per bucket for one request type (e.g. "Voltage"), not
+    // cumulative.
+    QList<qulonglong> latencyHistogram(const QString &type);
+
+    QString exposition();
+
+protected:
+    quint64 counter(HeadsetStats::Counter c);
+};
+
+#endif // HEADSETSTATSDBUSSERVICE_H
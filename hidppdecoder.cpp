@@ -0,0 +1,237 @@
+#include "hidppdecoder.h"
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#define HIDPP_LONG_REPORT   0x11
+#define HIDPP_RECEIVER      0xff
+#define HIDPP_ERROR_INDEX   0xff
+#define NO_FEATURE          0xff
+#define HIDPP_FUNCTIONS     16
+#define HIDPP_ANY_FUNCTION  0xff
+
+HidppFeatureMap::HidppFeatureMap()
+{
+    memset(m_index, 0, sizeof(m_index));
+    memset(m_feature, NO_FEATURE, sizeof(m_feature));
+    m_feature[0] = FeatureRoot;
+
+    set(FeatureBattery, 0x08);
+    set(FeatureLighting, 0x04);
+    set(FeatureSidetone, 0x07);
+    set(FeatureButtons, 0x05);
+}
+
+void HidppFeatureMap::set(HidppFeature feature, quint8 index)
+{
+    // Index 0 is the root feature, here it means unsupported.
+    if( feature == FeatureRoot || feature >= FeatureCount )
+        return;
+
+    if( m_index[feature] && m_feature[m_index[feature]] == feature )
+        m_feature[m_index[feature]] = NO_FEATURE;
+
+    m_index[feature] = index;
+    if( index && index != HIDPP_ERROR_INDEX )
+        m_feature[index] = feature;
+}
+
+quint8 HidppFeatureMap::index(HidppFeature feature) const
+{
+    return feature < FeatureCount ? m_index[feature] : 0;
+}
+
+int HidppFeatureMap::feature(quint8 index) const
+{
+    return m_feature[index] == NO_FEATURE ? -1 : m_feature[index];
+}
+
+quint16 HidppFeatureMap::featureId(HidppFeature feature)
+{
+    switch( feature )
+    {
+    case FeatureRoot:
+        return 0x0000;
+    case FeatureFirmware:
+        return 0x0003;
+    case FeatureBattery:
+        return 0x1f20;
+    case FeatureLighting:
+        return 0x8070;
+    case FeatureSidetone:
+        return 0x8300;
+    default:
+        return 0xffff;
+    }
+}
+
+typedef bool (*HidppHandler)(const quint8 *data, int length, HidppEvent &event);
+
+// 11 ff 00 0x <index> <type> <version>, reply to getFeature(id)
+static bool decodeFeatureIndex(const quint8 *data, int length, HidppEvent &event)
+{
+    if( length < 7 || event.swid == 0 )
+        return false;
+
+    event.type = HidppFeatureIndex;
+    event.index = data[4];
+    return true;
+}
+
+// 11 ff <fw> 1x <type> <prefix x3> <major> <minor> <build hi> <build lo>,
+// reply to getFwInfo(0). Major and minor are BCD.
+static bool decodeFirmware(const quint8 *data, int length, HidppEvent &event)
+{
+    if( length < 12 || event.swid == 0 )
+        return false;
+
+    event.type = HidppFirmware;
+    snprintf(event.firmware, sizeof(event.firmware), "%c%c%c %02x.%02x.%04x",
+             data[5], data[6], data[7], data[8], data[9], (data[10] << 8) | data[11]);
+    return true;
+}
+
+// 11 ff 05 00 <mask>
+static bool decodeButtons(const quint8 *data, int length, HidppEvent &event)
+{
+    if( length < 5 || event.swid != 0 )
+        return false;
+
+    event.type = HidppButtons;
+    event.buttons = data[4];
+    return true;
+}
+
+static bool decodeBattery(const quint8 *data, int length, HidppEvent &event)
+{
+    if( length < 7 )
+        return false;
+
+    // 11 ff 08 0a <mV hi> <mV lo> <state>, 3 is charging
+    if( event.swid != 0 )
+    {
+        event.type = HidppBattery;
+        event.voltage = (data[4] << 8) | data[5];
+        event.charging = data[6] == 0x03;
+        return true;
+    }
+
+    // 11 ff 08 00 00 00 00
+    if( data[4] == 0 && data[5] == 0 && data[6] == 0 )
+    {
+        event.type = HidppSleep;
+        return true;
+    }
+
+    // 11 ff 08 00 0f 83 01 <- 0=sleep, 1=woke?
+    //              `--'- important?
+    if( data[6] == 0x01 )
+    {
+        event.type = HidppWake;
+        return true;
+    }
+
+    return false;
+}
+
+// 11 ff 04 3c <zone> <mode> <parameters>, lighting change confirmed. The
+// parameters echo the request's, a static color starts with a non-zero byte.
+static bool decodeLighting(const quint8 *data, int length, HidppEvent &event)
+{
+    if( length < 6 )
+        return false;
+
+    event.type = HidppLighting;
+    event.zone = data[4];
+    event.mode = data[5];
+    return true;
+}
+
+// 11 ff 07 1x <level>, reply to setSidetoneLevel(level)
+static bool decodeSidetone(const quint8 *data, int length, HidppEvent &event)
+{
+    if( length < 5 || event.swid == 0 )
+        return false;
+
+    event.type = HidppSidetone;
+    event.level = data[4];
+    return true;
+}
+
+// 11 ff ff <feature> <function|swid> <error>
+static bool decodeError(const quint8 *data, int length, HidppEvent &event)
+{
+    if( length < 6 )
+        return false;
+
+    event.type = HidppError;
+    event.feature = data[3];
+    event.function = data[4] >> 4;
+    event.swid = data[4] & 0x0f;
+    event.error = data[5];
+    return true;
+}
+
+typedef struct {
+    int             feature;
+    quint8          function;
+    HidppHandler    handler;
+} HidppRoute;
+
+// Error replies come on index 0xff rather than a feature's.
+#define ROUTE_ERROR FeatureCount
+
+static constexpr HidppRoute routes[] = {
+    { FeatureRoot, 0, decodeFeatureIndex },
+    { FeatureFirmware, 1, decodeFirmware },
+    { FeatureLighting, 3, decodeLighting },
+    { FeatureSidetone, 1, decodeSidetone },
+    { FeatureButtons, 0, decodeButtons },
+    { FeatureBattery, 0, decodeBattery },
+    { ROUTE_ERROR, HIDPP_ANY_FUNCTION, decodeError },
+};
+
+// Long reports only, indexed by feature << 4 | function.
+typedef struct {
+    HidppHandler handlers[(FeatureCount + 1) * HIDPP_FUNCTIONS];
+} HidppTable;
+
+static constexpr HidppTable buildTable()
+{
+    HidppTable t{};
+    for( const HidppRoute &r : routes )
+    {
+        for( int fn=0; fn < HIDPP_FUNCTIONS; fn++ )
+        {
+            if( r.function == HIDPP_ANY_FUNCTION || r.function == fn )
+                t.handlers[r.feature * HIDPP_FUNCTIONS + fn] = r.handler;
+        }
+    }
+    return t;
+}
+
+static constexpr HidppTable table = buildTable();
+
+bool HidppDecoder::decode(const quint8 *data, int length, const HidppFeatureMap &features, HidppEvent &event)
+{
+    event = HidppEvent{};
+    if( length < 4 || data[0] != HIDPP_LONG_REPORT || data[1] != HIDPP_RECEIVER )
+        return false;
+
+    event.feature = data[2];
+    event.function = data[3] >> 4;
+    event.swid = data[3] & 0x0f;
+
+    int feature = event.feature == HIDPP_ERROR_INDEX ? ROUTE_ERROR : features.feature(event.feature);
+    if( feature < 0 )
+        return false;
+
+    HidppHandler handler = table.handlers[feature * HIDPP_FUNCTIONS + event.function];
+    if( !handler || !handler(data, length, event) )
+    {
+        event.type = HidppUnknown;
+        return false;
+    }
+    return true;
+}
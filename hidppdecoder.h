@@ -0,0 +1,74 @@
+#ifndef HIDPPDECODER_H
+#define HIDPPDECODER_H
+
+#include <QtGlobal>
+
+typedef enum {
+    HidppUnknown,
+    HidppButtons,       // buttons: bitmask of pressed buttons
+    HidppBattery,       // voltage, charging: reply to a voltage request
+    HidppSleep,         // headset turned off or went to sleep
+    HidppWake,          // headset came back
+    HidppError,         // feature, function, error: a request failed
+    HidppLighting,      // zone, mode: a lighting change was applied
+    HidppFeatureIndex,  // index: root feature lookup, 0 if unsupported
+    HidppFirmware,      // firmware: version of the main firmware
+    HidppSidetone       // level: reply to a sidetone change
+} HidppEventType;
+
+// The HID++ 2.0 features the daemon uses.
+typedef enum {
+    FeatureRoot,        // 0x0000, always at index 0
+    FeatureFirmware,    // 0x0003
+    FeatureBattery,     // 0x1f20
+    FeatureLighting,    // 0x8070
+    FeatureSidetone,    // 0x8300
+    FeatureButtons,     // ID unknown, only ever at its legacy index
+    FeatureCount
+} HidppFeature;
+
+// Where the features sit on one particular device. Starts out with the
+// indices found on G733 firmware so far, discovery replaces them.
+class HidppFeatureMap
+{
+    quint8  m_index[FeatureCount];
+    quint8  m_feature[256];     // by index
+
+public:
+    HidppFeatureMap();
+
+    void set(HidppFeature feature, quint8 index);
+    quint8 index(HidppFeature feature) const;
+    int feature(quint8 index) const;   // -1 if none of ours
+
+    static quint16 featureId(HidppFeature feature);
+};
+
+// What a report means, without any of the state it applies to.
+typedef struct {
+    HidppEventType type;
+    quint8  feature;    // feature index the report is about
+    quint8  function;
+    quint8  swid;       // 0 for notifications
+    quint8  buttons;
+    quint16 voltage;    // mV
+    bool    charging;
+    quint8  zone;       // 1 for the strips, 0 for the logo
+    quint8  mode;       // 0 off, 2 breathing
+    quint8  error;
+    quint8  index;
+    quint8  level;      // sidetone, percent
+    char    firmware[16];   // e.g. "U1 12.03.0045", NUL terminated
+} HidppEvent;
+
+// Decodes HID++ reports through a table of handlers indexed by report id,
+// feature and function, built at compile time. Thread-safe and allocation
+// free.
+class HidppDecoder
+{
+public:
+    // False if no handler claims the report.
+    static bool decode(const quint8 *data, int length, const HidppFeatureMap &features, HidppEvent &event);
+};
+
+#endif // HIDPPDECODER_H
@@ -0,0 +1,455 @@
+#include "hidtransport.h"
+
+#include <QDebug>
+#include <QSettings>
+#include <QThread>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+
+// Reports handed out per wakeup when replaying at full speed, well short of
+// what the kernel queues for a hidraw reader so it doesn't look like overruns.
+#define REPLAY_BURST 16
+
+// Feature indices SimulatedTransport hands out, the ones HidppFeatureMap
+// starts out with and a firmware index of its own.
+#define SIM_FIRMWARE    0x03
+#define SIM_LIGHTING    0x04
+#define SIM_SIDETONE    0x07
+#define SIM_BATTERY     0x08
+
+HidTransport::HidTransport(QObject *parent)
+    : QObject{parent}
+{
+}
+
+HidTransport *HidTransport::create(QObject *parent)
+{
+    QString record = QSettings().value("Transport/Record").toString();
+    if( record.isEmpty() )
+        return new HidapiTransport(parent);
+
+    return new RecordingTransport(new HidapiTransport, record, parent);
+}
+
+HidapiTransport::HidapiTransport(QObject *parent)
+    : HidTransport{parent},
+      m_handle{nullptr},
+      m_fd{-1},
+      m_notifier{nullptr}
+{
+}
+
+HidapiTransport::~HidapiTransport()
+{
+    close();
+}
+
+bool HidapiTransport::open(const QString &path)
+{
+    close();
+
+    m_handle = hid_open_path(path.toStdString().c_str());
+    if( !m_handle )
+    {
+        qDebug() << "Failed to open the device" << path;
+        qDebug() << QString::fromWCharArray(hid_error(NULL));
+        return false;
+    }
+
+    // Every reader of a hidraw node gets its own report queue.
+    m_fd = ::open(path.toLocal8Bit().constData(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if( m_fd < 0 )
+    {
+        qDebug() << "Failed to open the device for reading" << path << strerror(errno);
+        hid_close(m_handle);
+        m_handle = nullptr;
+        return false;
+    }
+
+    m_notifier = new QSocketNotifier(m_fd, QSocketNotifier::Read, this);
+    connect( m_notifier, &QSocketNotifier::activated, this, &HidTransport::readyRead );
+    return true;
+}
+
+void HidapiTransport::close()
+{
+    if( m_notifier )
+    {
+        m_notifier->setEnabled(false);
+        m_notifier->deleteLater();
+        m_notifier = nullptr;
+    }
+    if( m_fd >= 0 )
+    {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+    if( m_handle )
+    {
+        hid_close(m_handle);
+        m_handle = nullptr;
+    }
+}
+
+QString HidapiTransport::serial()
+{
+    wchar_t serial[64];
+    if( m_handle && hid_get_serial_number_string(m_handle, serial, sizeof(serial) / sizeof(serial[0])) == 0 )
+        return QString::fromWCharArray(serial);
+    return QString();
+}
+
+int HidapiTransport::write(const quint8 *data, int length)
+{
+    if( !m_handle )
+        return -1;
+
+    int r = hid_write(m_handle, data, length);
+    if( r < 0 )
+    {
+        qDebug() << "HidapiTransport::write(): Failed to write to headset.";
+        qDebug() << QString::fromWCharArray(hid_error(m_handle));
+    }
+    return r;
+}
+
+int HidapiTransport::read(quint8 *data, int length)
+{
+    if( m_fd < 0 )
+        return -1;
+
+    for( ;; )
+    {
+        int r = ::read(m_fd, data, length);
+        if( r >= 0 )
+            return r;
+        if( errno == EINTR )
+            continue;
+        if( errno == EAGAIN )
+            return 0;
+
+        // ENODEV/EIO: the receiver went away.
+        qDebug() << "HidapiTransport::read(): Read error from headset:" << strerror(errno);
+        return -1;
+    }
+}
+
+RecordingTransport::RecordingTransport(HidTransport *inner, const QString &traceFile, QObject *parent)
+    : HidTransport{parent},
+      m_inner{inner},
+      m_trace{traceFile}
+{
+    m_inner->setParent(this);
+    connect( m_inner, &HidTransport::readyRead, this, &HidTransport::readyRead );
+}
+
+RecordingTransport::~RecordingTransport()
+{
+    close();
+}
+
+bool RecordingTransport::open(const QString &path)
+{
+    if( !m_inner->open(path) )
+        return false;
+
+    if( !m_trace.open(QIODevice::WriteOnly | QIODevice::Truncate) )
+        qDebug() << "RecordingTransport::open(): Failed to open the trace file" << m_trace.fileName() << m_trace.errorString();
+    else
+        m_trace.write(TRACE_MAGIC, strlen(TRACE_MAGIC));
+
+    m_clock.start();
+    return true;
+}
+
+void RecordingTransport::close()
+{
+    m_inner->close();
+    if( m_trace.isOpen() )
+        m_trace.close();
+}
+
+QString RecordingTransport::serial()
+{
+    return m_inner->serial();
+}
+
+int RecordingTransport::write(const quint8 *data, int length)
+{
+    int r = m_inner->write(data, length);
+    if( r > 0 )
+        record(TraceOutput, data, r);
+    return r;
+}
+
+int RecordingTransport::read(quint8 *data, int length)
+{
+    int r = m_inner->read(data, length);
+    if( r > 0 )
+        record(TraceInput, data, r);
+    return r;
+}
+
+void RecordingTransport::record(TraceDirection direction, const quint8 *data, int length)
+{
+    if( !m_trace.isOpen() )
+        return;
+
+    TraceRecord rec;
+    rec.time = m_clock.nsecsElapsed() / 1000;
+    rec.direction = direction;
+    rec.length = quint8(qMin(length, TRACE_MAX_REPORT));
+    m_trace.write(reinterpret_cast<const char *>(&rec), sizeof(rec));
+    m_trace.write(reinterpret_cast<const char *>(data), rec.length);
+}
+
+ReplayTransport::ReplayTransport(bool realTime, QObject *parent)
+    : HidTransport{parent},
+      m_realTime{realTime},
+      m_timer{this},
+      m_hasNext{false},
+      m_burst{0}
+{
+    connect( &m_timer, &QTimer::timeout, this, [this]() {
+        m_burst = 0;
+        emit readyRead();
+    } );
+    m_timer.setSingleShot(true);
+}
+
+bool ReplayTransport::open(const QString &path)
+{
+    close();
+
+    m_trace.setFileName(path);
+    if( !m_trace.open(QIODevice::ReadOnly) )
+    {
+        qDebug() << "ReplayTransport::open(): Failed to open the trace" << path << m_trace.errorString();
+        return false;
+    }
+
+    char magic[sizeof(TRACE_MAGIC) - 1];
+    if( m_trace.read(magic, sizeof(magic)) != qint64(sizeof(magic)) || memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0 )
+    {
+        qDebug() << "ReplayTransport::open(): Not a trace file" << path;
+        m_trace.close();
+        return false;
+    }
+
+    m_clock.start();
+    readNext();
+    schedule();
+    return true;
+}
+
+void ReplayTransport::close()
+{
+    m_timer.stop();
+    m_hasNext = false;
+    if( m_trace.isOpen() )
+        m_trace.close();
+}
+
+QString ReplayTransport::serial()
+{
+    return "replay";
+}
+
+int ReplayTransport::write(const quint8 *data, int length)
+{
+    Q_UNUSED(data);
+    return m_trace.isOpen() ? length : -1;
+}
+
+int ReplayTransport::read(quint8 *data, int length)
+{
+    if( !m_trace.isOpen() )
+        return -1;
+
+    if( !m_hasNext )
+        return 0;
+
+    // Not due yet, or the burst is used up, wait for the next wakeup.
+    if( (m_realTime && m_next.time > m_clock.nsecsElapsed() / 1000) || (!m_realTime && m_burst >= REPLAY_BURST) )
+    {
+        schedule();
+        return 0;
+    }
+
+    int r = qMin<int>(length, m_next.length);
+    memcpy(data, m_nextData, r);
+    m_burst++;
+    emit delivered(QByteArray(reinterpret_cast<const char *>(data), r));
+
+    if( !readNext() )
+        emit finished();
+    return r;
+}
+
+bool ReplayTransport::atEnd() const
+{
+    return !m_hasNext;
+}
+
+bool ReplayTransport::readNext()
+{
+    // Only input is replayed, what the daemon writes is up to the daemon.
+    m_hasNext = false;
+    while( m_trace.read(reinterpret_cast<char *>(&m_next), sizeof(m_next)) == qint64(sizeof(m_next)) )
+    {
+        if( m_next.length > TRACE_MAX_REPORT || m_trace.read(reinterpret_cast<char *>(m_nextData), m_next.length) != m_next.length )
+            break;
+
+        if( m_next.direction == TraceInput )
+        {
+            m_hasNext = true;
+            break;
+        }
+    }
+    return m_hasNext;
+}
+
+void ReplayTransport::schedule()
+{
+    if( !m_hasNext || m_timer.isActive() )
+        return;
+
+    qint64 wait = 0;
+    if( m_realTime )
+        wait = qMax<qint64>(0, m_next.time / 1000 - m_clock.elapsed());
+    m_timer.start(int(wait));
+}
+
+SimulatedTransport::SimulatedTransport(QObject *parent)
+    : HidTransport{parent},
+      m_open{false},
+      m_timer{this},
+      m_stall{0},
+      m_voltage{3900},
+      m_stalled{0}
+{
+    connect( &m_timer, &QTimer::timeout, this, &HidTransport::readyRead );
+    m_timer.setSingleShot(true);
+}
+
+bool SimulatedTransport::open(const QString &path)
+{
+    Q_UNUSED(path);
+    m_open = true;
+    m_replies.clear();
+    return true;
+}
+
+void SimulatedTransport::close()
+{
+    m_open = false;
+    m_replies.clear();
+    m_timer.stop();
+}
+
+QString SimulatedTransport::serial()
+{
+    return "simulated";
+}
+
+int SimulatedTransport::write(const quint8 *data, int length)
+{
+    if( !m_open )
+        return -1;
+
+    int stall = m_stall.load(std::memory_order_relaxed);
+    if( stall > 0 )
+    {
+        QThread::msleep(stall);
+        m_stalled.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    emit written(QByteArray(reinterpret_cast<const char *>(data), length));
+    reply(data, length);
+    return length;
+}
+
+int SimulatedTransport::read(quint8 *data, int length)
+{
+    if( !m_open )
+        return -1;
+
+    if( m_replies.isEmpty() )
+        return 0;
+
+    const QByteArray report = m_replies.takeFirst();
+    int r = qMin(length, int(report.size()));
+    memcpy(data, report.constData(), r);
+    return r;
+}
+
+void SimulatedTransport::setStall(int ms)
+{
+    m_stall.store(qMax(0, ms), std::memory_order_relaxed);
+}
+
+void SimulatedTransport::setVoltage(int voltage)
+{
+    m_voltage.store(voltage, std::memory_order_relaxed);
+}
+
+quint64 SimulatedTransport::stalledWrites() const
+{
+    return m_stalled.load(std::memory_order_relaxed);
+}
+
+void SimulatedTransport::reply(const quint8 *data, int length)
+{
+    if( length < 7 || data[0] != 0x11 || data[1] != 0xff )
+        return;
+
+    // Replies echo the request's first four bytes, software id included.
+    QByteArray r(reinterpret_cast<const char *>(data), length);
+    quint8 *d = reinterpret_cast<quint8 *>(r.data());
+    const quint8 function = data[3] >> 4;
+
+    if( data[2] == 0x00 && function == 0 )
+    {
+        // getFeature(id)
+        switch( (data[4] << 8) | data[5] )
+        {
+        case 0x0003:
+            d[4] = SIM_FIRMWARE;
+            break;
+        case 0x1f20:
+            d[4] = SIM_BATTERY;
+            break;
+        case 0x8070:
+            d[4] = SIM_LIGHTING;
+            break;
+        case 0x8300:
+            d[4] = SIM_SIDETONE;
+            break;
+        default:
+            d[4] = 0;
+            break;
+        }
+        d[5] = d[6] = 0;
+    }
+    else if( data[2] == SIM_FIRMWARE && function == 1 && length >= 12 )
+    {
+        const quint8 info[] = { 0x00, 'U', '1', ' ', 0x12, 0x03, 0x00, 0x45 };
+        memcpy(d + 4, info, sizeof(info));
+    }
+    else if( data[2] == SIM_BATTERY && function == 0 )
+    {
+        const int voltage = m_voltage.load(std::memory_order_relaxed);
+        d[4] = quint8(voltage >> 8);
+        d[5] = quint8(voltage & 0xff);
+        d[6] = 0x01;
+    }
+    else if( !(data[2] == SIM_LIGHTING && function == 3) && !(data[2] == SIM_SIDETONE && function == 1) )
+        return;     // lighting and sidetone are echoed, anything else goes unanswered
+
+    m_replies.push_back(r);
+    if( !m_timer.isActive() )
+        m_timer.start(0);
+}
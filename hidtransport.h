@@ -0,0 +1,180 @@
+#ifndef HIDTRANSPORT_H
+#define HIDTRANSPORT_H
+
+#include <QByteArray>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QList>
+#include <QObject>
+#include <QSocketNotifier>
+#include <QTimer>
+
+#include <atomic>
+#include <hidapi.h>
+
+// Trace files written by RecordingTransport and played back by
+// ReplayTransport: TRACE_MAGIC, then one TraceRecord per report followed by
+// its bytes. Little endian, as written.
+#define TRACE_MAGIC         "G733TRC1"
+#define TRACE_MAX_REPORT    64
+
+#pragma pack(push, 1)
+typedef struct {
+    qint64  time;       // µs since the recording started
+    quint8  direction;  // TraceDirection
+    quint8  length;
+} TraceRecord;
+#pragma pack(pop)
+
+enum TraceDirection {
+    TraceInput,         // report from the device
+    TraceOutput         // report written to the device
+};
+
+// How HeadsetHID talks to a receiver. All calls are from the thread the
+// transport lives on, reads never block.
+class HidTransport : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit HidTransport(QObject *parent = nullptr);
+
+    // The hidapi transport for a hidraw node, wrapped in a recorder when the
+    // Transport/Record setting names a trace file.
+    static HidTransport *create(QObject *parent = nullptr);
+
+    virtual bool open(const QString &path) = 0;
+    virtual void close() = 0;
+    virtual QString serial() = 0;
+
+    // Both return the bytes transferred, or -1 on errors that mean the
+    // device is gone. read() returns 0 once nothing is queued.
+    virtual int write(const quint8 *data, int length) = 0;
+    virtual int read(quint8 *data, int length) = 0;
+
+signals:
+    void readyRead();
+};
+
+// hidapi for output, our own non-blocking descriptor on the hidraw node for
+// input, since hidapi doesn't expose its own.
+class HidapiTransport : public HidTransport
+{
+    Q_OBJECT
+
+    hid_device      *m_handle;
+    int             m_fd;
+    QSocketNotifier *m_notifier;
+
+public:
+    explicit HidapiTransport(QObject *parent = nullptr);
+    ~HidapiTransport();
+
+    bool open(const QString &path) override;
+    void close() override;
+    QString serial() override;
+    int write(const quint8 *data, int length) override;
+    int read(quint8 *data, int length) override;
+};
+
+// Passes everything through to another transport and logs each report with
+// its time to a trace file.
+class RecordingTransport : public HidTransport
+{
+    Q_OBJECT
+
+    HidTransport    *m_inner;
+    QFile           m_trace;
+    QElapsedTimer   m_clock;
+
+public:
+    RecordingTransport(HidTransport *inner, const QString &traceFile, QObject *parent = nullptr);
+    ~RecordingTransport();
+
+    bool open(const QString &path) override;
+    void close() override;
+    QString serial() override;
+    int write(const quint8 *data, int length) override;
+    int read(quint8 *data, int length) override;
+
+protected:
+    void record(TraceDirection direction, const quint8 *data, int length);
+};
+
+// Plays back the input reports of a trace, either with their recorded
+// timing or as fast as they are read. Writes are accepted and dropped.
+class ReplayTransport : public HidTransport
+{
+    Q_OBJECT
+
+    QFile           m_trace;
+    bool            m_realTime;
+    QElapsedTimer   m_clock;
+    QTimer          m_timer;
+
+    TraceRecord     m_next;
+    quint8          m_nextData[TRACE_MAX_REPORT];
+    bool            m_hasNext;
+    int             m_burst;
+
+public:
+    explicit ReplayTransport(bool realTime, QObject *parent = nullptr);
+
+    // path is the trace file.
+    bool open(const QString &path) override;
+    void close() override;
+    QString serial() override;
+    int write(const quint8 *data, int length) override;
+    int read(quint8 *data, int length) override;
+
+    bool atEnd() const;
+
+protected:
+    bool readNext();
+    void schedule();
+
+signals:
+    // Just before a report is handed out, for measuring what follows it.
+    void delivered(const QByteArray &report);
+    void finished();
+};
+
+// Answers like a G733 for tools that need a headset without having one:
+// feature lookups, firmware, voltage, lighting and sidetone. Writes can be
+// made to block first, as they do on a wedged receiver.
+class SimulatedTransport : public HidTransport
+{
+    Q_OBJECT
+
+    bool            m_open;
+    QList<QByteArray> m_replies;
+    QTimer          m_timer;
+    std::atomic<int> m_stall;       // ms each write() blocks
+    std::atomic<int> m_voltage;     // mV
+    std::atomic<quint64> m_stalled; // writes that blocked
+
+public:
+    explicit SimulatedTransport(QObject *parent = nullptr);
+
+    // path is only a name.
+    bool open(const QString &path) override;
+    void close() override;
+    QString serial() override;
+    int write(const quint8 *data, int length) override;
+    int read(quint8 *data, int length) override;
+
+    // These three are safe from any thread.
+    void setStall(int ms);
+    void setVoltage(int voltage);
+    quint64 stalledWrites() const;
+
+protected:
+    void reply(const quint8 *data, int length);
+
+signals:
+    // Every report written, before it is answered.
+    void written(const QByteArray &report);
+};
+
+#endif // HIDTRANSPORT_H
@@ -0,0 +1,147 @@
+#include "hotplugmonitor.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+
+#include <algorithm>
+#include <libudev.h>
+#include <string.h>
+
+#define SYSFS_HIDRAW "/sys/class/hidraw"
+
+HotplugMonitor::HotplugMonitor(QObject *parent)
+    : QObject{parent}
+{
+}
+
+UdevHotplugMonitor::UdevHotplugMonitor(quint16 vendor, quint16 product, QObject *parent)
+    : HotplugMonitor{parent},
+      m_vendor{vendor},
+      m_product{product},
+      m_udev{nullptr},
+      m_monitor{nullptr},
+      m_notifier{nullptr}
+{
+}
+
+UdevHotplugMonitor::~UdevHotplugMonitor()
+{
+    release();
+}
+
+void UdevHotplugMonitor::release()
+{
+    if( m_monitor )
+        udev_monitor_unref(m_monitor);
+    if( m_udev )
+        udev_unref(m_udev);
+    m_monitor = nullptr;
+    m_udev = nullptr;
+}
+
+bool UdevHotplugMonitor::start()
+{
+    if( m_monitor )
+        return true;
+
+    m_udev = udev_new();
+    if( !m_udev )
+    {
+        qDebug() << "UdevHotplugMonitor::start(): Failed to create udev context.";
+        return false;
+    }
+
+    // Listen after udev has run its rules, so permissions are already in place.
+    m_monitor = udev_monitor_new_from_netlink(m_udev, "udev");
+    if( !m_monitor )
+    {
+        qDebug() << "UdevHotplugMonitor::start(): Failed to create udev monitor.";
+        release();
+        return false;
+    }
+
+    udev_monitor_filter_add_match_subsystem_devtype(m_monitor, "hidraw", NULL);
+    if( udev_monitor_enable_receiving(m_monitor) < 0 )
+    {
+        qDebug() << "UdevHotplugMonitor::start(): Failed to enable udev monitor.";
+        release();
+        return false;
+    }
+
+    m_notifier = new QSocketNotifier(udev_monitor_get_fd(m_monitor), QSocketNotifier::Read, this);
+    connect( m_notifier, &QSocketNotifier::activated, this, &UdevHotplugMonitor::readEvents );
+
+    return true;
+}
+
+QStringList UdevHotplugMonitor::scan()
+{
+    // Only hidraw nodes are looked at, not every HID device on the system.
+    QStringList names = QDir(SYSFS_HIDRAW).entryList(QDir::Dirs | QDir::System | QDir::NoDotAndDotDot);
+    std::sort(names.begin(), names.end(), [](const QString &a, const QString &b) {
+        if( a.length() != b.length() )
+            return a.length() < b.length();
+        return a < b;
+    });
+
+    QStringList result;
+    for( const QString &name : names )
+    {
+        if( !matches(name) )
+            continue;
+
+        QString path = QString("/dev/%1").arg(name);
+        m_known.insert(path);
+        result.push_back(path);
+    }
+    return result;
+}
+
+bool UdevHotplugMonitor::matches(const QString &sysname)
+{
+    // HID_ID=0003:0000046D:00000AB5
+    QFile f(QString("%1/%2/device/uevent").arg(SYSFS_HIDRAW).arg(sysname));
+    if( !f.open(QIODevice::ReadOnly) )
+        return false;
+
+    const QList<QByteArray> lines = f.readAll().split('\n');
+    for( const QByteArray &line : lines )
+    {
+        if( !line.startsWith("HID_ID=") )
+            continue;
+
+        QList<QByteArray> parts = line.mid(7).split(':');
+        if( parts.length() < 3 )
+            return false;
+
+        return parts[1].toUInt(nullptr, 16) == m_vendor && parts[2].toUInt(nullptr, 16) == m_product;
+    }
+    return false;
+}
+
+void UdevHotplugMonitor::readEvents()
+{
+    struct udev_device *dev;
+    while( (dev = udev_monitor_receive_device(m_monitor)) )
+    {
+        const char *action = udev_device_get_action(dev);
+        const char *node = udev_device_get_devnode(dev);
+        const char *sysname = udev_device_get_sysname(dev);
+
+        if( action && node && sysname )
+        {
+            QString path = QString::fromLocal8Bit(node);
+            if( 0 == strcmp(action, "add") && matches(QString::fromLocal8Bit(sysname)) )
+            {
+                m_known.insert(path);
+                emit deviceAdded(path);
+            }
+            // sysfs is already gone on removal, so go by what we've seen.
+            else if( 0 == strcmp(action, "remove") && m_known.remove(path) )
+                emit deviceRemoved(path);
+        }
+
+        udev_device_unref(dev);
+    }
+}
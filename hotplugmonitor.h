@@ -0,0 +1,57 @@
+#ifndef HOTPLUGMONITOR_H
+#define HOTPLUGMONITOR_H
+
+#include <QObject>
+#include <QSet>
+#include <QSocketNotifier>
+#include <QStringList>
+
+struct udev;
+struct udev_monitor;
+
+// Reports hidraw nodes belonging to one VID/PID as they come and go.
+class HotplugMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit HotplugMonitor(QObject *parent = nullptr);
+
+    virtual bool start() = 0;
+
+    // Device nodes currently present, e.g. "/dev/hidraw3".
+    virtual QStringList scan() = 0;
+
+signals:
+    void deviceAdded(const QString &path);
+    void deviceRemoved(const QString &path);
+};
+
+class UdevHotplugMonitor : public HotplugMonitor
+{
+    Q_OBJECT
+
+    quint16         m_vendor;
+    quint16         m_product;
+    struct udev     *m_udev;
+    struct udev_monitor *m_monitor;
+    QSocketNotifier *m_notifier;
+
+    QSet<QString>   m_known;
+
+public:
+    explicit UdevHotplugMonitor(quint16 vendor, quint16 product, QObject *parent = nullptr);
+    ~UdevHotplugMonitor();
+
+    bool start() override;
+    QStringList scan() override;
+
+protected:
+    bool matches(const QString &sysname);
+    void release();     // drops the udev context and monitor
+
+private slots:
+    void readEvents();
+};
+
+#endif // HOTPLUGMONITOR_H
@@ -0,0 +1,291 @@
+#include "lightingengine.h"
+
+#include <string.h>
+
+static const char *zoneNames[LightingZoneCount] = { "logo", "strips" };
+static const char *modeNames[LightingModeCount] = { "off", "static", "breathing", "cycle" };
+
+bool operator==(const LightingEffect &a, const LightingEffect &b)
+{
+    return a.mode == b.mode && a.color == b.color && a.period == b.period && a.brightness == b.brightness;
+}
+
+bool operator!=(const LightingEffect &a, const LightingEffect &b)
+{
+    return !(a == b);
+}
+
+LightingEngine::LightingEngine()
+{
+    for( Zone &z : m_zones )
+    {
+        z.wanted = z.frame = z.confirmed = z.sent = offEffect();
+        z.set = false;
+        z.known = false;
+        z.inflight = false;
+        z.sentSinceSet = false;
+        z.written = false;
+    }
+}
+
+LightingEffect LightingEngine::defaultEffect()
+{
+    LightingEffect e;
+    e.mode = LightingBreathing;
+    e.color = 0x00b6ff;
+    e.period = 4000;
+    e.brightness = 100;
+    return e;
+}
+
+LightingEffect LightingEngine::offEffect()
+{
+    LightingEffect e;
+    e.mode = LightingOff;
+    e.color = 0;
+    e.period = 0;
+    e.brightness = 0;
+    return e;
+}
+
+const char *LightingEngine::zoneName(int zone)
+{
+    if( zone < 0 || zone >= LightingZoneCount )
+        return nullptr;
+    return zoneNames[zone];
+}
+
+const char *LightingEngine::modeName(int mode)
+{
+    if( mode < 0 || mode >= LightingModeCount )
+        return nullptr;
+    return modeNames[mode];
+}
+
+int LightingEngine::zoneFromName(const QString &name)
+{
+    for( int i=0; i < LightingZoneCount; i++ )
+    {
+        if( name == zoneNames[i] )
+            return i;
+    }
+    return -1;
+}
+
+int LightingEngine::modeFromName(const QString &name)
+{
+    for( int i=0; i < LightingModeCount; i++ )
+    {
+        if( name == modeNames[i] )
+            return i;
+    }
+    return -1;
+}
+
+void LightingEngine::setEffect(int zone, const LightingEffect &effect)
+{
+    Zone &z = m_zones[zone];
+    z.wanted = effect;
+    z.wanted.brightness = qMin<quint8>(effect.brightness, 100);
+    z.wanted.color &= 0xffffff;
+    if( z.wanted.mode == LightingOff )
+        z.wanted = offEffect();
+    z.set = true;
+    z.sentSinceSet = false;
+    z.written = false;
+
+    // Animations start from their first frame on the next frame() call.
+    if( z.wanted.mode != LightingCycle )
+        z.frame = z.wanted;
+}
+
+LightingEffect LightingEngine::effect(int zone) const
+{
+    return m_zones[zone].wanted;
+}
+
+bool LightingEngine::enabled() const
+{
+    for( const Zone &z : m_zones )
+    {
+        if( z.set && z.wanted.mode != LightingOff )
+            return true;
+    }
+    return false;
+}
+
+bool LightingEngine::animating() const
+{
+    for( const Zone &z : m_zones )
+    {
+        if( z.set && z.wanted.mode == LightingCycle )
+            return true;
+    }
+    return false;
+}
+
+// Hue at phase 0..1 as 0xRRGGBB, scaled by brightness percent.
+static quint32 cycleColor(double phase, int brightness)
+{
+    const double h = phase * 6;
+    const int sector = int(h) % 6;
+    const double f = h - int(h);
+
+    double r = 0, g = 0, b = 0;
+    switch( sector )
+    {
+    case 0: r = 1;      g = f;      break;
+    case 1: r = 1 - f;  g = 1;      break;
+    case 2: g = 1;      b = f;      break;
+    case 3: g = 1 - f;  b = 1;      break;
+    case 4: r = f;      b = 1;      break;
+    case 5: r = 1;      b = 1 - f;  break;
+    }
+
+    const double scale = 255.0 * brightness / 100;
+    return quint32(r * scale + 0.5) << 16 | quint32(g * scale + 0.5) << 8 | quint32(b * scale + 0.5);
+}
+
+void LightingEngine::frame(qint64 now)
+{
+    for( Zone &z : m_zones )
+    {
+        if( !z.set || z.wanted.mode != LightingCycle )
+            continue;
+
+        const int period = qMax<int>(z.wanted.period, LIGHTING_FRAME_INTERVAL);
+        z.frame.mode = LightingStatic;
+        z.frame.color = cycleColor(double(now % period) / period, z.wanted.brightness);
+        z.frame.period = 0;
+        z.frame.brightness = 100;
+    }
+}
+
+bool LightingEngine::needsWrite(int zone) const
+{
+    const Zone &z = m_zones[zone];
+    if( !z.set || z.inflight )
+        return false;
+
+    // Until the first frame() there is nothing to show.
+    if( z.wanted.mode == LightingCycle && z.frame.mode != LightingStatic )
+        return false;
+
+    return !z.known || z.confirmed != z.frame;
+}
+
+bool LightingEngine::inflight(int zone) const
+{
+    return m_zones[zone].inflight;
+}
+
+bool LightingEngine::settled(int zone) const
+{
+    const Zone &z = m_zones[zone];
+    if( !z.set || !z.known || z.inflight )
+        return false;
+
+    // An animation has settled once any of its frames is showing.
+    if( z.wanted.mode == LightingCycle )
+        return z.written;
+
+    return z.confirmed == z.frame;
+}
+
+bool LightingEngine::settled() const
+{
+    for( int z=0; z < LightingZoneCount; z++ )
+    {
+        if( m_zones[z].set && !settled(z) )
+            return false;
+    }
+    return true;
+}
+
+void LightingEngine::write(int zone, quint8 *packet)
+{
+    Zone &z = m_zones[zone];
+    encode(zone, z.frame, packet);
+    z.sent = z.frame;
+    z.inflight = true;
+    z.sentSinceSet = true;
+}
+
+void LightingEngine::confirmed(int zone)
+{
+    Zone &z = m_zones[zone];
+    if( !z.inflight )
+        return;
+
+    z.confirmed = z.sent;
+    z.known = true;
+    z.inflight = false;
+    z.written = z.sentSinceSet;
+}
+
+void LightingEngine::failed(int zone)
+{
+    Zone &z = m_zones[zone];
+    z.inflight = false;
+    z.known = false;
+}
+
+void LightingEngine::reported(int zone, quint8 mode)
+{
+    if( zone < 0 || zone >= LightingZoneCount )
+        return;
+
+    Zone &z = m_zones[zone];
+    if( z.confirmed.mode != mode )
+        z.known = false;
+}
+
+void LightingEngine::invalidate()
+{
+    for( Zone &z : m_zones )
+    {
+        z.known = false;
+        z.inflight = false;
+    }
+}
+
+// 11 ff <index> 3c <zone> <effect> <parameters>, parameters as the G Hub
+// effects lay them out:
+//   static     r g b
+//   breathing  r g b <period ms, BE> <waveform> <brightness>
+void LightingEngine::encode(int zone, const LightingEffect &effect, quint8 *packet)
+{
+    memset(packet + 4, 0, 16);
+    packet[4] = quint8(zone);
+    packet[5] = effect.mode;
+
+    quint32 color = effect.color;
+    if( effect.mode == LightingStatic && effect.brightness < 100 )
+    {
+        // No brightness parameter, dim the color instead.
+        const int b = effect.brightness;
+        color = ((color >> 16 & 0xff) * b / 100) << 16 | ((color >> 8 & 0xff) * b / 100) << 8 | (color & 0xff) * b / 100;
+    }
+
+    switch( effect.mode )
+    {
+    case LightingStatic:
+        packet[6] = color >> 16;
+        packet[7] = color >> 8;
+        packet[8] = color;
+        break;
+
+    case LightingBreathing:
+        packet[6] = color >> 16;
+        packet[7] = color >> 8;
+        packet[8] = color;
+        packet[9] = effect.period >> 8;
+        packet[10] = effect.period;
+        packet[11] = 0x00;
+        packet[12] = effect.brightness;
+        break;
+
+    default:
+        break;
+    }
+}
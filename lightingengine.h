@@ -0,0 +1,100 @@
+#ifndef LIGHTINGENGINE_H
+#define LIGHTINGENGINE_H
+
+#include <QString>
+#include <QtGlobal>
+
+#define LIGHTING_FRAME_INTERVAL 100     // ms between software animation frames
+
+// Zone byte of a setEffect request.
+typedef enum {
+    LightingLogo,
+    LightingStrips,
+    LightingZoneCount
+} LightingZone;
+
+// Effect byte of a setEffect request, apart from LightingCycle which is
+// animated in software as a series of static colors.
+typedef enum {
+    LightingOff,
+    LightingStatic,
+    LightingBreathing,
+    LightingCycle,
+    LightingModeCount
+} LightingMode;
+
+typedef struct {
+    quint8  mode;
+    quint32 color;      // 0xRRGGBB
+    quint16 period;     // ms, breathing and cycle
+    quint8  brightness; // percent
+} LightingEffect;
+
+bool operator==(const LightingEffect &a, const LightingEffect &b);
+bool operator!=(const LightingEffect &a, const LightingEffect &b);
+
+// Keeps what each zone should show and what the headset last confirmed it
+// shows, so only zones that differ get written. A zone has at most one write
+// in flight; changes made meanwhile go out once it is answered.
+class LightingEngine
+{
+    typedef struct {
+        LightingEffect wanted;
+        LightingEffect frame;       // what goes out next, wanted or an animation frame
+        LightingEffect confirmed;
+        LightingEffect sent;
+        bool    set;                // wanted was given, nothing is written before
+        bool    known;              // confirmed matches the headset
+        bool    inflight;
+        bool    sentSinceSet;       // the write in flight was made after wanted was set
+        bool    written;            // and it was confirmed
+    } Zone;
+
+    Zone    m_zones[LightingZoneCount];
+
+public:
+    LightingEngine();
+
+    // The G733's default, blue breathing every 4s at full brightness.
+    static LightingEffect defaultEffect();
+    static LightingEffect offEffect();
+
+    static const char *zoneName(int zone);
+    static const char *modeName(int mode);
+    static int zoneFromName(const QString &name);   // -1 if unknown
+    static int modeFromName(const QString &name);   // -1 if unknown
+
+    void setEffect(int zone, const LightingEffect &effect);
+    LightingEffect effect(int zone) const;
+    bool enabled() const;       // some zone is set to something other than off
+    bool animating() const;     // some zone needs frame() called
+
+    // Moves software animations to time now, in ms.
+    void frame(qint64 now);
+
+    bool needsWrite(int zone) const;
+    bool inflight(int zone) const;
+
+    // The headset confirmed the zone shows what was asked for.
+    bool settled(int zone) const;
+    bool settled() const;       // every zone that was set
+
+    // Fills bytes 4 to 19 of a setEffect request with the zone's next state
+    // and marks it in flight.
+    void write(int zone, quint8 *packet);
+
+    // Outcome of the write in flight.
+    void confirmed(int zone);
+    void failed(int zone);
+
+    // The headset changed a zone by itself, it gets rewritten unless the
+    // effect still matches.
+    void reported(int zone, quint8 mode);
+
+    // The headset forgot its lighting (reconnect, wake).
+    void invalidate();
+
+    static void encode(int zone, const LightingEffect &effect, quint8 *packet);
+};
+
+#endif // LIGHTINGENGINE_H
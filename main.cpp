@@ -1,28 +1,68 @@
+#include <QCommandLineParser>
 #include <QCoreApplication>
 #include <QDBusConnection>
 #include <QDBusError>
+#include <QSettings>
+#include <QTimer>
+
+#include <signal.h>
 
 #include "headsetdbusservice.h"
-#include "headsethid.h"
+#include "headsetmanager.h"
+#include "headsetmanagerdbusservice.h"
+#include "hotplugmonitor.h"
+#include "tracering.h"
+#ifdef HEADSET_STATS
+# include "headsetstatsdbusservice.h"
+# include "statsexporter.h"
+#endif
 
 int main(int argc, char *argv[])
 {
     QCoreApplication a(argc, argv);
+    QCoreApplication::setOrganizationName("g733daemon");
+    QCoreApplication::setApplicationName("g733daemon");
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+    TraceRing::dumpOnSignal(SIGUSR1);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("D-Bus daemon for the Logitech G733 headset.");
+    parser.addHelpOption();
+    QCommandLineOption idleExit("idle-exit", "Exit after this many seconds without a headset, for D-Bus activation.", "seconds");
+    parser.addOption(idleExit);
+    parser.process(a);
 
-    HeadsetHID *h = new HeadsetHID();
-    h->open();
-    //hs->setHIDInterface(h);
+    UdevHotplugMonitor monitor(VENDOR_LOGITECH, ID_LOGITECH_G733);
+    HeadsetManager manager(&monitor, QDBusConnection::sessionBus());
+    if( parser.isSet(idleExit) )
+    {
+        manager.setIdleExit(qMax(1, parser.value(idleExit).toInt()) * 1000);
+        QObject::connect(&manager, &HeadsetManager::idle, &a, &QCoreApplication::quit);
+    }
 
+    // "/" serves the first headset found, as well as the list of all of them.
     QObject obj;
-    HeadsetDBusService *hs = new HeadsetDBusService(&obj, h);
+    HeadsetDBusService *hs = new HeadsetDBusService(&obj, nullptr);
+    new HeadsetManagerDBusService(&obj, &manager);
+    STATS( new HeadsetStatsDBusService(&obj, hs) );
+    QObject::connect(&manager, &HeadsetManager::primaryChanged, hs, &HeadsetDBusService::setHeadset);
     QObject::connect(&a, &QCoreApplication::aboutToQuit, hs, &HeadsetDBusService::aboutToQuit);
     QDBusConnection::sessionBus().registerObject("/", &obj);
 
+#ifdef HEADSET_STATS
+    StatsExporter exporter(&manager);
+    exporter.start();
+#endif
+
+    // The name comes first, clients (and D-Bus activation) shouldn't wait on
+    // the headsets. They show up through headsetAdded and the properties.
     if (!QDBusConnection::sessionBus().registerService(SERVICE_NAME)) {
         fprintf(stderr, "%s\n",
                 qPrintable(QDBusConnection::sessionBus().lastError().message()));
         exit(1);
     }
+    manager.nameOwned();
+    QTimer::singleShot(0, &manager, &HeadsetManager::start);
 
     return a.exec();
 }
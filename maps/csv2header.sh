@@ -0,0 +1,25 @@
+#!/bin/sh
+# Turns a "millivolts,percent" battery curve into a header holding a
+# constexpr BatteryCurveTable named curve_<name>.
+#
+# Usage: csv2header.sh <curve.csv> <name>
+
+set -e
+
+in="$1"
+name="$2"
+guard=$(echo "${name}_CURVE_H" | tr 'a-z' 'A-Z')
+
+echo "// Generated from $(basename "$in") by csv2header.sh, do not edit."
+echo "#ifndef ${guard}"
+echo "#define ${guard}"
+echo
+echo "#include \"batterycurve.h\""
+echo
+echo "constexpr BatteryCurvePoint curve_${name}_points[] = {"
+tr -d '\r' < "$in" | grep ',' | sort -t, -k1,1n -k2,2n | awk -F, '{ printf "    { %d, %s },\n", $1, $2 }'
+echo "};"
+echo
+echo "constexpr auto curve_${name} = BATTERY_CURVE(curve_${name}_points);"
+echo
+echo "#endif // ${guard}"
@@ -0,0 +1,119 @@
+#include "pollscheduler.h"
+
+#include <QSettings>
+#include <QStringList>
+
+#define STABLE_VOLTAGE  5           // mV between polls still considered stable
+#define MS_PER_HOUR     3600000.0
+
+PollScheduler::PollScheduler()
+    : m_minInterval{5000},
+      m_maxInterval{120000},
+      m_offlineInterval{300000},
+      m_budget{720},
+      m_margin{2.0},
+      m_thresholds{5, 10, 20},
+      m_online{false},
+      m_charging{false},
+      m_interval{5000},
+      m_lastVoltage{-1},
+      m_soc{-1},
+      m_tokens{60},
+      m_tokensAt{0}
+{
+}
+
+void PollScheduler::loadSettings()
+{
+    QSettings settings;
+    settings.beginGroup("Poll");
+    m_minInterval = qMax(1000, settings.value("MinInterval", m_minInterval).toInt());
+    m_maxInterval = qMax(m_minInterval, settings.value("MaxInterval", m_maxInterval).toInt());
+    m_offlineInterval = qMax(m_minInterval, settings.value("OfflineInterval", m_offlineInterval).toInt());
+    m_budget = qMax(1, settings.value("WakeupBudget", m_budget).toInt());
+    m_margin = settings.value("ThresholdMargin", m_margin).toDouble();
+
+    if( settings.contains("Thresholds") )
+    {
+        m_thresholds.clear();
+        const QStringList values = settings.value("Thresholds").toString().split(',', Qt::SkipEmptyParts);
+        for( const QString &v : values )
+            m_thresholds.push_back(v.trimmed().toDouble());
+    }
+    settings.endGroup();
+
+    m_interval = m_minInterval;
+    m_tokens = qMax(1, m_budget / 12);
+}
+
+void PollScheduler::setOnline(bool online)
+{
+    if( online && !m_online )
+    {
+        m_interval = m_minInterval;
+        m_lastVoltage = -1;
+    }
+    m_online = online;
+}
+
+void PollScheduler::setCharging(bool charging)
+{
+    if( charging != m_charging )
+        m_interval = m_minInterval;
+    m_charging = charging;
+}
+
+void PollScheduler::sample(int voltage, double soc)
+{
+    // Back off while the voltage holds still, start over once it moves.
+    if( m_lastVoltage >= 0 && qAbs(voltage - m_lastVoltage) <= STABLE_VOLTAGE )
+        m_interval = qMin(m_interval * 2, m_maxInterval);
+    else
+        m_interval = m_minInterval;
+
+    m_lastVoltage = voltage;
+    m_soc = soc;
+}
+
+void PollScheduler::polled(qint64 now)
+{
+    // May go negative when a poll is forced, which pushes the next one out.
+    double capacity = qMax(1, m_budget / 12);
+    m_tokens = qMax(-capacity, tokensAt(now) - 1);
+    m_tokensAt = now;
+}
+
+int PollScheduler::nextInterval(qint64 now) const
+{
+    int interval = m_interval;
+    if( !m_online )
+        interval = m_offlineInterval;
+    else if( m_charging || nearThreshold() )
+        interval = m_minInterval;
+
+    double tokens = tokensAt(now);
+    if( tokens < 1 )
+        interval = qMax(interval, int((1 - tokens) * MS_PER_HOUR / m_budget));
+
+    return interval;
+}
+
+bool PollScheduler::nearThreshold() const
+{
+    if( m_soc < 0 )
+        return false;
+
+    for( double t : m_thresholds )
+    {
+        if( qAbs(m_soc - t) <= m_margin )
+            return true;
+    }
+    return false;
+}
+
+double PollScheduler::tokensAt(qint64 now) const
+{
+    // Up to five minutes' worth of polls can be spent in a burst.
+    double capacity = qMax(1, m_budget / 12);
+    return qMin(capacity, m_tokens + (now - m_tokensAt) * m_budget / MS_PER_HOUR);
+}
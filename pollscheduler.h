@@ -0,0 +1,47 @@
+#ifndef POLLSCHEDULER_H
+#define POLLSCHEDULER_H
+
+#include <QList>
+
+// Picks the interval until the next voltage poll from how the battery is
+// behaving, within a budget of polls per hour. Times are in ms.
+class PollScheduler
+{
+    int     m_minInterval;
+    int     m_maxInterval;
+    int     m_offlineInterval;
+    int     m_budget;           // polls per hour
+    double  m_margin;           // SoC percent around a threshold
+    QList<double> m_thresholds; // SoC percent clients care about
+
+    bool    m_online;
+    bool    m_charging;
+    int     m_interval;         // current discharging interval
+    int     m_lastVoltage;
+    double  m_soc;
+
+    // Token bucket for the budget: refills m_budget tokens per hour.
+    double  m_tokens;
+    qint64  m_tokensAt;
+
+public:
+    PollScheduler();
+
+    // Reads the "Poll" group of the daemon settings.
+    void loadSettings();
+
+    void setOnline(bool online);
+    void setCharging(bool charging);
+    void sample(int voltage, double soc);
+
+    // Called when a poll is sent, charges it against the budget.
+    void polled(qint64 now);
+
+    int nextInterval(qint64 now) const;
+
+protected:
+    bool nearThreshold() const;
+    double tokensAt(qint64 now) const;
+};
+
+#endif // POLLSCHEDULER_H
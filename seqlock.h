@@ -0,0 +1,69 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <cstring>
+#include <type_traits>
+
+// Publishes a trivially copyable value from one writer thread to any number
+// of readers without locking. Readers never wait on the writer's I/O, at worst
+// they retry a copy that raced with a store. The value is kept in atomic words
+// so a torn read is detected rather than undefined.
+template<typename T>
+class SeqLock
+{
+    static_assert(std::is_trivially_copyable<T>::value, "SeqLock needs a trivially copyable type");
+
+    static constexpr std::size_t Words = (sizeof(T) + sizeof(quint64) - 1) / sizeof(quint64);
+
+    std::atomic<quint64> m_sequence;
+    std::atomic<quint64> m_words[Words];
+
+public:
+    SeqLock()
+        : m_sequence{0}
+    {
+        for( std::atomic<quint64> &w : m_words )
+            w.store(0, std::memory_order_relaxed);
+    }
+
+    // Only ever called from the owning thread.
+    void store(const T &value)
+    {
+        quint64 buf[Words] = {};
+        memcpy(buf, &value, sizeof(T));
+
+        quint64 seq = m_sequence.load(std::memory_order_relaxed);
+        m_sequence.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+
+        for( std::size_t i=0; i < Words; i++ )
+            m_words[i].store(buf[i], std::memory_order_relaxed);
+
+        m_sequence.store(seq + 2, std::memory_order_release);
+    }
+
+    T load(quint64 *version = nullptr) const
+    {
+        quint64 buf[Words];
+        quint64 before, after;
+        do {
+            before = m_sequence.load(std::memory_order_acquire);
+            for( std::size_t i=0; i < Words; i++ )
+                buf[i] = m_words[i].load(std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_acquire);
+            after = m_sequence.load(std::memory_order_relaxed);
+        } while( before != after || (before & 1) );
+
+        if( version )
+            *version = before / 2;
+
+        T value;
+        memcpy(&value, buf, sizeof(T));
+        return value;
+    }
+};
+
+#endif // SEQLOCK_H
@@ -0,0 +1,148 @@
+#include "settingsstore.h"
+
+#include <QDebug>
+#include <QSettings>
+#include <QStandardPaths>
+
+SettingsStore::SettingsStore()
+    : m_sidetone{-1}
+{
+    for( int z=0; z < LightingZoneCount; z++ )
+    {
+        m_zones[z] = LightingEngine::offEffect();
+        m_zoneSet[z] = false;
+    }
+}
+
+QString SettingsStore::defaultPath()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/device.ini";
+}
+
+// [<serial>]
+// Lighting-logo\Effect=breathing     ; as for setZoneEffect()
+// Lighting-logo\Color=46847          ; 0xRRGGBB
+// Lighting-logo\Period=4000
+// Lighting-logo\Brightness=100
+// Sidetone\Level=30
+//
+// Files from before the group per serial hold the same keys ungrouped. A
+// headset without a group of its own starts from those, and the first save
+// drops them.
+void SettingsStore::load(const QString &path, const QString &serial)
+{
+    m_path = path;
+    m_serial = serial;
+    for( int z=0; z < LightingZoneCount; z++ )
+    {
+        m_zones[z] = LightingEngine::offEffect();
+        m_zoneSet[z] = false;
+    }
+
+    QSettings settings(m_path, QSettings::IniFormat);
+    if( settings.childGroups().contains(m_serial) )
+        settings.beginGroup(m_serial);
+    for( int z=0; z < LightingZoneCount; z++ )
+    {
+        settings.beginGroup(QString("Lighting-%1").arg(LightingEngine::zoneName(z)));
+        int mode = LightingEngine::modeFromName(settings.value("Effect").toString());
+        if( mode >= 0 )
+        {
+            LightingEffect e;
+            e.mode = quint8(mode);
+            e.color = settings.value("Color").toUInt() & 0xffffff;
+            e.period = quint16(qBound(0, settings.value("Period").toInt(), 0xffff));
+            e.brightness = quint8(qBound(0, settings.value("Brightness", 100).toInt(), 100));
+            m_zones[z] = e;
+            m_zoneSet[z] = true;
+        }
+        else if( settings.contains("Effect") )
+            qDebug() << "SettingsStore: Ignoring the" << LightingEngine::zoneName(z) << "effect in" << m_path;
+        settings.endGroup();
+    }
+
+    bool ok = false;
+    int level = settings.value("Sidetone/Level").toInt(&ok);
+    m_sidetone = ok ? qBound(0, level, 100) : -1;
+}
+
+bool SettingsStore::save() const
+{
+    if( m_path.isEmpty() )
+        return false;
+
+    QSettings settings(m_path, QSettings::IniFormat);
+    for( int z=0; z < LightingZoneCount; z++ )
+        settings.remove(QString("Lighting-%1").arg(LightingEngine::zoneName(z)));
+    settings.remove("Sidetone");
+
+    settings.beginGroup(m_serial);
+    for( int z=0; z < LightingZoneCount; z++ )
+    {
+        if( !m_zoneSet[z] )
+            continue;
+
+        settings.beginGroup(QString("Lighting-%1").arg(LightingEngine::zoneName(z)));
+        settings.setValue("Effect", LightingEngine::modeName(m_zones[z].mode));
+        settings.setValue("Color", uint(m_zones[z].color));
+        settings.setValue("Period", int(m_zones[z].period));
+        settings.setValue("Brightness", int(m_zones[z].brightness));
+        settings.endGroup();
+    }
+    if( m_sidetone >= 0 )
+        settings.setValue("Sidetone/Level", m_sidetone);
+    settings.endGroup();
+
+    settings.sync();
+    if( settings.status() != QSettings::NoError )
+    {
+        qDebug() << "SettingsStore: Failed to write" << m_path;
+        return false;
+    }
+    return true;
+}
+
+bool SettingsStore::isEmpty() const
+{
+    for( bool set : m_zoneSet )
+    {
+        if( set )
+            return false;
+    }
+    return m_sidetone < 0;
+}
+
+bool SettingsStore::hasZone(int zone) const
+{
+    return zone >= 0 && zone < LightingZoneCount && m_zoneSet[zone];
+}
+
+LightingEffect SettingsStore::zone(int zone) const
+{
+    return hasZone(zone) ? m_zones[zone] : LightingEngine::offEffect();
+}
+
+bool SettingsStore::setZone(int zone, const LightingEffect &effect)
+{
+    if( zone < 0 || zone >= LightingZoneCount || (m_zoneSet[zone] && m_zones[zone] == effect) )
+        return false;
+
+    m_zones[zone] = effect;
+    m_zoneSet[zone] = true;
+    return true;
+}
+
+int SettingsStore::sidetone() const
+{
+    return m_sidetone;
+}
+
+bool SettingsStore::setSidetone(int level)
+{
+    level = qBound(0, level, 100);
+    if( m_sidetone == level )
+        return false;
+
+    m_sidetone = level;
+    return true;
+}
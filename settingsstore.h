@@ -0,0 +1,37 @@
+#ifndef SETTINGSSTORE_H
+#define SETTINGSSTORE_H
+
+#include <QString>
+
+#include "lightingengine.h"
+
+// The configuration the headset should be in, kept across restarts per
+// serial in device.ini under the data location. HeadsetHID replays whatever
+// differs from the headset after a wake or reconnect.
+class SettingsStore
+{
+    QString         m_path;
+    QString         m_serial;
+    LightingEffect  m_zones[LightingZoneCount];
+    bool            m_zoneSet[LightingZoneCount];
+    int             m_sidetone;     // percent, -1 if never set
+
+public:
+    SettingsStore();
+
+    // Nothing is kept on disk without a path.
+    void load(const QString &path, const QString &serial);
+    bool save() const;
+    static QString defaultPath();
+
+    bool isEmpty() const;
+
+    bool hasZone(int zone) const;
+    LightingEffect zone(int zone) const;
+    bool setZone(int zone, const LightingEffect &effect);  // true if it changed
+
+    int sidetone() const;
+    bool setSidetone(int level);                            // true if it changed
+};
+
+#endif // SETTINGSSTORE_H
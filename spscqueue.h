@@ -0,0 +1,53 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <QtGlobal>
+
+#include <atomic>
+#include <cstddef>
+
+// Fixed size ring for handing items from exactly one producer thread to
+// exactly one consumer thread without locking. Size must be a power of two.
+template<typename T, std::size_t Size>
+class SpscQueue
+{
+    static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "SpscQueue size must be a power of two");
+
+    T m_items[Size];
+    alignas(64) std::atomic<std::size_t> m_head; // next to pop, owned by the consumer
+    alignas(64) std::atomic<std::size_t> m_tail; // next to push, owned by the producer
+
+public:
+    SpscQueue()
+        : m_items{},
+          m_head{0},
+          m_tail{0}
+    {
+    }
+
+    // Producer side, false when full.
+    bool push(const T &item)
+    {
+        std::size_t tail = m_tail.load(std::memory_order_relaxed);
+        if( tail - m_head.load(std::memory_order_acquire) == Size )
+            return false;
+
+        m_items[tail & (Size - 1)] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side, false when empty.
+    bool pop(T &item)
+    {
+        std::size_t head = m_head.load(std::memory_order_relaxed);
+        if( head == m_tail.load(std::memory_order_acquire) )
+            return false;
+
+        item = m_items[head & (Size - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+#endif // SPSCQUEUE_H
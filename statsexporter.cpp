@@ -0,0 +1,56 @@
+#include "statsexporter.h"
+
+#include <QDebug>
+#include <QLocalSocket>
+#include <QSettings>
+#include <QStandardPaths>
+
+#include "headsetstatsdbusservice.h"
+
+StatsExporter::StatsExporter(HeadsetManager *manager, QObject *parent)
+    : QObject{parent},
+      m_manager{manager},
+      m_server{this}
+{
+    connect( &m_server, &QLocalServer::newConnection, this, &StatsExporter::serve );
+}
+
+bool StatsExporter::start()
+{
+    QString fallback = QStandardPaths::writableLocation(QStandardPaths::RuntimeLocation) + "/g733daemon-stats";
+    QString path = QSettings().value("Stats/Socket", fallback).toString();
+    if( path.isEmpty() )
+        return false;
+
+    // A previous instance that crashed leaves its socket behind.
+    QLocalServer::removeServer(path);
+    m_server.setSocketOptions(QLocalServer::UserAccessOption);
+    if( !m_server.listen(path) )
+    {
+        qDebug() << "StatsExporter::start(): Failed to listen on" << path << m_server.errorString();
+        return false;
+    }
+    return true;
+}
+
+void StatsExporter::serve()
+{
+    while( QLocalSocket *socket = m_server.nextPendingConnection() )
+    {
+        QString text;
+        const QStringList paths = m_manager->objectPaths();
+        for( const QString &path : paths )
+        {
+            HeadsetHID *hid = m_manager->headset(path);
+            if( !hid )
+                continue;
+
+            QString labels = QString("path=\"%1\",serial=\"%2\"").arg(path).arg(hid->serial());
+            text += HeadsetStatsDBusService::exposition(hid, labels);
+        }
+
+        connect( socket, &QLocalSocket::disconnected, socket, &QObject::deleteLater );
+        socket->write(text.toUtf8());
+        socket->disconnectFromServer();
+    }
+}
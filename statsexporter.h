@@ -0,0 +1,29 @@
+#ifndef STATSEXPORTER_H
+#define STATSEXPORTER_H
+
+#include <QLocalServer>
+#include <QObject>
+
+#include "headsetmanager.h"
+
+// Writes the stats of every headset as text to whoever connects to a local
+// socket, then hangs up. Scrapers can read it with e.g. socat.
+class StatsExporter : public QObject
+{
+    Q_OBJECT
+
+    HeadsetManager  *m_manager;
+    QLocalServer    m_server;
+
+public:
+    explicit StatsExporter(HeadsetManager *manager, QObject *parent = nullptr);
+
+    // Listens on the Stats/Socket setting, by default g733daemon-stats in the
+    // runtime directory. An empty setting turns the socket off.
+    bool start();
+
+private slots:
+    void serve();
+};
+
+#endif // STATSEXPORTER_H
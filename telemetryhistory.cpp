@@ -0,0 +1,175 @@
+#include "telemetryhistory.h"
+
+#include <QDebug>
+#include <QDir>
+#include <QFileInfo>
+
+#include <atomic>
+#include <string.h>
+
+TelemetryHistory::TelemetryHistory()
+    : m_map{nullptr},
+      m_header{nullptr},
+      m_records{nullptr}
+{
+}
+
+TelemetryHistory::~TelemetryHistory()
+{
+    close();
+}
+
+bool TelemetryHistory::open(const QString &path)
+{
+    close();
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    m_file.setFileName(path);
+    if( !m_file.open(QIODevice::ReadWrite) )
+    {
+        qDebug() << "TelemetryHistory::open(): Failed to open" << path << m_file.errorString();
+        return false;
+    }
+
+    const qint64 size = sizeof(HistoryHeader) + qint64(HISTORY_CAPACITY) * sizeof(HistoryRecord);
+    bool fresh = m_file.size() != size;
+    if( fresh && !m_file.resize(size) )
+    {
+        qDebug() << "TelemetryHistory::open(): Failed to size" << path << m_file.errorString();
+        m_file.close();
+        return false;
+    }
+
+    m_map = m_file.map(0, size);
+    if( !m_map )
+    {
+        qDebug() << "TelemetryHistory::open(): Failed to map" << path << m_file.errorString();
+        m_file.close();
+        return false;
+    }
+
+    m_header = reinterpret_cast<HistoryHeader *>(m_map);
+    m_records = reinterpret_cast<HistoryRecord *>(m_map + sizeof(HistoryHeader));
+
+    if( fresh || memcmp(m_header->magic, HISTORY_MAGIC, sizeof(m_header->magic)) != 0
+        || m_header->version != HISTORY_VERSION
+        || m_header->recordSize != sizeof(HistoryRecord)
+        || m_header->capacity != HISTORY_CAPACITY )
+    {
+        memset(m_header, 0, sizeof(HistoryHeader));
+        memcpy(m_header->magic, HISTORY_MAGIC, sizeof(m_header->magic));
+        m_header->version = HISTORY_VERSION;
+        m_header->recordSize = sizeof(HistoryRecord);
+        m_header->capacity = HISTORY_CAPACITY;
+        m_header->head = 0;
+    }
+
+    return true;
+}
+
+void TelemetryHistory::close()
+{
+    if( m_map )
+        m_file.unmap(m_map);
+    m_map = nullptr;
+    m_header = nullptr;
+    m_records = nullptr;
+
+    if( m_file.isOpen() )
+        m_file.close();
+}
+
+bool TelemetryHistory::isOpen() const
+{
+    return m_map != nullptr;
+}
+
+QString TelemetryHistory::fileName() const
+{
+    return m_file.fileName();
+}
+
+void TelemetryHistory::append(qint64 timestamp, int voltage, double soc, quint8 flags, quint8 event)
+{
+    if( !m_map )
+        return;
+
+    quint64 head = m_header->head;
+
+    // Range queries rely on time order, don't let a clock step break it.
+    if( head > 0 && timestamp < at(head - 1).timestamp )
+        timestamp = at(head - 1).timestamp;
+
+    HistoryRecord &r = m_records[head % HISTORY_CAPACITY];
+    r.timestamp = timestamp;
+    r.voltage = quint16(qBound(0, voltage, 0xffff));
+    r.soc = quint16(qBound(0, qRound(soc * 100), 10000));
+    r.flags = flags;
+    r.event = event;
+    r.reserved = 0;
+
+    // Readers of the mapping go by head, publish the record before it.
+    std::atomic_thread_fence(std::memory_order_release);
+    m_header->head = head + 1;
+}
+
+QByteArray TelemetryHistory::range(qint64 from, qint64 to, int maxRecords) const
+{
+    QByteArray result;
+    if( !m_map || to < from )
+        return result;
+
+    quint64 head = published();
+    quint64 first = lowerBound(from, head);
+    quint64 last = lowerBound(to + 1, head);
+    quint64 count = qMin<quint64>(last - first, quint64(qMax(0, maxRecords)));
+
+    result.resize(int(count * sizeof(HistoryRecord)));
+    char *out = result.data();
+
+    // At most two contiguous runs, either side of the wrap.
+    while( count > 0 )
+    {
+        quint64 slot = first % HISTORY_CAPACITY;
+        quint64 run = qMin<quint64>(count, HISTORY_CAPACITY - slot);
+        memcpy(out, &m_records[slot], run * sizeof(HistoryRecord));
+        out += run * sizeof(HistoryRecord);
+        first += run;
+        count -= run;
+    }
+    return result;
+}
+
+quint64 TelemetryHistory::published() const
+{
+    // Pairs with the release fence in append().
+    quint64 head = m_header->head;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return head;
+}
+
+quint64 TelemetryHistory::oldest(quint64 head) const
+{
+    return head > HISTORY_CAPACITY ? head - HISTORY_CAPACITY : 0;
+}
+
+const HistoryRecord &TelemetryHistory::at(quint64 n) const
+{
+    return m_records[n % HISTORY_CAPACITY];
+}
+
+quint64 TelemetryHistory::lowerBound(qint64 timestamp, quint64 head) const
+{
+    // First record at or after timestamp, records are in time order.
+    quint64 lo = oldest(head);
+    quint64 hi = head;
+    while( lo < hi )
+    {
+        quint64 mid = lo + (hi - lo) / 2;
+        if( at(mid).timestamp < timestamp )
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
@@ -0,0 +1,80 @@
+#ifndef TELEMETRYHISTORY_H
+#define TELEMETRYHISTORY_H
+
+#include <QByteArray>
+#include <QFile>
+#include <QString>
+
+#define HISTORY_MAGIC       "G733HIST"
+#define HISTORY_VERSION     1
+#define HISTORY_CAPACITY    262144  // records, 4 MiB
+
+// On-disk layout, little endian. The file is a header followed by a ring of
+// HISTORY_CAPACITY records; record n lives in slot n % capacity, and the
+// records from max(0, head - capacity) to head are valid, oldest first.
+typedef struct {
+    char    magic[8];
+    quint32 version;
+    quint32 recordSize;
+    quint32 capacity;
+    quint32 reserved;
+    quint64 head;           // records ever written
+    quint8  padding[32];
+} HistoryHeader;
+
+typedef struct {
+    qint64  timestamp;      // ms since the epoch
+    quint16 voltage;        // mV
+    quint16 soc;            // hundredths of a percent
+    quint8  flags;          // HistoryFlags
+    quint8  event;          // HistoryEvent
+    quint16 reserved;
+} HistoryRecord;
+
+enum HistoryFlags {
+    HistoryOnline   = 0x01,
+    HistoryCharging = 0x02
+};
+
+enum HistoryEvent {
+    HistorySample,
+    HistorySleep,
+    HistoryWake,
+    HistoryChargingChanged,
+    HistoryLost             // stopped answering without going to sleep
+};
+
+static_assert(sizeof(HistoryHeader) == 64, "HistoryHeader must stay 64 bytes");
+static_assert(sizeof(HistoryRecord) == 16, "HistoryRecord must stay 16 bytes");
+
+// Append-only battery history kept in a memory-mapped file.
+class TelemetryHistory
+{
+    QFile           m_file;
+    uchar           *m_map;
+    HistoryHeader   *m_header;
+    HistoryRecord   *m_records;
+
+public:
+    TelemetryHistory();
+    ~TelemetryHistory();
+
+    bool open(const QString &path);
+    void close();
+    bool isOpen() const;
+    QString fileName() const;
+
+    void append(qint64 timestamp, int voltage, double soc, quint8 flags, quint8 event);
+
+    // Records with from <= timestamp <= to, at most maxRecords of the oldest.
+    // Only from the thread appending, close() unmaps the ring.
+    QByteArray range(qint64 from, qint64 to, int maxRecords) const;
+
+protected:
+    quint64 published() const;
+    quint64 oldest(quint64 head) const;
+    const HistoryRecord &at(quint64 n) const;
+    quint64 lowerBound(qint64 timestamp, quint64 head) const;
+};
+
+#endif // TELEMETRYHISTORY_H
@@ -0,0 +1,13 @@
+# Compiles the CSVs in CURVES into <name>_curve.h the way the daemon does,
+# both built-in curves unless the tool names its own.
+isEmpty(CURVES): CURVES = \
+    $$PWD/../maps/charging_ascending.csv \
+    $$PWD/../maps/discharging.csv
+
+curves.input = CURVES
+curves.output = ${QMAKE_FILE_BASE}_curve.h
+curves.commands = sh $$PWD/../maps/csv2header.sh ${QMAKE_FILE_IN} ${QMAKE_FILE_BASE} > ${QMAKE_FILE_OUT}
+curves.depends = $$PWD/../maps/csv2header.sh
+curves.CONFIG += no_link target_predeps
+QMAKE_EXTRA_COMPILERS += curves
+INCLUDEPATH += $$OUT_PWD
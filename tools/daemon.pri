@@ -0,0 +1,50 @@
+# HeadsetHID and everything it links, for the tools that run a headset
+# against a simulated or replayed receiver. New daemon sources only need
+# adding here.
+QT -= gui
+QT += dbus
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+CONFIG += link_pkgconfig
+
+PKGCONFIG += hidapi-hidraw
+
+ROOT = $$clean_path($$PWD/..)
+INCLUDEPATH += $$ROOT $$PWD
+
+SOURCES += \
+        $$PWD/scratchhome.cpp \
+        $$ROOT/actionsink.cpp \
+        $$ROOT/batterycalibration.cpp \
+        $$ROOT/batterycurve.cpp \
+        $$ROOT/batteryestimator.cpp \
+        $$ROOT/buttonengine.cpp \
+        $$ROOT/headsethid.cpp \
+        $$ROOT/hidppdecoder.cpp \
+        $$ROOT/hidtransport.cpp \
+        $$ROOT/lightingengine.cpp \
+        $$ROOT/pollscheduler.cpp \
+        $$ROOT/settingsstore.cpp \
+        $$ROOT/telemetryhistory.cpp \
+        $$ROOT/tracering.cpp
+
+HEADERS += \
+    $$PWD/scratchhome.h \
+    $$ROOT/actionsink.h \
+    $$ROOT/batterycalibration.h \
+    $$ROOT/batterycurve.h \
+    $$ROOT/batteryestimator.h \
+    $$ROOT/buttonengine.h \
+    $$ROOT/headsethid.h \
+    $$ROOT/hidppdecoder.h \
+    $$ROOT/hidtransport.h \
+    $$ROOT/lightingengine.h \
+    $$ROOT/pollscheduler.h \
+    $$ROOT/seqlock.h \
+    $$ROOT/settingsstore.h \
+    $$ROOT/spscqueue.h \
+    $$ROOT/telemetryhistory.h \
+    $$ROOT/tracering.h
+
+include(curves.pri)
@@ -0,0 +1,12 @@
+# Replays a trace recorded with Transport/Record through the daemon's
+# decoder, state and D-Bus code on a private bus.
+TARGET = g733bench
+
+include(../daemon.pri)
+
+SOURCES += \
+        main.cpp \
+        $$ROOT/headsetdbusservice.cpp
+
+HEADERS += \
+    $$ROOT/headsetdbusservice.h
@@ -0,0 +1,247 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QDBusError>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QProcess>
+#include <QSettings>
+#include <QThread>
+#include <QTimer>
+#include <QVariantMap>
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "actionsink.h"
+#include "headsetdbusservice.h"
+#include "headsethid.h"
+#include "hidtransport.h"
+#include "scratchhome.h"
+
+// How long the bus has to be quiet after the trace ends.
+#define SETTLE_TIME 500
+
+static qint64 now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Pairs each voltage reply handed to the daemon with the PropertiesChanged
+// signal that reports it.
+class Bench : public QObject
+{
+    Q_OBJECT
+
+    QMutex  m_lock;
+    QHash<int, qint64> m_pending;   // voltage -> delivery time, ns
+    qint64  m_buttonsAt = 0;        // delivery time of the last button report, ns
+
+public:
+    quint64 reports = 0;
+    quint64 signalCount = 0;
+    std::vector<qint64> latencies;  // ns
+    std::vector<qint64> actionLatencies;    // ns, button report to action
+
+    // Called on the I/O thread.
+    void delivered(const QByteArray &report)
+    {
+        qint64 at = now();
+        const quint8 *d = reinterpret_cast<const quint8 *>(report.constData());
+
+        QMutexLocker locker(&m_lock);
+        reports++;
+        if( report.size() >= 7 && d[0] == 0x11 && (d[3] & 0x0f) != 0 && (d[3] >> 4) == 0 )
+            m_pending.insert((d[4] << 8) | d[5], at);
+        if( report.size() >= 5 && d[0] == 0x11 && d[2] == 0x05 && d[3] == 0x00 )
+            m_buttonsAt = at;
+    }
+
+    // Called on the I/O thread by BenchSink.
+    void actionRun()
+    {
+        qint64 at = now();
+        QMutexLocker locker(&m_lock);
+        actionLatencies.push_back(at - m_buttonsAt);
+    }
+
+public slots:
+    void propertiesChanged(const QString &interface, const QVariantMap &changed, const QStringList &invalidated)
+    {
+        Q_UNUSED(interface);
+        Q_UNUSED(invalidated);
+
+        qint64 at = now();
+        signalCount++;
+        if( !changed.contains("voltage") )
+            return;
+
+        QMutexLocker locker(&m_lock);
+        auto it = m_pending.find(changed.value("voltage").toInt());
+        if( it == m_pending.end() )
+            return;
+        latencies.push_back(at - it.value());
+        m_pending.erase(it);
+    }
+};
+
+// Stands in for uinput, every button is bound to a key press.
+class BenchSink : public ActionSink
+{
+    Bench   *m_bench;
+
+public:
+    explicit BenchSink(Bench *bench) : m_bench{bench} {}
+
+    void run(const ButtonAction &action) override
+    {
+        Q_UNUSED(action);
+        m_bench->actionRun();
+    }
+};
+
+static double percentile(const std::vector<qint64> &sorted, double p)
+{
+    if( sorted.empty() )
+        return 0;
+    size_t i = qMin(sorted.size() - 1, size_t(p * (sorted.size() - 1) + 0.5));
+    return sorted[i] / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    ScratchHome home;
+
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setOrganizationName("g733bench");
+    QCoreApplication::setApplicationName("g733bench");
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays a HID trace through the g733daemon pipeline.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("trace", "Trace recorded with the Transport/Record setting.");
+    QCommandLineOption realTime("realtime", "Replay with the recorded timing instead of as fast as possible.");
+    QCommandLineOption minInterval("min-interval", "Signals/MinInterval for the run, in ms.", "ms", "0");
+    parser.addOption(realTime);
+    parser.addOption(minInterval);
+    parser.process(a);
+
+    if( parser.positionalArguments().size() != 1 )
+        parser.showHelp(1);
+
+    {
+        QSettings settings;
+        settings.setValue("Signals/MinInterval", parser.value(minInterval).toInt());
+        settings.setValue("Deadband/voltage", 0);
+        for( int i=0; i < BUTTON_COUNT; i++ )
+        {
+            settings.setValue(QString("Binding-bench%1/Buttons").arg(i), i);
+            settings.setValue(QString("Binding-bench%1/Trigger").arg(i), "press");
+            settings.setValue(QString("Binding-bench%1/Key").arg(i), "KEY_F20");
+        }
+    }
+
+    QProcess daemon;
+    daemon.start("dbus-daemon", { "--session", "--nofork", "--print-address" });
+    if( !daemon.waitForStarted() || !daemon.waitForReadyRead() )
+    {
+        fprintf(stderr, "Failed to start a private dbus-daemon.\n");
+        return 1;
+    }
+    QString address = QString::fromLocal8Bit(daemon.readLine()).trimmed();
+
+    QDBusConnection service = QDBusConnection::connectToBus(address, "g733bench-service");
+    QDBusConnection client = QDBusConnection::connectToBus(address, "g733bench-client");
+    if( !service.isConnected() || !client.isConnected() )
+    {
+        fprintf(stderr, "Failed to connect to %s\n", qPrintable(address));
+        return 1;
+    }
+
+    Bench bench;
+    QThread io;
+    io.setObjectName("hid-io");
+    io.start();
+
+    HeadsetHID *hid = new HeadsetHID;
+    ReplayTransport *replay = new ReplayTransport(parser.isSet(realTime));
+    QObject::connect( replay, &ReplayTransport::delivered, &bench, [&bench](const QByteArray &report) {
+        bench.delivered(report);
+    }, Qt::DirectConnection );
+    hid->setTransport(replay);
+    hid->setActionSink(new BenchSink(&bench));
+    hid->moveToThread(&io);
+
+    QObject root;
+    new HeadsetDBusService(&root, hid, "/", service);
+    service.registerObject("/", &root);
+    client.connect(service.baseService(), "/", "org.freedesktop.DBus.Properties", "PropertiesChanged",
+                   &bench, SLOT(propertiesChanged(QString,QVariantMap,QStringList)));
+
+    // Stop once nothing has come in for SETTLE_TIME after the trace ran out.
+    QElapsedTimer wall;
+    qint64 replayTime = 0;
+    QTimer settle;
+    settle.setSingleShot(true);
+    QObject::connect( &settle, &QTimer::timeout, &a, &QCoreApplication::quit );
+    QObject::connect( replay, &ReplayTransport::finished, &a, [&]() {
+        replayTime = wall.nsecsElapsed();
+        settle.start(SETTLE_TIME);
+    }, Qt::QueuedConnection );
+
+    bool opened = false;
+    QString trace = parser.positionalArguments().first();
+    wall.start();
+    QMetaObject::invokeMethod( hid, [hid, trace, &opened]() {
+        opened = hid->open(trace);
+    }, Qt::BlockingQueuedConnection );
+    if( !opened )
+    {
+        fprintf(stderr, "Failed to open %s\n", qPrintable(trace));
+        return 1;
+    }
+
+    if( replay->atEnd() )
+        fprintf(stderr, "No input reports in %s\n", qPrintable(trace));
+    else
+        a.exec();
+
+    QMetaObject::invokeMethod( hid, [hid]() {
+        hid->close();
+        hid->deleteLater();
+    }, Qt::BlockingQueuedConnection );
+    io.quit();
+    io.wait();
+    daemon.terminate();
+    daemon.waitForFinished();
+
+    std::sort(bench.latencies.begin(), bench.latencies.end());
+    double seconds = replayTime / 1e9;
+    printf("reports      %llu\n", (unsigned long long)bench.reports);
+    printf("replay       %.3f s\n", seconds);
+    printf("throughput   %.0f reports/s\n", seconds > 0 ? bench.reports / seconds : 0.0);
+    printf("signals      %llu\n", (unsigned long long)bench.signalCount);
+    printf("latency      %zu samples, report to PropertiesChanged in µs\n", bench.latencies.size());
+    printf("  p50        %.1f\n", percentile(bench.latencies, 0.50));
+    printf("  p90        %.1f\n", percentile(bench.latencies, 0.90));
+    printf("  p99        %.1f\n", percentile(bench.latencies, 0.99));
+    printf("  max        %.1f\n", bench.latencies.empty() ? 0.0 : bench.latencies.back() / 1000.0);
+
+    if( !bench.actionLatencies.empty() )
+    {
+        std::sort(bench.actionLatencies.begin(), bench.actionLatencies.end());
+        printf("actions      %zu, button report to action in µs\n", bench.actionLatencies.size());
+        printf("  p50        %.1f\n", percentile(bench.actionLatencies, 0.50));
+        printf("  p99        %.1f\n", percentile(bench.actionLatencies, 0.99));
+        printf("  max        %.1f\n", bench.actionLatencies.back() / 1000.0);
+    }
+
+    return 0;
+}
+
+#include "main.moc"
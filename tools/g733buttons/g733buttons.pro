@@ -0,0 +1,22 @@
+QT -= gui
+QT += dbus
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# Feeds button masks to ButtonEngine and checks which bindings run. "make
+# check" runs it.
+TARGET = g733buttons
+CONFIG += testcase
+
+ROOT = $$PWD/../..
+INCLUDEPATH += $$ROOT
+
+SOURCES += \
+        main.cpp \
+        $$ROOT/actionsink.cpp \
+        $$ROOT/buttonengine.cpp
+
+HEADERS += \
+    $$ROOT/actionsink.h \
+    $$ROOT/buttonengine.h
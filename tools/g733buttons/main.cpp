@@ -0,0 +1,132 @@
+#include <QList>
+#include <QString>
+#include <QStringList>
+
+#include <stdio.h>
+
+#include "buttonengine.h"
+
+#define LONG_PRESS  500     // ms
+
+// Keeps the name of each action run instead of running it. Every binding
+// gets its own key code, which is how the name is found again.
+class RecordingSink : public ActionSink
+{
+    QStringList m_names;
+
+public:
+    QStringList ran;
+
+    void run(const ButtonAction &action) override
+    {
+        ran.push_back(m_names.value(action.key - 1, "?"));
+    }
+
+    ButtonBinding binding(const QString &name, quint8 mask, ButtonTrigger trigger)
+    {
+        ButtonBinding b;
+        b.name = name;
+        b.mask = mask;
+        b.trigger = trigger;
+        b.action.type = ActionKey;
+        m_names.push_back(name);
+        b.action.key = m_names.size();
+        return b;
+    }
+};
+
+// Buttons 0 and 1 each tap and long press on their own, and as a chord.
+// Button 2 only presses.
+static void bind(ButtonEngine &engine, RecordingSink &sink)
+{
+    engine.setBindings({
+        sink.binding("tap0", 0x01, TriggerTap),
+        sink.binding("tap1", 0x02, TriggerTap),
+        sink.binding("long0", 0x01, TriggerLong),
+        sink.binding("long1", 0x02, TriggerLong),
+        sink.binding("chordTap", 0x03, TriggerTap),
+        sink.binding("chordLong", 0x03, TriggerLong),
+        sink.binding("press2", 0x04, TriggerPress),
+    }, LONG_PRESS);
+}
+
+// Each step is a button mask at a time, or an expire() with buttons < 0.
+typedef struct {
+    int     buttons;
+    qint64  at;
+} Step;
+
+static bool check(const char *name, const QList<Step> &steps, const QStringList &expected)
+{
+    ButtonEngine engine;
+    RecordingSink sink;
+    bind(engine, sink);
+
+    for( const Step &s : steps )
+    {
+        if( s.buttons < 0 )
+            engine.expire(s.at, &sink);
+        else
+            engine.update(quint8(s.buttons), s.at, &sink);
+    }
+
+    const bool ok = sink.ran == expected;
+    printf("%-32s %s%s\n", name, qPrintable(sink.ran.join(' ')),
+           ok ? "" : qPrintable(QString("  expected %1").arg(expected.join(' '))));
+    return ok;
+}
+
+int main()
+{
+    bool ok = true;
+
+    ok = check("press", { {0x04, 0} }, { "press2" }) && ok;
+    ok = check("press, then release", { {0x04, 0}, {0x00, 100} }, { "press2" }) && ok;
+
+    ok = check("tap", { {0x01, 0}, {0x00, 100} }, { "tap0" }) && ok;
+    ok = check("tap, just short of long", { {0x01, 0}, {0x00, LONG_PRESS - 1} }, { "tap0" }) && ok;
+
+    ok = check("long, not yet due", { {0x01, 0}, {-1, LONG_PRESS - 1} }, {}) && ok;
+    ok = check("long, then release", { {0x01, 0}, {-1, LONG_PRESS}, {0x00, 800} }, { "long0" }) && ok;
+    ok = check("long, due at release", { {0x01, 0}, {0x00, LONG_PRESS + 100} }, { "long0" }) && ok;
+
+    // The chord takes the place of the taps and long presses of its buttons.
+    ok = check("chord tap", { {0x01, 0}, {0x03, 50}, {0x00, 150} }, { "chordTap" }) && ok;
+    ok = check("chord tap, released 1 then 0", { {0x01, 0}, {0x03, 50}, {0x01, 150}, {0x00, 200} },
+               { "chordTap" }) && ok;
+    ok = check("chord tap, released 0 then 1", { {0x01, 0}, {0x03, 50}, {0x02, 150}, {0x00, 200} },
+               { "chordTap" }) && ok;
+    ok = check("chord tap, last held long", { {0x01, 0}, {0x03, 50}, {0x01, 150}, {0x00, 900} },
+               { "chordTap" }) && ok;
+
+    // Counted from the chord's last button, not from when button 0 went down.
+    ok = check("chord long, not yet due", { {0x01, 0}, {0x03, 50}, {-1, LONG_PRESS} }, {}) && ok;
+    ok = check("chord long", { {0x01, 0}, {0x03, 50}, {-1, LONG_PRESS + 50}, {0x01, 700}, {0x00, 800} },
+               { "chordLong" }) && ok;
+
+    // Button 0 is used up by its long press, so the chord never fires and
+    // button 1 taps on its own.
+    ok = check("long, then chord", { {0x01, 0}, {-1, LONG_PRESS}, {0x03, 600}, {0x00, 700} },
+               { "long0", "tap1" }) && ok;
+
+    // A press fires whatever else is held.
+    ok = check("press during chord", { {0x03, 0}, {0x07, 50}, {0x00, 100} }, { "press2", "chordTap" }) && ok;
+
+    // Nothing runs for buttons held across a reset.
+    {
+        ButtonEngine engine;
+        RecordingSink sink;
+        bind(engine, sink);
+        engine.update(0x01, 0, &sink);
+        const bool deadline = engine.nextDeadline() == LONG_PRESS;
+        engine.reset();
+        engine.expire(LONG_PRESS, &sink);
+        engine.update(0x00, LONG_PRESS + 100, &sink);
+        const bool reset = sink.ran.isEmpty() && engine.nextDeadline() < 0 && deadline;
+        printf("%-32s %s%s\n", "reset", qPrintable(sink.ran.join(' ')), reset ? "" : "  expected nothing");
+        ok = reset && ok;
+    }
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,27 @@
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# Replays a battery history through the daemon's curve calibration and
+# reports how far each curve was off.
+TARGET = g733calibrate
+
+ROOT = $$PWD/../..
+INCLUDEPATH += $$ROOT
+
+SOURCES += \
+        main.cpp \
+        $$ROOT/batterycalibration.cpp \
+        $$ROOT/batterycurve.cpp \
+        $$ROOT/batteryestimator.cpp
+
+HEADERS += \
+    $$ROOT/batterycalibration.h \
+    $$ROOT/batterycurve.h \
+    $$ROOT/batteryestimator.h \
+    $$ROOT/telemetryhistory.h
+
+# Same discharge curve header as the daemon.
+CURVES = $$ROOT/maps/discharging.csv
+include(../curves.pri)
@@ -0,0 +1,170 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QString>
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+#include "batterycalibration.h"
+#include "batterycurve.h"
+#include "batteryestimator.h"
+#include "telemetryhistory.h"
+
+#include "discharging_curve.h"
+
+typedef struct {
+    qint64  online;     // ms into the discharge
+    int     voltage;    // filtered, as the daemon feeds it
+    double  builtin;
+    double  learned;
+} Point;
+
+// Mean absolute error against the share of online time left, which is what
+// the calibration learns from.
+static void report(const std::vector<Point> &points, const BatteryCalibration &learned, qint64 started)
+{
+    const qint64 total = points.back().online;
+    if( total <= 0 )
+        return;
+
+    double builtin = 0;
+    double own = 0;
+    for( const Point &p : points )
+    {
+        const double truth = 100.0 * (total - p.online) / total;
+        builtin += qAbs(p.builtin - truth);
+        own += qAbs(p.learned - truth);
+    }
+
+    const QString ownMae = learned.converged() ? QString::number(own / points.size(), 'f', 2) : QString("-");
+    printf("%s %7.2fh %6zu %8.2f %8s\n",
+           qPrintable(QDateTime::fromMSecsSinceEpoch(started).toString("yyyy-MM-dd HH:mm")),
+           total / 3600000.0, points.size(), builtin / points.size(), qPrintable(ownMae));
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("g733calibrate");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Replays a g733daemon battery history through the curve calibration.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("history", "A history-<serial>.bin file.");
+    QCommandLineOption curveOption("curve", "Print the learned curve next to the built-in one at the end.");
+    parser.addOption(curveOption);
+    parser.process(a);
+
+    const QStringList args = parser.positionalArguments();
+    if( args.size() != 1 )
+        parser.showHelp(1);
+
+    QFile f(args.first());
+    if( !f.open(QIODevice::ReadOnly) )
+    {
+        fprintf(stderr, "%s: %s\n", qPrintable(args.first()), qPrintable(f.errorString()));
+        return 1;
+    }
+
+    HistoryHeader header;
+    if( f.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header)
+        || memcmp(header.magic, HISTORY_MAGIC, sizeof(header.magic)) != 0 )
+    {
+        fprintf(stderr, "%s: Not a battery history.\n", qPrintable(args.first()));
+        return 1;
+    }
+    if( header.version != HISTORY_VERSION || header.recordSize != sizeof(HistoryRecord) || header.capacity == 0 )
+    {
+        fprintf(stderr, "%s: Unsupported history version %u.\n", qPrintable(args.first()), header.version);
+        return 1;
+    }
+
+    const QByteArray ring = f.readAll();
+    if( quint64(ring.size()) < quint64(header.capacity) * sizeof(HistoryRecord) )
+    {
+        fprintf(stderr, "%s: Truncated.\n", qPrintable(args.first()));
+        return 1;
+    }
+    const HistoryRecord *records = reinterpret_cast<const HistoryRecord *>(ring.constData());
+
+    const BatteryCurve builtin(curve_discharging);
+    BatteryEstimator estimator;
+    BatteryCalibration calibration;
+
+    // The discharge being followed, and the curve as it was when it started
+    // so each one is judged on what was learned before it.
+    BatteryCalibration learned;
+    std::vector<Point> points;
+    qint64 started = 0;
+    qint64 online = 0;
+    qint64 last = -1;
+    int discarded = 0;
+
+    printf("%-16s %8s %6s %8s %8s\n", "discharge", "online", "reads", "built-in", "learned");
+
+    const quint64 first = header.head > header.capacity ? header.head - header.capacity : 0;
+    for( quint64 n=first; n < header.head; n++ )
+    {
+        const HistoryRecord &r = records[n % header.capacity];
+
+        if( r.event == HistorySleep || r.event == HistoryLost )
+        {
+            calibration.offline(r.event == HistoryLost);
+            last = -1;
+            continue;
+        }
+        if( r.event == HistoryWake || !(r.flags & HistoryOnline) )
+            continue;
+
+        const bool charging = r.flags & HistoryCharging;
+        estimator.setCharging(charging);
+        const int voltage = qRound(estimator.filterVoltage(r.voltage));
+        const double soc = builtin.soc(voltage);
+
+        const bool wasActive = calibration.active();
+        if( calibration.sample(r.timestamp, voltage, charging, soc) )
+        {
+            report(points, learned, started);
+            points.clear();
+            continue;
+        }
+        if( !calibration.active() )
+        {
+            if( wasActive )
+                discarded++;
+            points.clear();
+            continue;
+        }
+
+        if( !wasActive )
+        {
+            learned = calibration;
+            started = r.timestamp;
+            online = 0;
+            last = -1;
+        }
+        if( last >= 0 && r.timestamp > last && r.timestamp - last <= CALIBRATION_MAX_GAP )
+            online += r.timestamp - last;
+        last = r.timestamp;
+
+        points.push_back({ online, voltage, soc, learned.soc(voltage) });
+    }
+
+    printf("%d full discharges learned, %d cut short, curve %s.\n", calibration.cycles(), discarded,
+           calibration.converged() ? "in use" : "not in use yet");
+
+    if( parser.isSet(curveOption) )
+    {
+        printf("\n%6s %8s %8s\n", "mV", "built-in", "learned");
+        for( int k=0; k < CALIBRATION_KNOTS; k++ )
+        {
+            const int voltage = CALIBRATION_MIN_VOLTAGE + k * CALIBRATION_STEP;
+            printf("%6d %8.2f %8.2f\n", voltage, builtin.soc(voltage), calibration.soc(voltage));
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,8 @@
+# Checks what changesSince() hands out as publications fill and overrun its
+# ring. "make check" runs it.
+TARGET = g733changes
+CONFIG += testcase
+
+include(../daemon.pri)
+
+SOURCES += main.cpp
@@ -0,0 +1,120 @@
+#include <QCoreApplication>
+#include <QMap>
+#include <QSettings>
+#include <QStringList>
+
+#include <stdio.h>
+
+#include "headsethid.h"
+#include "scratchhome.h"
+
+// Publishes made-up readings without a device, the way the I/O thread
+// would after a report.
+class PublishingHeadset : public HeadsetHID
+{
+public:
+    void publish(int voltage, int soc, int sidetone)
+    {
+        m_voltage = quint16(voltage);
+        m_soc = quint16(soc);
+        m_sidetone = sidetone;
+        publishState();
+    }
+
+    void setVoltage(int voltage)
+    {
+        publish(voltage, m_soc, m_sidetone);
+    }
+};
+
+typedef QMap<int, qint32> Changes;
+
+static QString describe(bool whole, const Changes &changes)
+{
+    if( !whole )
+        return "refused";
+
+    QStringList parts;
+    for( auto it = changes.constBegin(); it != changes.constEnd(); ++it )
+        parts.push_back(QString("%1=%2").arg(HeadsetHID::statePropertyName(it.key())).arg(it.value()));
+    return parts.isEmpty() ? "nothing" : parts.join(' ');
+}
+
+// expectWhole false means the caller has to fall back to state().
+static bool expect(const PublishingHeadset &hid, const char *step, quint64 since, bool expectWhole, const Changes &expected = Changes())
+{
+    Changes changes;
+    const bool whole = hid.changesSince(since, changes);
+    const bool ok = whole == expectWhole && (!whole || changes == expected);
+    printf("%-36s %s%s\n", step, qPrintable(describe(whole, changes)),
+           ok ? "" : qPrintable(QString("  expected %1").arg(describe(expectWhole, expected))));
+    return ok;
+}
+
+static quint64 current(const PublishingHeadset &hid)
+{
+    Changes changes;
+    quint64 sequence = 0;
+    hid.changesSince(0, changes, &sequence);
+    return sequence;
+}
+
+int main(int argc, char *argv[])
+{
+    ScratchHome home;
+
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setOrganizationName("g733changes");
+    QCoreApplication::setApplicationName("g733changes");
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+
+    PublishingHeadset hid;
+    bool ok = true;
+
+    hid.publish(3900, 80, 20);
+    const quint64 start = current(hid);
+    ok = expect(hid, "nothing since", start, true) && ok;
+    ok = expect(hid, "ahead of the headset", start + 1, false) && ok;
+
+    // Several properties in one publication share its sequence.
+    hid.publish(3800, 70, 20);
+    ok = expect(hid, "one publication", start, true, { {StateVoltage, 3800}, {StateSoc, 70} }) && ok;
+    if( current(hid) != start + 1 )
+    {
+        printf("One publication took %llu sequence numbers.\n", (unsigned long long)(current(hid) - start));
+        ok = false;
+    }
+
+    // Publishing the same values again isn't a change.
+    hid.publish(3800, 70, 20);
+    ok = expect(hid, "unchanged", start + 1, true) && ok;
+
+    // Only the latest value of each property.
+    hid.publish(3700, 70, 30);
+    ok = expect(hid, "latest of two", start, true, { {StateVoltage, 3700}, {StateSoc, 70}, {StateSidetone, 30} }) && ok;
+    ok = expect(hid, "second only", start + 1, true, { {StateVoltage, 3700}, {StateSidetone, 30} }) && ok;
+
+    // The ring holds the last STATE_LOG_SIZE changes, one per publication
+    // here. Whatever the oldest of them came after is no longer known.
+    for( int i=0; i < STATE_LOG_SIZE + 10; i++ )
+        hid.setVoltage(3000 + i);
+    const quint64 last = current(hid);
+    const quint64 oldest = last - STATE_LOG_SIZE + 1;
+    ok = expect(hid, "overflowed, from the start", start, false) && ok;
+    ok = expect(hid, "overflowed, before the oldest", oldest - 1, false) && ok;
+    ok = expect(hid, "overflowed, from the oldest", oldest, true, { {StateVoltage, 3000 + STATE_LOG_SIZE + 9} }) && ok;
+    ok = expect(hid, "overflowed, newest", last, true) && ok;
+
+    // A publication of three changes followed by STATE_LOG_SIZE - 2 more
+    // leaves two of its three in the ring. Reaching back before it would
+    // miss its voltage, so it's refused; from it on all is whole.
+    hid.publish(4000, 90, 40);
+    const quint64 partial = current(hid);
+    for( int i=0; i < STATE_LOG_SIZE - 2; i++ )
+        hid.setVoltage(3000 + i);
+    ok = expect(hid, "partly overwritten", partial - 1, false) && ok;
+    ok = expect(hid, "after the partial one", partial, true, { {StateVoltage, 3000 + STATE_LOG_SIZE - 3} }) && ok;
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,23 @@
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# Checks the compiled-in battery curves against maps/*.csv and times the
+# lookup. "make check" runs the comparison.
+TARGET = g733curves
+CONFIG += testcase
+
+ROOT = $$PWD/../..
+INCLUDEPATH += $$ROOT
+DEFINES += MAPS_DIR=\\\"$$ROOT/maps\\\"
+
+SOURCES += \
+        main.cpp \
+        $$ROOT/batterycurve.cpp
+
+HEADERS += \
+    $$ROOT/batterycurve.h
+
+# Same curve headers as the daemon.
+include(../curves.pri)
@@ -0,0 +1,212 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QFile>
+#include <QList>
+#include <QPair>
+#include <QString>
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <random>
+#include <stdio.h>
+#include <vector>
+
+#include "batterycurve.h"
+
+#include "charging_ascending_curve.h"
+#include "discharging_curve.h"
+
+#define TOLERANCE   0.001   // percent, the table holds floats
+#define MARGIN      50      // mV checked beyond each end of the samples
+
+typedef QList< QPair<int, double> > Samples;
+
+static qint64 now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Same format as HeadsetHID::loadMap().
+static Samples readCsv(const QString &path)
+{
+    Samples res;
+    QFile f(path);
+    if( !f.open(QIODevice::ReadOnly) )
+    {
+        fprintf(stderr, "%s: %s\n", qPrintable(path), qPrintable(f.errorString()));
+        return res;
+    }
+
+    while( !f.atEnd() )
+    {
+        QList<QByteArray> parts = f.readLine().trimmed().split(',');
+        if( parts.size() != 2 )
+            continue;
+        res.push_back({ parts[0].toInt(), parts[1].toDouble() });
+    }
+    return res;
+}
+
+// Highest SoC sampled at or below voltage.
+static double best(const Samples &samples, int voltage)
+{
+    double soc = -1;
+    for( const QPair<int, double> &s : samples )
+    {
+        if( s.first <= voltage && s.second > soc )
+            soc = s.second;
+    }
+    return soc;
+}
+
+// What the table should hold, worked out the slow way straight from the
+// samples: the running maximum at the sampled voltages, interpolated
+// linearly in between and clamped at the ends.
+static double reference(const Samples &samples, int voltage)
+{
+    int lowest = samples.first().first;
+    int below = INT_MIN;
+    int above = INT_MAX;
+    for( const QPair<int, double> &s : samples )
+    {
+        lowest = qMin(lowest, s.first);
+        if( s.first <= voltage )
+            below = qMax(below, s.first);
+        else
+            above = qMin(above, s.first);
+    }
+
+    if( below == INT_MIN )
+        return best(samples, lowest);
+    if( below == voltage || above == INT_MAX )
+        return best(samples, below);
+
+    const double from = best(samples, below);
+    const double to = best(samples, above);
+    return from + (to - from) * (voltage - below) / (above - below);
+}
+
+static bool check(const char *name, const BatteryCurve &compiled, const QString &path)
+{
+    const Samples samples = readCsv(path);
+    if( samples.isEmpty() )
+    {
+        fprintf(stderr, "%s: No samples.\n", qPrintable(path));
+        return false;
+    }
+
+    BatteryCurve runtime;
+    runtime.build(samples);
+
+    int lowest = samples.first().first;
+    int highest = lowest;
+    for( const QPair<int, double> &s : samples )
+    {
+        lowest = qMin(lowest, s.first);
+        highest = qMax(highest, s.first);
+    }
+
+    int failures = 0;
+    if( compiled.minVoltage() != lowest || compiled.maxVoltage() != highest )
+    {
+        fprintf(stderr, "%s: Table covers %d-%d mV, the samples %d-%d mV.\n", name,
+                compiled.minVoltage(), compiled.maxVoltage(), lowest, highest);
+        failures++;
+    }
+
+    double previous = -1;
+    for( int v=lowest - MARGIN; v <= highest + MARGIN; v++ )
+    {
+        const double expected = reference(samples, v);
+        const double got = compiled.soc(v);
+        if( qAbs(got - expected) > TOLERANCE || qAbs(runtime.soc(v) - expected) > TOLERANCE )
+        {
+            if( failures < 10 )
+                fprintf(stderr, "%s: %d mV is %.3f compiled, %.3f built, expected %.3f\n", name, v, got, runtime.soc(v), expected);
+            failures++;
+        }
+        if( got < previous )
+        {
+            if( failures < 10 )
+                fprintf(stderr, "%s: %d mV drops to %.3f from %.3f\n", name, v, got, previous);
+            failures++;
+        }
+        previous = got;
+    }
+
+    printf("%-12s %4d samples, %d-%d mV, %s\n", name, int(samples.size()), lowest, highest,
+           failures ? qPrintable(QString("%1 failures").arg(failures)) : "ok");
+    return failures == 0;
+}
+
+// The lookup the table replaced: first sample at or below the voltage, with
+// the samples in descending voltage order.
+static double scan(const Samples &descending, int voltage)
+{
+    for( const QPair<int, double> &s : descending )
+    {
+        if( s.first <= voltage )
+            return s.second;
+    }
+    return descending.last().second;
+}
+
+static void bench(const BatteryCurve &compiled, const QString &path, int lookups)
+{
+    Samples descending = readCsv(path);
+    std::sort(descending.begin(), descending.end(), [](const QPair<int, double> &a, const QPair<int, double> &b) {
+        return a.first > b.first;
+    });
+
+    std::mt19937 rng(733);
+    std::uniform_int_distribution<int> dist(compiled.minVoltage() - MARGIN, compiled.maxVoltage() + MARGIN);
+    std::vector<int> voltages(lookups);
+    for( int &v : voltages )
+        v = dist(rng);
+
+    // The sums keep the loops from being optimised away.
+    double sum = 0;
+    qint64 start = now();
+    for( int v : voltages )
+        sum += compiled.soc(v);
+    const qint64 table = now() - start;
+
+    start = now();
+    for( int v : voltages )
+        sum += scan(descending, v);
+    const qint64 linear = now() - start;
+
+    printf("table        %.2f ns/lookup, %.0f lookups/s\n", double(table) / lookups, lookups / (table / 1e9));
+    printf("linear scan  %.2f ns/lookup, %.0f lookups/s\n", double(linear) / lookups, lookups / (linear / 1e9));
+    printf("(checksum %.0f)\n", sum);
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("g733curves");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Checks the compiled-in battery curves against maps/*.csv.");
+    parser.addHelpOption();
+    QCommandLineOption benchOption("bench", "Also time lookups in the discharge curve against the old linear scan.");
+    QCommandLineOption lookupsOption("lookups", "Lookups timed by --bench.", "count", "10000000");
+    QCommandLineOption mapsOption("maps", "Directory holding the CSVs.", "dir", MAPS_DIR);
+    parser.addOption(benchOption);
+    parser.addOption(lookupsOption);
+    parser.addOption(mapsOption);
+    parser.process(a);
+
+    const QString maps = parser.value(mapsOption);
+    const BatteryCurve charging(curve_charging_ascending);
+    const BatteryCurve discharging(curve_discharging);
+
+    bool ok = check("charging", charging, maps + "/charging_ascending.csv");
+    ok = check("discharging", discharging, maps + "/discharging.csv") && ok;
+
+    if( parser.isSet(benchOption) )
+        bench(discharging, maps + "/discharging.csv", qMax(1, parser.value(lookupsOption).toInt()));
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# Times HidppDecoder over the report shapes it documents.
+TARGET = g733decode
+
+ROOT = $$PWD/../..
+INCLUDEPATH += $$ROOT
+
+SOURCES += \
+        main.cpp \
+        $$ROOT/hidppdecoder.cpp
+
+HEADERS += \
+    $$ROOT/hidppdecoder.h
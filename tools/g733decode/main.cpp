@@ -0,0 +1,109 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+
+#include "hidppdecoder.h"
+
+#define REPORT_LENGTH   20
+#define FIRMWARE_INDEX  0x03    // not in HidppFeatureMap's defaults, discovery finds it
+
+static qint64 now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef struct {
+    const char  *name;
+    quint8      bytes[REPORT_LENGTH];
+    int         length;
+    int         type;       // HidppEventType, HidppUnknown if nothing should claim it
+} Shape;
+
+// The reports documented in hidppdecoder.cpp, and some it must turn down.
+static const Shape shapes[] = {
+    { "featureIndex", { 0x11, 0xff, 0x00, 0x03, 0x08, 0x00, 0x01 }, REPORT_LENGTH, HidppFeatureIndex },
+    { "firmware", { 0x11, 0xff, FIRMWARE_INDEX, 0x13, 0x00, 'U', '1', ' ', 0x12, 0x03, 0x00, 0x45 }, REPORT_LENGTH, HidppFirmware },
+    { "buttons", { 0x11, 0xff, 0x05, 0x00, 0x01 }, REPORT_LENGTH, HidppButtons },
+    { "battery", { 0x11, 0xff, 0x08, 0x0a, 0x0f, 0x3c, 0x01 }, REPORT_LENGTH, HidppBattery },
+    { "sleep", { 0x11, 0xff, 0x08, 0x00, 0x00, 0x00, 0x00 }, REPORT_LENGTH, HidppSleep },
+    { "wake", { 0x11, 0xff, 0x08, 0x00, 0x0f, 0x83, 0x01 }, REPORT_LENGTH, HidppWake },
+    { "lighting", { 0x11, 0xff, 0x04, 0x3c, 0x00, 0x02 }, REPORT_LENGTH, HidppLighting },
+    { "sidetone", { 0x11, 0xff, 0x07, 0x1a, 0x1e }, REPORT_LENGTH, HidppSidetone },
+    { "error", { 0x11, 0xff, 0xff, 0x08, 0x0a, 0x05 }, REPORT_LENGTH, HidppError },
+    { "unknownFeature", { 0x11, 0xff, 0x09, 0x00, 0x01 }, REPORT_LENGTH, HidppUnknown },
+    { "shortReport", { 0x10, 0xff, 0x08, 0x0a, 0x00, 0x00, 0x00 }, 7, HidppUnknown },
+};
+
+#define SHAPE_COUNT int(sizeof(shapes) / sizeof(shapes[0]))
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("g733decode");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Measures HidppDecoder throughput over the documented report shapes.");
+    parser.addHelpOption();
+    QCommandLineOption packetsOption("packets", "Reports decoded per shape.", "count", "5000000");
+    parser.addOption(packetsOption);
+    parser.process(a);
+
+    const qint64 packets = qMax(1LL, parser.value(packetsOption).toLongLong());
+
+    HidppFeatureMap features;
+    features.set(FeatureFirmware, FIRMWARE_INDEX);
+
+    // A shape that decodes to the wrong thing makes the numbers meaningless.
+    bool ok = true;
+    for( const Shape &s : shapes )
+    {
+        HidppEvent event;
+        bool claimed = HidppDecoder::decode(s.bytes, s.length, features, event);
+        if( (claimed ? int(event.type) : int(HidppUnknown)) != s.type )
+        {
+            fprintf(stderr, "%s: decoded as %d, expected %d\n", s.name, claimed ? int(event.type) : -1, s.type);
+            ok = false;
+        }
+    }
+    if( !ok )
+        return 1;
+
+    printf("%-16s %14s %10s\n", "shape", "packets/s", "ns/packet");
+
+    // The sum keeps the loops from being optimised away.
+    quint64 sum = 0;
+    qint64 total = 0;
+    for( const Shape &s : shapes )
+    {
+        HidppEvent event;
+        qint64 started = now();
+        for( qint64 i=0; i < packets; i++ )
+        {
+            HidppDecoder::decode(s.bytes, s.length, features, event);
+            sum += event.type;
+        }
+        const qint64 took = qMax<qint64>(1, now() - started);
+        total += took;
+        printf("%-16s %14.0f %10.2f\n", s.name, packets / (took / 1e9), double(took) / packets);
+    }
+
+    // All of them interleaved, as they arrive.
+    HidppEvent event;
+    qint64 started = now();
+    for( qint64 i=0; i < packets; i++ )
+    {
+        for( const Shape &s : shapes )
+        {
+            HidppDecoder::decode(s.bytes, s.length, features, event);
+            sum += event.type;
+        }
+    }
+    const qint64 mixed = qMax<qint64>(1, now() - started);
+
+    printf("%-16s %14.0f %10.2f\n", "mixed", packets * SHAPE_COUNT / (mixed / 1e9), double(mixed) / (packets * SHAPE_COUNT));
+    printf("(checksum %llu, %.2f s)\n", (unsigned long long)sum, (total + mixed) / 1e9);
+    return 0;
+}
@@ -0,0 +1,19 @@
+# Drives HeadsetManager through a fake hotplug monitor and simulated
+# headsets on a private bus. "make check" runs it.
+TARGET = g733hotplug
+CONFIG += testcase
+
+include(../daemon.pri)
+
+PKGCONFIG += libudev
+
+SOURCES += \
+        main.cpp \
+        $$ROOT/headsetdbusservice.cpp \
+        $$ROOT/headsetmanager.cpp \
+        $$ROOT/hotplugmonitor.cpp
+
+HEADERS += \
+    $$ROOT/headsetdbusservice.h \
+    $$ROOT/headsetmanager.h \
+    $$ROOT/hotplugmonitor.h
@@ -0,0 +1,197 @@
+#include <QCoreApplication>
+#include <QDBusConnection>
+#include <QEventLoop>
+#include <QProcess>
+#include <QSettings>
+#include <QTimer>
+
+#include <atomic>
+#include <functional>
+#include <stdio.h>
+
+#include "headsethid.h"
+#include "headsetmanager.h"
+#include "hidtransport.h"
+#include "hotplugmonitor.h"
+#include "scratchhome.h"
+
+#define SETTLE_TIMEOUT  3000    // ms
+
+// Headsets alive, counted from the I/O threads that delete them.
+static std::atomic<int> g_headsets{0};
+
+// The next write on any headset fails, as it does on a receiver that went
+// away under hidapi.
+static std::atomic<bool> g_failWrite{false};
+
+// Device nodes come and go when told to, instead of when udev says so.
+class FakeHotplugMonitor : public HotplugMonitor
+{
+    QStringList m_present;
+
+public:
+    bool start() override
+    {
+        return true;
+    }
+
+    QStringList scan() override
+    {
+        return m_present;
+    }
+
+    void plug(const QString &path)
+    {
+        m_present.push_back(path);
+        emit deviceAdded(path);
+    }
+
+    void unplug(const QString &path)
+    {
+        m_present.removeAll(path);
+        emit deviceRemoved(path);
+    }
+};
+
+class FailingTransport : public SimulatedTransport
+{
+public:
+    int write(const quint8 *data, int length) override
+    {
+        if( g_failWrite.exchange(false) )
+            return -1;
+        return SimulatedTransport::write(data, length);
+    }
+};
+
+// Every headset answers like a G733, whatever the node.
+class SimulatedManager : public HeadsetManager
+{
+public:
+    using HeadsetManager::HeadsetManager;
+
+protected:
+    HeadsetHID *createHeadset(const QString &path) override
+    {
+        Q_UNUSED(path);
+        HeadsetHID *hid = new HeadsetHID;
+        hid->setTransport(new FailingTransport);
+        g_headsets++;
+        QObject::connect( hid, &QObject::destroyed, [](){ g_headsets--; } );
+        return hid;
+    }
+};
+
+// Runs the event loop until done() holds, false if it didn't in time.
+static bool settle(const std::function<bool()> &done)
+{
+    for( int waited=0; waited < SETTLE_TIMEOUT; waited += 10 )
+    {
+        if( done() )
+            return true;
+
+        QEventLoop loop;
+        QTimer::singleShot(10, &loop, &QEventLoop::quit);
+        loop.exec();
+    }
+    return done();
+}
+
+static bool expect(const char *step, bool ok, const QStringList &paths)
+{
+    printf("%-28s %-24s %d headset(s)%s\n", step, qPrintable(paths.join(' ')), g_headsets.load(), ok ? "" : "  FAILED");
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    ScratchHome home;
+
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setOrganizationName("g733hotplug");
+    QCoreApplication::setApplicationName("g733hotplug");
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+
+    QProcess daemon;
+    daemon.start("dbus-daemon", { "--session", "--nofork", "--print-address" });
+    if( !daemon.waitForStarted() || !daemon.waitForReadyRead() )
+    {
+        fprintf(stderr, "Failed to start a private dbus-daemon.\n");
+        return 1;
+    }
+    QString address = QString::fromLocal8Bit(daemon.readLine()).trimmed();
+
+    QDBusConnection bus = QDBusConnection::connectToBus(address, "g733hotplug");
+    if( !bus.isConnected() )
+    {
+        fprintf(stderr, "Failed to connect to %s\n", qPrintable(address));
+        return 1;
+    }
+
+    FakeHotplugMonitor monitor;
+    SimulatedManager *manager = new SimulatedManager(&monitor, bus);
+    int added = 0;
+    int removed = 0;
+    QObject::connect( manager, &HeadsetManager::headsetAdded, [&added](){ added++; } );
+    QObject::connect( manager, &HeadsetManager::headsetRemoved, [&removed](){ removed++; } );
+
+    const QString first = "/dev/hidraw1";
+    const QString second = "/dev/hidraw2";
+    const QString firstObject = HEADSET_PATH_PREFIX "hidraw1";
+    manager->start();
+
+    // Served once it opened, and the one on "/".
+    monitor.plug(first);
+    bool ok = expect("add", settle([&]() { return manager->objectPaths() == QStringList{firstObject}; })
+                     && manager->primary() == manager->headset(firstObject) && added == 1, manager->objectPaths());
+
+    // Off the bus right away, the headset goes with its thread.
+    monitor.unplug(first);
+    ok = expect("remove", manager->objectPaths().isEmpty() && !manager->primary() && removed == 1
+                && settle([]() { return g_headsets == 0; }), manager->objectPaths()) && ok;
+
+    // Its open() is still queued, the headset never shows up.
+    monitor.plug(second);
+    monitor.unplug(second);
+    ok = expect("remove while opening", settle([]() { return g_headsets == 0; })
+                && manager->objectPaths().isEmpty() && added == 1, manager->objectPaths()) && ok;
+
+    // A new HeadsetHID for the same node.
+    monitor.plug(first);
+    ok = expect("re-add", settle([&]() { return manager->objectPaths() == QStringList{firstObject}; })
+                && added == 2 && g_headsets == 1, manager->objectPaths()) && ok;
+
+    // A failed write closes it. The node is still there, so it's dropped and
+    // opened again rather than left dead until replugged.
+    HeadsetHID *hid = manager->headset(firstObject);
+    g_failWrite = true;
+    hid->setSidetone(hid->sidetone() == 50 ? 60 : 50);
+    ok = expect("write failed", settle([&]() { return removed == 2; }) && manager->objectPaths().isEmpty(),
+                manager->objectPaths()) && ok;
+    ok = expect("reopened", settle([&]() { return added == 3 && g_headsets == 1; })
+                && manager->objectPaths() == QStringList{firstObject}, manager->objectPaths()) && ok;
+
+    // Once it's gone, a failed write isn't retried.
+    g_failWrite = true;
+    manager->headset(firstObject)->setSidetone(70);
+    settle([&]() { return removed == 3; });
+    monitor.unplug(first);
+    settle([]() { return g_headsets == 0; });
+    QEventLoop loop;
+    QTimer::singleShot(REOPEN_DELAY + 200, &loop, &QEventLoop::quit);
+    loop.exec();
+    ok = expect("write failed, unplugged", manager->objectPaths().isEmpty() && g_headsets == 0 && added == 3,
+                manager->objectPaths()) && ok;
+
+    // Shutting down with one open closes it before returning.
+    monitor.plug(second);
+    settle([&]() { return added == 4; });
+    delete manager;
+    ok = expect("shutdown", g_headsets == 0, QStringList()) && ok;
+
+    daemon.terminate();
+    daemon.waitForFinished();
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,8 @@
+# Counts the lighting writes a sequence of calls makes against a simulated
+# headset. "make check" runs it.
+TARGET = g733lighting
+CONFIG += testcase
+
+include(../daemon.pri)
+
+SOURCES += main.cpp
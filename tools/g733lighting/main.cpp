@@ -0,0 +1,210 @@
+#include <QCoreApplication>
+#include <QEventLoop>
+#include <QSettings>
+#include <QTimer>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "headsethid.h"
+#include "hidtransport.h"
+#include "lightingengine.h"
+#include "scratchhome.h"
+
+#define LIGHTING_INDEX  0x04    // where SimulatedTransport puts the lighting feature
+#define READY_TIMEOUT   2000    // ms
+
+// Lighting writes per zone, kept across transports so a reconnect counts too.
+typedef struct {
+    int         writes[LightingZoneCount];
+    QByteArray  last[LightingZoneCount];
+} Tally;
+
+// Counts the lighting writes and can hold back their replies, so a write
+// stays in flight while more changes are made. Everything else is answered
+// as SimulatedTransport does.
+class CountingTransport : public SimulatedTransport
+{
+    Tally       *m_tally;
+    bool        m_hold;
+    QList<QByteArray> m_held;
+
+public:
+    explicit CountingTransport(Tally *tally)
+        : m_tally{tally},
+          m_hold{false}
+    {
+    }
+
+    int write(const quint8 *data, int length) override
+    {
+        // 11 ff <index> 3c <zone> ..., setEffect is function 3.
+        if( length < 5 || data[2] != LIGHTING_INDEX || data[3] >> 4 != 3 || data[4] >= LightingZoneCount )
+            return SimulatedTransport::write(data, length);
+
+        const QByteArray report(reinterpret_cast<const char *>(data), length);
+        m_tally->writes[data[4]]++;
+        m_tally->last[data[4]] = report;
+        if( m_hold )
+        {
+            m_held.push_back(report);
+            return length;
+        }
+        return SimulatedTransport::write(data, length);
+    }
+
+    void hold()
+    {
+        m_hold = true;
+    }
+
+    // Writes go out now and are answered as usual.
+    void release()
+    {
+        m_hold = false;
+        const QList<QByteArray> held = m_held;
+        m_held.clear();
+        for( const QByteArray &report : held )
+            SimulatedTransport::write(reinterpret_cast<const quint8 *>(report.constData()), report.size());
+    }
+};
+
+static void spin(int ms)
+{
+    QEventLoop loop;
+    QTimer::singleShot(ms, &loop, &QEventLoop::quit);
+    loop.exec();
+}
+
+static LightingEffect effect(int mode, quint32 color)
+{
+    LightingEffect e = LightingEngine::offEffect();
+    e.mode = mode;
+    e.color = color;
+    e.period = mode == LightingStatic ? 0 : 2000;
+    e.brightness = 100;
+    return e;
+}
+
+static bool open(HeadsetHID *hid, Tally *tally, CountingTransport **transport)
+{
+    *transport = new CountingTransport(tally);
+    hid->setTransport(*transport);
+    if( !hid->open("simulated") )
+        return false;
+
+    // Lighting waits for feature discovery, which is done by the first reading.
+    for( int waited=0; hid->state().timeToReady < 0 && waited < READY_TIMEOUT; waited += 10 )
+        spin(10);
+    return hid->state().timeToReady >= 0;
+}
+
+// Compares the writes since the last step with what the step should cost.
+static bool expect(Tally &tally, const char *step, int logo, int strips)
+{
+    const bool ok = tally.writes[LightingLogo] == logo && tally.writes[LightingStrips] == strips;
+    printf("%-24s logo %d strips %d%s\n", step, tally.writes[LightingLogo], tally.writes[LightingStrips],
+           ok ? "" : qPrintable(QString("  expected %1 and %2").arg(logo).arg(strips)));
+    tally.writes[LightingLogo] = tally.writes[LightingStrips] = 0;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    ScratchHome home;
+
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setOrganizationName("g733lighting");
+    QCoreApplication::setApplicationName("g733lighting");
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+
+    // On this thread, so each step runs to completion in spin().
+    Tally tally{};
+    HeadsetHID *hid = new HeadsetHID;
+    CountingTransport *transport = nullptr;
+    if( !open(hid, &tally, &transport) )
+    {
+        fprintf(stderr, "Failed to open the simulated headset.\n");
+        return 1;
+    }
+
+    const LightingEffect red = effect(LightingStatic, 0xff0000);
+    bool ok = expect(tally, "open", 0, 0);
+
+    hid->enableLighting(true);
+    spin(50);
+    ok = expect(tally, "lighting on", 1, 1) && ok;
+
+    hid->enableLighting(true);
+    spin(50);
+    ok = expect(tally, "lighting on again", 0, 0) && ok;
+
+    hid->setZoneEffect(LightingLogo, red);
+    spin(50);
+    ok = expect(tally, "logo red", 1, 0) && ok;
+
+    hid->setZoneEffect(LightingLogo, red);
+    spin(50);
+    ok = expect(tally, "logo red again", 0, 0) && ok;
+
+    // Answered well inside REQUEST_TIMEOUT, a resend would count as a write.
+    transport->hold();
+    hid->setZoneEffect(LightingStrips, effect(LightingStatic, 0x00ff00));
+    spin(20);
+    hid->setZoneEffect(LightingStrips, effect(LightingStatic, 0x0000ff));
+    hid->setZoneEffect(LightingStrips, effect(LightingBreathing, 0x0000ff));
+    hid->setZoneEffect(LightingStrips, effect(LightingStatic, 0xffffff));
+    spin(20);
+    ok = expect(tally, "strips, write held", 0, 1) && ok;
+    transport->release();
+    spin(50);
+    ok = expect(tally, "strips, released", 0, 1) && ok;
+
+    // The follow-up carries the last change, not one of those in between.
+    const QByteArray &last = tally.last[LightingStrips];
+    if( last.size() < 9 || quint8(last[5]) != LightingStatic || (quint8(last[6]) & quint8(last[7]) & quint8(last[8])) != 0xff )
+    {
+        printf("The strips were last written %s, not static white.\n", last.toHex(' ').constData());
+        ok = false;
+    }
+
+    // Both applied before the queued write goes out.
+    hid->setZoneEffect(LightingLogo, effect(LightingStatic, 0x00ff00));
+    hid->setZoneEffect(LightingLogo, red);
+    spin(50);
+    ok = expect(tally, "logo changed and back", 0, 0) && ok;
+
+    // At most one frame per LIGHTING_FRAME_INTERVAL, and not none.
+    const int animated = 1000;
+    hid->setZoneEffect(LightingLogo, effect(LightingCycle, 0));
+    spin(animated);
+    const int frames = tally.writes[LightingLogo];
+    if( frames < 1 || frames > animated / LIGHTING_FRAME_INTERVAL + 1 )
+    {
+        printf("%-24s logo %d, expected 1 to %d\n", "logo cycle", frames, animated / LIGHTING_FRAME_INTERVAL + 1);
+        ok = false;
+    }
+    else
+        printf("%-24s logo %d\n", "logo cycle", frames);
+    tally.writes[LightingLogo] = tally.writes[LightingStrips] = 0;
+
+    hid->setZoneEffect(LightingLogo, red);
+    spin(50 + LIGHTING_FRAME_INTERVAL);
+    tally.writes[LightingLogo] = tally.writes[LightingStrips] = 0;
+
+    // A new receiver knows nothing, both zones go back out once.
+    hid->close();
+    if( !open(hid, &tally, &transport) )
+    {
+        fprintf(stderr, "Failed to reopen the simulated headset.\n");
+        return 1;
+    }
+    spin(50);
+    ok = expect(tally, "reopened", 1, 1) && ok;
+
+    hid->close();
+    delete hid;
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,8 @@
+# Hammers the state getters from several threads while a simulated headset
+# stalls the I/O thread. "make check" runs it.
+TARGET = g733stress
+CONFIG += testcase
+
+include(../daemon.pri)
+
+SOURCES += main.cpp
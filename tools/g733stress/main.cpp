@@ -0,0 +1,223 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QMap>
+#include <QSettings>
+#include <QThread>
+
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <stdio.h>
+#include <thread>
+#include <vector>
+
+#include "headsethid.h"
+#include "hidtransport.h"
+#include "scratchhome.h"
+
+static qint64 now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+typedef enum {
+    GetState,
+    GetVoltage,
+    GetSoc,
+    GetOnline,
+    GetChanges,
+    PostCommand,
+    CallCount
+} Call;
+
+static const char *callNames[CallCount] = { "state", "voltage", "soc", "online", "changesSince", "command" };
+
+// What one thread saw. Sequences and versions only ever go forward.
+typedef struct {
+    quint64 calls[CallCount];
+    qint64  worst[CallCount];   // ns
+    quint64 regressions;
+} Tally;
+
+static void timed(Tally &t, Call c, qint64 started)
+{
+    const qint64 took = now() - started;
+    t.calls[c]++;
+    if( took > t.worst[c] )
+        t.worst[c] = took;
+}
+
+static void reader(HeadsetHID *hid, const std::atomic<bool> &stop, Tally &t)
+{
+    t = Tally{};
+    quint64 lastVersion = 0;
+    quint64 lastSequence = 0;
+    quint64 lastChanges = 0;
+    QMap<int, qint32> changes;
+
+    while( !stop.load(std::memory_order_relaxed) )
+    {
+        quint64 version = 0;
+        qint64 started = now();
+        HeadsetState st = hid->state(&version);
+        timed(t, GetState, started);
+        if( version < lastVersion || st.sequence < lastSequence )
+            t.regressions++;
+        lastVersion = version;
+        lastSequence = st.sequence;
+
+        started = now();
+        hid->voltage();
+        timed(t, GetVoltage, started);
+
+        started = now();
+        hid->soc();
+        timed(t, GetSoc, started);
+
+        started = now();
+        hid->online();
+        timed(t, GetOnline, started);
+
+        quint64 current = 0;
+        changes.clear();
+        started = now();
+        hid->changesSince(lastChanges, changes, &current);
+        timed(t, GetChanges, started);
+        if( current < lastChanges )
+            t.regressions++;
+        lastChanges = current;
+    }
+}
+
+// The one producer of commands, like the D-Bus thread. Every command ends up
+// as a write, so the I/O thread is kept stalling.
+static void commander(HeadsetHID *hid, SimulatedTransport *sim, int stall, const std::atomic<bool> &stop, Tally &t)
+{
+    t = Tally{};
+    std::mt19937 rng(733);
+    int round = 0;
+
+    while( !stop.load(std::memory_order_relaxed) )
+    {
+        // Stalls come and go every 25 rounds.
+        if( round % 25 == 0 )
+        {
+            sim->setStall((round / 25) % 2 ? 0 : stall);
+            sim->setVoltage(3600 + int(rng() % 500));
+        }
+
+        qint64 started = now();
+        if( round % 5 == 0 )
+            hid->enableLighting(round % 10 == 0);
+        else
+            hid->setSidetone(int(rng() % 101));
+        timed(t, PostCommand, started);
+
+        round++;
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    ScratchHome home;
+
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setOrganizationName("g733stress");
+    QCoreApplication::setApplicationName("g733stress");
+    QSettings::setDefaultFormat(QSettings::IniFormat);
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Hammers the g733daemon state getters while the headset I/O stalls.");
+    parser.addHelpOption();
+    QCommandLineOption durationOption("duration", "How long to run, in seconds.", "s", "5");
+    QCommandLineOption readersOption("readers", "Threads calling the getters.", "count", "4");
+    QCommandLineOption stallOption("stall", "How long each write blocks while stalling, in ms.", "ms", "200");
+    QCommandLineOption limitOption("limit", "Slowest getter or command allowed, in ms.", "ms", "20");
+    parser.addOption(durationOption);
+    parser.addOption(readersOption);
+    parser.addOption(stallOption);
+    parser.addOption(limitOption);
+    parser.process(a);
+
+    const int duration = qMax(1, parser.value(durationOption).toInt());
+    const int readers = qMax(1, parser.value(readersOption).toInt());
+    const int stall = qMax(1, parser.value(stallOption).toInt());
+    const qint64 limit = qMax(1, parser.value(limitOption).toInt()) * 1000000LL;
+
+    QThread io;
+    io.setObjectName("hid-io");
+    io.start();
+
+    HeadsetHID *hid = new HeadsetHID;
+    SimulatedTransport *sim = new SimulatedTransport;
+    hid->setTransport(sim);
+    hid->moveToThread(&io);
+
+    bool opened = false;
+    QMetaObject::invokeMethod( hid, [hid, &opened]() {
+        opened = hid->open("simulated");
+    }, Qt::BlockingQueuedConnection );
+    if( !opened )
+    {
+        fprintf(stderr, "Failed to open the simulated headset.\n");
+        return 1;
+    }
+
+    std::atomic<bool> stop{false};
+    std::vector<Tally> tallies(readers + 1);
+    std::vector<std::thread> threads;
+    for( int i=0; i < readers; i++ )
+        threads.emplace_back(reader, hid, std::cref(stop), std::ref(tallies[i]));
+    threads.emplace_back(commander, hid, sim, stall, std::cref(stop), std::ref(tallies[readers]));
+
+    std::this_thread::sleep_for(std::chrono::seconds(duration));
+    stop.store(true);
+    for( std::thread &t : threads )
+        t.join();
+
+    // The transport goes with the headset.
+    sim->setStall(0);
+    const quint64 stalled = sim->stalledWrites();
+    const quint64 sequence = hid->state().sequence;
+    QMetaObject::invokeMethod( hid, [hid]() {
+        hid->close();
+        hid->deleteLater();
+    }, Qt::BlockingQueuedConnection );
+    io.quit();
+    io.wait();
+
+    Tally total{};
+    for( const Tally &t : tallies )
+    {
+        for( int c=0; c < CallCount; c++ )
+        {
+            total.calls[c] += t.calls[c];
+            total.worst[c] = qMax(total.worst[c], t.worst[c]);
+        }
+        total.regressions += t.regressions;
+    }
+
+    bool ok = true;
+    printf("stalled writes %llu of %d ms, state sequence %llu\n", (unsigned long long)stalled, stall, (unsigned long long)sequence);
+    for( int c=0; c < CallCount; c++ )
+    {
+        const bool slow = total.worst[c] > limit;
+        printf("%-14s %10llu calls, slowest %8.1f µs%s\n", callNames[c], (unsigned long long)total.calls[c],
+               total.worst[c] / 1000.0, slow ? "  TOO SLOW" : "");
+        ok = ok && !slow;
+    }
+    if( total.regressions )
+    {
+        printf("%llu reads went back in sequence\n", (unsigned long long)total.regressions);
+        ok = false;
+    }
+    if( stalled == 0 )
+    {
+        printf("The I/O thread never stalled, nothing was tested.\n");
+        ok = false;
+    }
+
+    printf("%s\n", ok ? "ok" : "FAILED");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,17 @@
+QT -= gui
+
+CONFIG += c++17 console
+CONFIG -= app_bundle
+
+# Renders a trace ring dump written on SIGUSR1 or by DumpTrace().
+TARGET = g733trace
+
+ROOT = $$PWD/../..
+INCLUDEPATH += $$ROOT
+
+SOURCES += \
+        main.cpp \
+        $$ROOT/tracering.cpp
+
+HEADERS += \
+    $$ROOT/tracering.h
@@ -0,0 +1,107 @@
+#include <QCommandLineParser>
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QFile>
+#include <QString>
+
+#include <stdio.h>
+#include <string.h>
+
+#include "tracering.h"
+
+static QString describe(const TraceEntry &r)
+{
+    QString text = QString::fromLatin1(traceEventFormat(r.event));
+    for( int i=0; i < 3; i++ )
+    {
+        const QString tag = QString("%%1").arg(i + 1);
+        if( !text.contains(tag) )
+            continue;
+
+        // Raw report bytes read better in hex.
+        if( r.event == TraceUnknownReport && i > 0 )
+            text.replace(tag, QString("%1").arg(r.args[i], 8, 16, QChar('0')));
+        else
+            text.replace(tag, QString::number(r.args[i]));
+    }
+    return text;
+}
+
+int main(int argc, char *argv[])
+{
+    QCoreApplication a(argc, argv);
+    QCoreApplication::setApplicationName("g733trace");
+
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Renders a g733daemon trace ring dump.");
+    parser.addHelpOption();
+    parser.addPositionalArgument("dump", "File written on SIGUSR1 or by DumpTrace().");
+    QCommandLineOption wallOption("wall", "Print wall clock times instead of seconds since the first record.");
+    QCommandLineOption levelOption("level", "Only show records at or below this level (0 error, 1 info, 2 debug).", "level", "2");
+    parser.addOption(wallOption);
+    parser.addOption(levelOption);
+    parser.process(a);
+
+    const QStringList args = parser.positionalArguments();
+    if( args.size() != 1 )
+        parser.showHelp(1);
+
+    QFile f(args.first());
+    if( !f.open(QIODevice::ReadOnly) )
+    {
+        fprintf(stderr, "%s: %s\n", qPrintable(args.first()), qPrintable(f.errorString()));
+        return 1;
+    }
+
+    TraceDumpHeader header;
+    if( f.read(reinterpret_cast<char *>(&header), sizeof(header)) != sizeof(header)
+        || memcmp(header.magic, TRACE_MAGIC_DUMP, sizeof(header.magic)) != 0 )
+    {
+        fprintf(stderr, "%s: Not a trace dump.\n", qPrintable(args.first()));
+        return 1;
+    }
+    if( header.version != TRACE_DUMP_VERSION || header.recordSize != sizeof(TraceEntry) )
+    {
+        fprintf(stderr, "%s: Unsupported dump version %u.\n", qPrintable(args.first()), header.version);
+        return 1;
+    }
+
+    const int maxLevel = parser.value(levelOption).toInt();
+    const bool wall = parser.isSet(wallOption);
+
+    qint64 first = -1;
+    quint64 expected = 0;
+    TraceEntry r;
+    for( quint64 n=0; n < header.count; n++ )
+    {
+        if( f.read(reinterpret_cast<char *>(&r), sizeof(r)) != sizeof(r) )
+        {
+            fprintf(stderr, "%s: Truncated after %llu records.\n", qPrintable(args.first()), (unsigned long long)n);
+            return 1;
+        }
+
+        if( n > 0 && r.index != expected )
+            printf("... %llu records lost\n", (unsigned long long)(r.index - expected));
+        expected = r.index + 1;
+
+        if( r.level > maxLevel )
+            continue;
+
+        QString when;
+        if( wall )
+        {
+            const qint64 ms = header.wallTime - (header.monoTime - r.time) / 1000000;
+            when = QDateTime::fromMSecsSinceEpoch(ms).toString("yyyy-MM-dd HH:mm:ss.zzz");
+        }
+        else
+        {
+            if( first < 0 )
+                first = r.time;
+            when = QString::number((r.time - first) / 1e9, 'f', 6);
+        }
+
+        printf("%s %s %-16s %s\n", qPrintable(when), traceLevelName(r.level), traceEventName(r.event), qPrintable(describe(r)));
+    }
+
+    return 0;
+}
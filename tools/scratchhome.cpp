@@ -0,0 +1,10 @@
+#include "scratchhome.h"
+
+#include <QtGlobal>
+
+ScratchHome::ScratchHome()
+{
+    qputenv("XDG_CONFIG_HOME", m_dir.filePath("config").toLocal8Bit());
+    qputenv("XDG_DATA_HOME", m_dir.filePath("data").toLocal8Bit());
+    qputenv("XDG_CACHE_HOME", m_dir.filePath("cache").toLocal8Bit());
+}
@@ -0,0 +1,18 @@
+#ifndef SCRATCHHOME_H
+#define SCRATCHHOME_H
+
+#include <QTemporaryDir>
+
+// Points the XDG config, data and cache locations into a temporary
+// directory for as long as it lives, so a tool running HeadsetHID never
+// touches the daemon's settings, history or feature cache. Create it before
+// the QCoreApplication.
+class ScratchHome
+{
+    QTemporaryDir   m_dir;
+
+public:
+    ScratchHome();
+};
+
+#endif // SCRATCHHOME_H
@@ -0,0 +1,219 @@
+#include "tracering.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSocketNotifier>
+#include <QStandardPaths>
+
+#include <chrono>
+#include <vector>
+
+#include <errno.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+static_assert((TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)) == 0, "TRACE_RING_SIZE must be a power of two");
+static_assert(sizeof(TraceEntry) == 32, "TraceEntry is part of the dump format");
+
+typedef struct {
+    const char *name;
+    const char *format;     // %1..%3 are the arguments
+} TraceEventInfo;
+
+static constexpr TraceEventInfo events[TraceEventCount] = {
+    { "opened",             "featuresCached=%1" },
+    { "closed",             "" },
+    { "ready",              "after=%1ms featuresCached=%2" },
+    { "sleep",              "" },
+    { "wake",               "" },
+    { "lighting",           "zone=%1 mode=%2" },
+    { "lighting-restore",   "zone=%1" },
+    { "voltage",            "mV=%1 charging=%2 soc=%3" },
+    { "request",            "type=%1 index=%2 function=%3" },
+    { "reply",              "type=%1 latency=%2us" },
+    { "error-reply",        "type=%1 error=%2" },
+    { "retry",              "type=%1 retries=%2" },
+    { "timeout",            "type=%1" },
+    { "write-failed",       "type=%1" },
+    { "no-software-id",     "type=%1" },
+    { "unknown-report",     "length=%1 data=%2 %3" },
+    { "command-dropped",    "command=%1" },
+    { "wake-failed",        "errno=%1" },
+    { "buttons",            "mask=%1" },
+    { "button-actions",     "mask=%1 actions=%2 latency=%3us" },
+    { "sidetone",           "level=%1" },
+    { "restored",           "after=%1ms writes=%2" },
+};
+
+const char *traceEventName(int event)
+{
+    if( event < 0 || event >= TraceEventCount )
+        return "?";
+    return events[event].name;
+}
+
+const char *traceEventFormat(int event)
+{
+    if( event < 0 || event >= TraceEventCount )
+        return "%1 %2 %3";
+    return events[event].format;
+}
+
+const char *traceLevelName(int level)
+{
+    switch( level )
+    {
+    case TRACE_ERROR:   return "E";
+    case TRACE_INFO:    return "I";
+    case TRACE_DEBUG:   return "D";
+    }
+    return "?";
+}
+
+static qint64 steadyNow()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+TraceRing::TraceRing()
+    : m_head{0}
+{
+    for( Slot &s : m_slots )
+        s.seq.store(0, std::memory_order_relaxed);
+}
+
+TraceRing &TraceRing::instance()
+{
+    static TraceRing ring;
+    return ring;
+}
+
+void TraceRing::record(int level, int event, quint32 a, quint32 b, quint32 c)
+{
+    const quint64 index = m_head.fetch_add(1, std::memory_order_relaxed);
+    Slot &s = m_slots[index & (TRACE_RING_SIZE - 1)];
+
+    s.seq.store(2 * index + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    s.time.store(steadyNow(), std::memory_order_relaxed);
+    s.meta.store(quint64(quint16(event)) << 16 | quint8(level), std::memory_order_relaxed);
+    s.args01.store(quint64(a) << 32 | b, std::memory_order_relaxed);
+    s.args2.store(c, std::memory_order_relaxed);
+    s.seq.store(2 * (index + 1), std::memory_order_release);
+}
+
+bool TraceRing::dump(const QString &path) const
+{
+    const quint64 head = m_head.load(std::memory_order_acquire);
+    const quint64 first = head > TRACE_RING_SIZE ? head - TRACE_RING_SIZE : 0;
+
+    std::vector<TraceEntry> records;
+    records.reserve(head - first);
+    for( quint64 index=first; index < head; index++ )
+    {
+        const Slot &s = m_slots[index & (TRACE_RING_SIZE - 1)];
+        const quint64 seq = s.seq.load(std::memory_order_acquire);
+        if( seq != 2 * (index + 1) )
+            continue;
+
+        TraceEntry r;
+        r.index = index;
+        r.time = s.time.load(std::memory_order_relaxed);
+        const quint64 meta = s.meta.load(std::memory_order_relaxed);
+        const quint64 args01 = s.args01.load(std::memory_order_relaxed);
+        r.args[2] = quint32(s.args2.load(std::memory_order_relaxed));
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if( s.seq.load(std::memory_order_relaxed) != seq )
+            continue;
+
+        r.event = quint16(meta >> 16);
+        r.level = quint8(meta);
+        r.reserved = 0;
+        r.args[0] = quint32(args01 >> 32);
+        r.args[1] = quint32(args01);
+        records.push_back(r);
+    }
+
+    TraceDumpHeader header;
+    memcpy(header.magic, TRACE_MAGIC_DUMP, sizeof(header.magic));
+    header.version = TRACE_DUMP_VERSION;
+    header.recordSize = sizeof(TraceEntry);
+    header.count = records.size();
+    header.wallTime = QDateTime::currentMSecsSinceEpoch();
+    header.monoTime = steadyNow();
+
+    QFile f(path);
+    if( !f.open(QIODevice::WriteOnly | QIODevice::Truncate) )
+    {
+        qDebug() << "TraceRing::dump(): Failed to open" << path << f.errorString();
+        return false;
+    }
+
+    const qint64 size = qint64(records.size() * sizeof(TraceEntry));
+    if( f.write(reinterpret_cast<const char *>(&header), sizeof(header)) != sizeof(header)
+        || f.write(reinterpret_cast<const char *>(records.data()), size) != size )
+    {
+        qDebug() << "TraceRing::dump(): Failed to write" << path << f.errorString();
+        return false;
+    }
+    return true;
+}
+
+QString TraceRing::defaultPath()
+{
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation);
+    QDir().mkpath(dir);
+    return QString("%1/trace-%2.bin").arg(dir).arg(QCoreApplication::applicationPid());
+}
+
+static int signalFd = -1;
+
+static void traceSignalHandler(int)
+{
+    const int saved = errno;
+    quint64 one = 1;
+    ssize_t r = ::write(signalFd, &one, sizeof(one));
+    Q_UNUSED(r);
+    errno = saved;
+}
+
+bool TraceRing::dumpOnSignal(int signum)
+{
+    if( signalFd < 0 )
+    {
+        signalFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if( signalFd < 0 )
+        {
+            qDebug() << "TraceRing::dumpOnSignal(): Failed to create an eventfd:" << strerror(errno);
+            return false;
+        }
+
+        QSocketNotifier *notifier = new QSocketNotifier(signalFd, QSocketNotifier::Read, QCoreApplication::instance());
+        QObject::connect(notifier, &QSocketNotifier::activated, notifier, []() {
+            quint64 count;
+            if( ::read(signalFd, &count, sizeof(count)) < 0 )
+                return;
+
+            const QString path = defaultPath();
+            if( instance().dump(path) )
+                qDebug() << "TraceRing: Dumped to" << path;
+        });
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = traceSignalHandler;
+    sa.sa_flags = SA_RESTART;
+    sigemptyset(&sa.sa_mask);
+    if( sigaction(signum, &sa, nullptr) < 0 )
+    {
+        qDebug() << "TraceRing::dumpOnSignal(): Failed to install the handler:" << strerror(errno);
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,114 @@
+#ifndef TRACERING_H
+#define TRACERING_H
+
+#include <QString>
+#include <QtGlobal>
+
+#include <atomic>
+
+#define TRACE_ERROR     0
+#define TRACE_INFO      1
+#define TRACE_DEBUG     2
+
+// Anything above this is compiled out, set with DEFINES += TRACE_LEVEL=n.
+#ifndef TRACE_LEVEL
+# define TRACE_LEVEL    TRACE_INFO
+#endif
+
+#define TRACE_RING_SIZE 8192    // records, a power of two
+#define TRACE_MAGIC_DUMP "G733RING"
+#define TRACE_DUMP_VERSION 1
+
+// Records an event with up to three integer arguments. Nothing is formatted
+// at the call site, g733trace renders a dump afterwards.
+#define TRACE(level, event, ...) \
+    do { if( (level) <= TRACE_LEVEL ) TraceRing::instance().record((level), (event), ##__VA_ARGS__); } while( 0 )
+
+// Argument meanings are listed in traceEventFormat().
+enum TraceEvent {
+    TraceOpened,            // featuresCached
+    TraceClosed,
+    TraceReady,             // ms since open, featuresCached
+    TraceSleep,
+    TraceWake,
+    TraceLighting,          // zone, mode
+    TraceLightingRestore,   // zone
+    TraceVoltage,           // mV, charging, soc
+    TraceRequestSent,       // request, feature index, function|swid
+    TraceReply,             // request, latency µs
+    TraceErrorReply,        // request, error code
+    TraceRetry,             // request, retries
+    TraceTimeout,           // request
+    TraceWriteFailed,       // request
+    TraceNoSoftwareId,      // request
+    TraceUnknownReport,     // length, bytes 0-3, bytes 4-7
+    TraceCommandDropped,    // command
+    TraceWakeFailed,        // errno
+    TraceButtons,           // mask
+    TraceButtonActions,     // mask, actions run, latency µs
+    TraceSidetone,          // level
+    TraceRestored,          // ms since the wake or open, writes
+    TraceEventCount
+};
+
+// As laid out in a dump file.
+#pragma pack(push, 1)
+typedef struct {
+    char    magic[8];
+    quint32 version;
+    quint32 recordSize;
+    quint64 count;
+    qint64  wallTime;       // ms since the epoch when dumped
+    qint64  monoTime;       // steady clock ns when dumped
+} TraceDumpHeader;
+
+typedef struct {
+    quint64 index;          // gaps mean records were overwritten mid-dump
+    qint64  time;           // steady clock ns
+    quint16 event;
+    quint8  level;
+    quint8  reserved;
+    quint32 args[3];
+} TraceEntry;
+#pragma pack(pop)
+
+const char *traceEventName(int event);
+const char *traceEventFormat(int event);
+const char *traceLevelName(int level);
+
+// Process wide ring of the last TRACE_RING_SIZE events. Any thread may
+// record, each slot is a small seqlock so a dump skips the ones being
+// written rather than copying them torn.
+class TraceRing
+{
+    struct Slot {
+        std::atomic<quint64> seq;   // 2 * (index + 1), odd while writing
+        std::atomic<qint64> time;
+        std::atomic<quint64> meta;  // event << 16 | level
+        std::atomic<quint64> args01;
+        std::atomic<quint64> args2;
+    };
+
+    std::atomic<quint64> m_head;
+    Slot m_slots[TRACE_RING_SIZE];
+
+    TraceRing();
+
+public:
+    static TraceRing &instance();
+
+    void record(int level, int event, quint32 a=0, quint32 b=0, quint32 c=0);
+
+    // Copies out the records still in the ring, oldest first, and writes them
+    // to path. Safe to call while other threads keep recording.
+    bool dump(const QString &path) const;
+
+    // <AppDataLocation>/trace-<pid>.bin
+    static QString defaultPath();
+
+    // Dumps to defaultPath() whenever the process gets signum. The handler
+    // only pokes an eventfd, the dump happens on the calling thread's loop.
+    static bool dumpOnSignal(int signum);
+};
+
+#endif // TRACERING_H